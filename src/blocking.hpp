@@ -0,0 +1,110 @@
+#ifndef __AHRI_BLOCKING_HPP__
+#define __AHRI_BLOCKING_HPP__
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+
+#include "coexecutor.h"
+#include "threadpool.h"
+
+// 阻塞调用线程池的最大线程数量，平时没有阻塞调用时不保留线程
+#define BLOCKING_POOL_MAX_THREADS 64
+
+namespace ahri {
+
+/**
+ * @brief 执行阻塞调用的线程池，第一次使用时启动。
+ * 阻塞调用通常很少但是会突然集中出现，线程池没有核心线程，按需增加线程，空闲一段时间后线程退出
+ *
+ * @return ThreadPoolExecutor&
+ */
+inline ThreadPoolExecutor &BlockingPool() {
+  static ThreadPoolExecutor pool(0, BLOCKING_POOL_MAX_THREADS, THREADPOOL_KEEP_ALIVE_MS);
+  static std::once_flag started;
+  std::call_once(started, []() { pool.Start(); });
+  return pool;
+}
+
+/**
+ * @brief 等待阻塞调用完成的协程和线程池任务共享的状态
+ *
+ */
+struct BlockingCallState {
+  CoExecutor::RecoveryEntry entry;
+  std::atomic<bool> done{false};
+};
+
+/**
+ * @brief 由线程池中的任务持有，任务执行完或者没有执行就被丢弃时析构，标记完成并唤醒等待的协程
+ *
+ */
+struct BlockingCallNotifier {
+  std::shared_ptr<BlockingCallState> state;
+
+  explicit BlockingCallNotifier(const std::shared_ptr<BlockingCallState> &s) : state(s) {}
+
+  ~BlockingCallNotifier() {
+    state->done = true;
+    CoExecutor::Wakeup(state->entry);
+  }
+};
+
+namespace this_coroutine {
+
+/**
+ * @brief 在线程池中执行会阻塞线程的函数，当前协程挂起直到函数完成，执行器在此期间继续执行其它协程
+ * 不在协程中时直接在当前线程中执行。等待期间忽略取消和超时，协程一直挂起到函数完成，不会阻塞执行器
+ *
+ * @param pool 执行函数的线程池，需要已经启动
+ * @param fn 阻塞的函数
+ * @return fn的返回值，fn中的异常会在协程中重新抛出
+ * @throw std::runtime_error 线程池已经停止，函数没有执行
+ */
+template <typename F>
+typename std::result_of<F()>::type RunBlocking(ThreadPoolExecutor &pool, F fn) {
+  typedef typename std::result_of<F()>::type R;
+  if (!CoExecutor::GetCurrentTask()) {
+    return fn();
+  }
+  std::shared_ptr<std::packaged_task<R()>> task = std::make_shared<std::packaged_task<R()>>(std::move(fn));
+  std::future<R> fut = task->get_future();
+  // 唤醒入口由线程池中的任务共同持有，线程池丢弃任务时也会唤醒协程
+  std::shared_ptr<BlockingCallState> state =
+      std::allocate_shared<BlockingCallState>(SlabAllocator<BlockingCallState>());
+  bool accepted = false;
+  CoExecutor::HoldUninterruptibly(state->entry, [&pool, &task, &state, &accepted]() {
+    std::shared_ptr<BlockingCallNotifier> notifier = std::make_shared<BlockingCallNotifier>(state);
+    accepted = pool.SchedulerTask([task, notifier]() { (*task)(); });
+  });
+  while (!state->done) {
+    // 完成之前被其它原因唤醒，重新挂起；完成标记在挂起之后再检查一次，避免错过唤醒
+    CoExecutor::HoldUninterruptibly(state->entry, [&state]() {
+      if (state->done) {
+        CoExecutor::Wakeup(state->entry);
+      }
+    });
+  }
+  if (!accepted) {
+    throw std::runtime_error("RunBlocking: thread pool is stopped");
+  }
+  return fut.get();
+}
+
+/**
+ * @brief 在公共的阻塞调用线程池BlockingPool()中执行阻塞的函数，详见RunBlocking(pool, fn)
+ *
+ */
+template <typename F>
+typename std::result_of<F()>::type RunBlocking(F fn) {
+  return RunBlocking(BlockingPool(), std::move(fn));
+}
+
+} // namespace this_coroutine
+
+} // namespace src
+
+#endif
@@ -0,0 +1,53 @@
+#include "cancellation.h"
+
+namespace ahri {
+
+CancellationToken CancellationToken::Create() {
+  CancellationToken token;
+  token.m_state = std::make_shared<State>();
+  return token;
+}
+
+void CancellationToken::Cancel() {
+  if (!m_state) {
+    return;
+  }
+  std::map<uint64_t, Callback> callbacks;
+  {
+    std::lock_guard<std::mutex> lk(m_state->mtx);
+    if (m_state->cancelled.exchange(true)) {
+      return;
+    }
+    callbacks.swap(m_state->callbacks);
+  }
+  // 在锁外调用回调，回调中可能会再次操作令牌
+  for (auto &item : callbacks) {
+    item.second();
+  }
+}
+
+uint64_t CancellationToken::Register(Callback cb) {
+  if (!m_state || !cb) {
+    return 0;
+  }
+  {
+    std::lock_guard<std::mutex> lk(m_state->mtx);
+    if (!m_state->cancelled) {
+      uint64_t id = m_state->next_id++;
+      m_state->callbacks[id] = std::move(cb);
+      return id;
+    }
+  }
+  cb();
+  return 0;
+}
+
+void CancellationToken::Unregister(uint64_t id) {
+  if (!m_state || id == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lk(m_state->mtx);
+  m_state->callbacks.erase(id);
+}
+
+} // namespace src
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace ahri {
+
+/**
+ * @brief 取消令牌，多个任务可以共享同一个令牌
+ * 默认构造的令牌为空令牌，永远不会被取消；需要通过Create()创建一个可以取消的令牌
+ *
+ */
+class CancellationToken {
+public:
+  typedef std::function<void()> Callback;
+
+  CancellationToken() {}
+
+  /**
+   * @brief 创建一个可以被取消的令牌
+   *
+   * @return CancellationToken
+   */
+  static CancellationToken Create();
+
+  /**
+   * @brief 是否是可以被取消的令牌
+   *
+   * @return true
+   * @return false
+   */
+  bool Valid() const { return m_state != nullptr; }
+
+  /**
+   * @brief 是否已经被取消
+   *
+   * @return true
+   * @return false
+   */
+  bool IsCancelled() const { return m_state && m_state->cancelled.load(std::memory_order_acquire); }
+
+  /**
+   * @brief 取消令牌，并且调用所有注册的回调函数，重复调用无效
+   *
+   */
+  void Cancel();
+
+  /**
+   * @brief 注册取消时的回调函数，如果已经取消了则立即调用
+   *
+   * @param cb 回调函数
+   * @return uint64_t 回调函数的id，用于取消注册；为0表示没有注册
+   */
+  uint64_t Register(Callback cb);
+
+  /**
+   * @brief 取消注册回调函数
+   *
+   * @param id Register返回的id
+   */
+  void Unregister(uint64_t id);
+
+private:
+  struct State {
+    std::atomic_bool cancelled{false};
+    std::mutex mtx;
+    uint64_t next_id = 1;
+    std::map<uint64_t, Callback> callbacks;
+  };
+
+  std::shared_ptr<State> m_state;
+};
+
+} // namespace src
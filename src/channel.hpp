@@ -0,0 +1,213 @@
+#ifndef __AHRI_CHANNEL_HPP__
+#define __AHRI_CHANNEL_HPP__
+
+#include <atomic>
+#include <condition_variable>
+#include <iterator>
+#include <mutex>
+#include <thread>
+
+#include "coexecutor.h"
+#include "containers.hpp"
+
+namespace ahri {
+
+/**
+ * @brief 在SpscRing上增加等待的单生产者单消费者通道
+ * 队列为空时消费者协程通过CoExecutor::Hold挂起，不占用执行器；不在协程中时在条件变量上等待。
+ * 生产者每次发布后检查消费者是否在等待，只有消费者真正挂起时才需要加锁唤醒；队列满时生产者让出后重试
+ *
+ * @tparam T 可以是只能移动的类型
+ */
+template <typename T>
+class SpscChannel {
+public:
+  /**
+   * @brief 创建通道
+   *
+   * @param capacity 容量，会向上取整到2的幂
+   */
+  explicit SpscChannel(size_t capacity) : m_ring(capacity) {}
+
+  SpscChannel(const SpscChannel &) = delete;
+
+  SpscChannel &operator=(const SpscChannel &) = delete;
+
+  /**
+   * @brief 放入元素，只能在生产者中调用，队列满时让出直到放入
+   *
+   * @return true
+   * @return false 通道已经关闭
+   */
+  bool Push(T value) {
+    while (!m_closed.load(std::memory_order_acquire)) {
+      if (m_ring.TryPush(std::move(value))) {
+        NotifyConsumer();
+        return true;
+      }
+      Backoff();
+    }
+    return false;
+  }
+
+  /**
+   * @brief 放入[first, last)中的所有元素，每批只通知一次消费者
+   *
+   * @return size_t 放入的数量，通道关闭时可能少于区间的长度
+   */
+  template <typename Iterator>
+  size_t PushBatch(Iterator first, Iterator last) {
+    size_t total = 0;
+    while (first != last && !m_closed.load(std::memory_order_acquire)) {
+      size_t n = m_ring.TryPushBatch(first, last);
+      if (n > 0) {
+        std::advance(first, n);
+        total += n;
+        NotifyConsumer();
+      } else {
+        Backoff();
+      }
+    }
+    return total;
+  }
+
+  /**
+   * @brief 取出元素，只能在消费者中调用，队列为空时等待
+   *
+   * @param out 取出的元素
+   * @return true
+   * @return false 通道已经关闭并且没有剩余的元素，或者等待的协程被取消、超时
+   */
+  bool Pop(T &out) { return WaitReadable() && m_ring.TryPop(out); }
+
+  /**
+   * @brief 取出最多max_count个元素，队列为空时等待
+   *
+   * @return size_t 取出的数量，为0的情况同Pop返回false
+   */
+  template <typename OutputIterator>
+  size_t PopBatch(OutputIterator out, size_t max_count) {
+    return WaitReadable() ? m_ring.TryPopBatch(out, max_count) : 0;
+  }
+
+  bool TryPop(T &out) { return m_ring.TryPop(out); }
+
+  /**
+   * @brief 关闭通道，之后的Push都会失败，消费者取完剩余的元素后Pop返回false
+   *
+   */
+  void Close() {
+    m_closed.store(true, std::memory_order_release);
+    NotifyConsumer();
+  }
+
+  bool IsClosed() const { return m_closed.load(std::memory_order_acquire); }
+
+  size_t Size() const { return m_ring.Size(); }
+
+  /**
+   * @brief 获取生产者唤醒消费者的次数
+   *
+   */
+  uint64_t GetWakeupCount() const { return m_wakeup_cnt.load(std::memory_order_relaxed); }
+
+private:
+  void Backoff() {
+    if (CoExecutor::GetCurrentTask()) {
+      this_coroutine::Yield();
+    } else {
+      std::this_thread::yield();
+    }
+  }
+
+  /**
+   * @brief 等到队列不为空
+   *
+   * @return false 通道已经关闭并且为空，或者协程被取消、超时
+   */
+  bool WaitReadable() {
+    for (;;) {
+      if (!m_ring.Empty()) {
+        return true;
+      }
+      if (m_closed.load(std::memory_order_acquire)) {
+        return !m_ring.Empty();
+      }
+      if (!Park()) {
+        return !m_ring.Empty();
+      }
+    }
+  }
+
+  /**
+   * @brief 挂起消费者直到生产者发布或者关闭通道
+   *
+   * @return false 协程因为取消或者超时被唤醒
+   */
+  bool Park() {
+    if (!CoExecutor::GetCurrentTask()) {
+      std::unique_lock<std::mutex> lk(m_mtx);
+      m_parked.store(true);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      m_cv.wait(lk, [this]() { return !m_ring.Empty() || m_closed.load(); });
+      m_parked.store(false);
+      return true;
+    }
+    CoExecutor::RecoveryEntry entry;
+    CoExecutor::HoldResult ret = CoExecutor::HoldThen(entry, [this, &entry]() {
+      // 协程已经换出，先登记再检查，和生产者发布后检查登记的顺序相反，不会丢失唤醒
+      std::unique_lock<std::mutex> lk(m_mtx);
+      m_entry = entry;
+      m_parked.store(true);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (!m_ring.Empty() || m_closed.load()) {
+        m_parked.store(false);
+        lk.unlock();
+        CoExecutor::Wakeup(entry);
+      }
+    });
+    // 被取消或者超时时生产者还没有唤醒，清除登记，之后的发布不会唤醒已经失效的入口
+    std::lock_guard<std::mutex> lk(m_mtx);
+    m_parked.store(false);
+    m_entry = CoExecutor::RecoveryEntry();
+    return ret == CoExecutor::AWOKEN;
+  }
+
+  void NotifyConsumer() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!m_parked.load(std::memory_order_relaxed)) {
+      return;
+    }
+    CoExecutor::RecoveryEntry entry;
+    {
+      std::lock_guard<std::mutex> lk(m_mtx);
+      if (!m_parked.load()) {
+        return;
+      }
+      m_parked.store(false);
+      entry = m_entry;
+      m_entry = CoExecutor::RecoveryEntry();
+      m_cv.notify_one();
+    }
+    m_wakeup_cnt.fetch_add(1, std::memory_order_relaxed);
+    if (entry) {
+      CoExecutor::Wakeup(entry);
+    }
+  }
+
+private:
+  SpscRing<T> m_ring;
+  std::atomic_bool m_closed{false};
+  // 消费者是否已经挂起或者正在等待条件变量
+  std::atomic_bool m_parked{false};
+  // 保护m_entry和条件变量
+  std::mutex m_mtx;
+  std::condition_variable m_cv;
+  // 挂起的消费者协程的恢复入口
+  CoExecutor::RecoveryEntry m_entry;
+  std::atomic<uint64_t> m_wakeup_cnt{0};
+};
+
+} // namespace src
+
+#endif
@@ -1,6 +1,9 @@
 #include <algorithm>
+#include <thread>
 
 #include "coexecutor.h"
+#include "thread.h"
+#include "topology.h"
 #include "utils.h"
 
 namespace ahri {
@@ -9,7 +12,24 @@ namespace ahri {
 // 主协程作为协程间切换的中介
 static thread_local Coroutine::Ptr st_master_co{new Coroutine};
 // 当前正在执行的协程
-static thread_local Coroutine::Ptr st_cur_co = nullptr;
+static thread_local Coroutine *st_cur_co = nullptr;
+
+CoExecutor::CoTask::~CoTask() {
+  if (handle != 0) {
+    TaskHandles().Unregister(handle);
+  }
+}
+
+HandleTable<CoExecutor::CoTask> &CoExecutor::TaskHandles() {
+  // 任务可能在静态变量析构之后才释放，句柄表不析构
+  static HandleTable<CoTask> *handles = new HandleTable<CoTask>();
+  return *handles;
+}
+
+bool CoExecutor::CoTask::Movable() const {
+  // 线程相关的任务一旦开始执行就只能在原来的线程中恢复
+  return !pinned && !(thread_affine && co->GetStatus() != Coroutine::Status::IDLE);
+}
 
 CoExecutor::CoExecutor(int32_t id) : m_id(id), m_waiting(true) {}
 
@@ -31,33 +51,103 @@ Coroutine *CoExecutor::GetMasterCo() {
   return st_master_co.get();
 }
 
-void CoExecutor::Hold(CoExecutor::RecoveryEntry &out) {
-  auto cur_executor = GetCurrentTask() ? GetCurrentTask()->proc : nullptr;
+CoExecutor::HoldResult CoExecutor::Hold(CoExecutor::RecoveryEntry &out) {
+  auto cur_task = GetCurrentTask();
+  CoExecutor *cur_executor = cur_task ? cur_task->proc.load() : nullptr;
   if (!cur_executor) {
-    return;
+    return AWOKEN;
+  }
+  // 已经取消或者超时了就不再挂起
+  if (cur_task->token.IsCancelled()) {
+    return CANCELLED;
+  }
+  if (cur_task->deadline_us != 0 && GetCurrentUs() >= cur_task->deadline_us) {
+    return TIMEDOUT;
   }
-  cur_executor->HoldThere(cur_executor->m_running_task, out);
+  cur_executor->HoldThere(cur_task, out);
+  return cur_task->hold_result;
 }
 
-void CoExecutor::HoldFor(const std::chrono::microseconds &dur) {
+CoExecutor::HoldResult CoExecutor::HoldThen(CoExecutor::RecoveryEntry &out, const std::function<void()> &after) {
+  auto cur_task = GetCurrentTask();
+  CoExecutor *cur_executor = cur_task ? cur_task->proc.load() : nullptr;
+  if (!cur_executor) {
+    after();
+    return AWOKEN;
+  }
+  // 换出之后由执行器调用，调用时协程的栈还在，可以修改局部变量
+  bool called = false;
+  cur_executor->m_after_hold = [&called, &after]() {
+    called = true;
+    after();
+  };
+  HoldResult ret = Hold(out);
+  if (!called) {
+    // 没有挂起，仍然在原来的执行器中
+    cur_executor->m_after_hold = nullptr;
+    after();
+  }
+  return ret;
+}
 
+void CoExecutor::HoldUninterruptibly(CoExecutor::RecoveryEntry &out, const std::function<void()> &after) {
+  auto cur_task = GetCurrentTask();
+  if (!cur_task) {
+    after();
+    return;
+  }
+  // 挂起期间暂时去掉令牌和截止时间，唤醒后恢复
+  CancellationToken token = cur_task->token;
+  cur_task->token = CancellationToken();
+  uint64_t deadline_us = cur_task->deadline_us;
+  cur_task->deadline_us = 0;
+  HoldThen(out, after);
+  cur_task->token = token;
+  cur_task->deadline_us = deadline_us;
 }
 
-void CoExecutor::HoldUntil(const TimePoint &tp) {
+CoExecutor::HoldResult CoExecutor::HoldFor(const std::chrono::microseconds &dur) {
+  return HoldUntil(std::chrono::high_resolution_clock::now() + dur);
+}
 
+CoExecutor::HoldResult CoExecutor::HoldUntil(const TimePoint &tp) {
+  auto cur_task = GetCurrentTask();
+  if (!cur_task || !cur_task->proc) {
+    // 不在协程中，直接睡眠当前线程
+    std::this_thread::sleep_until(tp);
+    return AWOKEN;
+  }
+  RecoveryEntry entry;
+  cur_task->wake_at_us = TimePointToUs(tp);
+  HoldResult ret = Hold(entry);
+  cur_task->wake_at_us = 0;
+  return ret;
 }
 
 bool CoExecutor::Wakeup(const CoExecutor::RecoveryEntry &entry) {
   if (!entry) {
     return false;
   }
-  auto cur_executor = entry.tk.lock()->proc;
+  CoTaskPtr tk = entry.Lock();
+  CoExecutor *cur_executor = tk ? tk->proc.load() : nullptr;
   if (!cur_executor) {
     return false;
   }
   return cur_executor->WakeupFromEntry(entry);
 }
 
+bool CoExecutor::BindCpu(int cpu) {
+  if (!Thread::SetCurrentAffinity(std::vector<int>{cpu})) {
+    std::cout << "CoExecutor-" << m_id << " can not bind to cpu-" << cpu << std::endl;
+    return false;
+  }
+  m_cpu = cpu;
+  m_l3_id = CpuTopology::Get().GetL3Id(cpu);
+  std::cout << "CoExecutor-" << m_id << " bound to cpu-" << cpu
+            << " (l3-" << m_l3_id << ")" << std::endl;
+  return true;
+}
+
 void CoExecutor::WakeupAll() {
   auto cur_executor = GetCurrentExecutor();
   if (!cur_executor) {
@@ -67,13 +157,22 @@ void CoExecutor::WakeupAll() {
 }
 
 bool CoExecutor::AssignRunnableTask(bool from_awoken) {
+  // runnable队列可能被调度线程取走任务，取出时需要检查队列是否为空
   if (from_awoken) { // 从awoken队列分配
-    m_running_task = m_awoken_queue.Front();
-    m_awoken_queue.PopFront();
+    m_awoken_queue.TryPopFront(m_running_task);
     return true;
   } else { // 从runnable队列分配
-    m_running_task = m_runnable_queue.Front();
-    m_runnable_queue.PopFront();
+    if (m_runnable_queue.TryPopFront(m_running_task) && m_running_task->enqueue_us != 0) {
+      uint64_t now = GetCurrentUs();
+      if (ShedIfQueuedTooLong(m_running_task, now)) {
+        m_running_task = nullptr;
+        return false;
+      }
+      // 记录排队时间
+      uint64_t delay = now - m_running_task->enqueue_us;
+      uint64_t avg = m_queue_delay_us.load(std::memory_order_relaxed);
+      m_queue_delay_us.store((avg * 7 + delay) / 8, std::memory_order_relaxed);
+    }
     return false;
   }
 }
@@ -87,9 +186,22 @@ void CoExecutor::Process(uint64_t timeout_miliseconds) {
     // 取任务，如果没有任务，则在条件变量上等待
     {
       std::unique_lock<std::mutex> lk(m_mtx);
-      // 在runnable_queue和m_awoken_queue上交替去任务
-      if (!m_runnable_queue.Empty() &&
-          !m_awoken_queue.Empty()) { // 两个队列都不为空，交替去任务
+      // 先取出其它线程唤醒的任务，再唤醒到期或者被取消的挂起任务
+      DrainInbox();
+      if (m_poller && m_poked.exchange(false)) {
+        m_poller();
+      }
+      CheckTimers();
+      m_running_task = nullptr;
+      // FIFO模式下在runnable_queue和m_awoken_queue上交替去任务
+      if (m_queue_mode == EDF_QUEUE) { // 按照截止时间取任务
+        if (!AssignEdfTask()) {
+          lk.unlock();
+          WaitForTasks(timeout_miliseconds);
+          continue;
+        }
+      } else if (!m_runnable_queue.Empty() &&
+                 !m_awoken_queue.Empty()) { // 两个队列都不为空，交替去任务
         if (last_retrieve_from_awoken) {
           last_retrieve_from_awoken = AssignRunnableTask(false);
         } else {
@@ -103,19 +215,14 @@ void CoExecutor::Process(uint64_t timeout_miliseconds) {
         last_retrieve_from_awoken = AssignRunnableTask(false);
       } else { // 两个队列都为空
         lk.unlock();
-        if (timeout_miliseconds == 0) {
-          WaitForCondition(); // 等待任务加入
-        } else {
-          WaitForConditionFor(timeout_miliseconds);
-        }
-        if (m_clean_right_now && !m_finished_queue.Empty()) {
-          m_clean_right_now = false;
-          Clean();
-        }
+        WaitForTasks(timeout_miliseconds);
+        continue;
+      }
+      if (!m_running_task) {
         continue;
       }
       m_running_task->proc = this;
-      st_cur_co = m_running_task->co;
+      st_cur_co = m_running_task->co.get();
       // 将任务协程换入，返回之后表示被换出或者执行完成了
       // std::cout << "Co-" << m_running_task->co->get_id()
       //                       << " got resumed, runnableQueue size is "
@@ -123,18 +230,49 @@ void CoExecutor::Process(uint64_t timeout_miliseconds) {
       //                       << " waitingQueue size is " << m_waiting_queue.size() << std::endl;
       ++m_switch_cnt;
       m_tick = GetCurrentUs();
+      m_slice_end_us = m_tick + (m_running_task->time_slice_us != 0
+                                 ? m_running_task->time_slice_us
+                                 : m_time_slice_us);
+      m_slice_check_countdown = MAYBE_YIELD_CHECK_INTERVAL;
       m_running_task->co->Resume();
       ++m_switched_cnt;
+      // 正在执行的任务也计入负载，换出后才减去
+      m_queue_depth.fetch_sub(1, std::memory_order_relaxed);
+      m_blocked.store(false, std::memory_order_relaxed);
       // std::cout << "Now waitingQueue size is " << m_waiting_queue.size() << std::endl;
       // 返回后判断任务的状态，对应有不同的操作
       switch (m_running_task->co->GetStatus()) {
         case Coroutine::Status::HOLD:
           // std::cout << "co-" << m_running_task->co->get_id()
           //                       << " m_running_task is HOLD" << std::endl;
+          if (m_after_hold) {
+            // 任务已经在waiting队列中，after可能马上唤醒它
+            std::function<void()> after;
+            after.swap(m_after_hold);
+            after();
+          } else if (m_handoff) {
+            // 交给回调处理，回调返回前任务可能已经在其它线程中被换入
+            std::function<void(const CoTaskPtr &)> handoff;
+            handoff.swap(m_handoff);
+            handoff(m_running_task);
+          } else if (m_yield_requested) {
+            // 主动让出的任务重新排到runnable队列末尾
+            m_yield_requested = false;
+            m_running_task->enqueue_us = GetCurrentUs();
+            m_runnable_queue.PushBack(m_running_task);
+            m_queue_depth.fetch_add(1, std::memory_order_relaxed);
+          }
           break;
         case Coroutine::Status::FINISHED:
           // std::cout << "co-" << m_running_task->co->get_id()
           //                       << " m_running_task is FINISHED" << std::endl;
+          if (m_running_task->deadline_us != 0) {
+            if (GetCurrentUs() <= m_running_task->deadline_us) {
+              m_deadline_met.fetch_add(1, std::memory_order_relaxed);
+            } else {
+              m_deadline_missed.fetch_add(1, std::memory_order_relaxed);
+            }
+          }
           // 任务完成后放入完成任务队列中
           m_finished_queue.PushBack(m_running_task);
           m_running_task = nullptr;
@@ -142,6 +280,9 @@ void CoExecutor::Process(uint64_t timeout_miliseconds) {
         case Coroutine::Status::EXCEPT:
           // std::cout << "co-" << m_running_task->co->get_id()
           //                       << " m_running_task is EXCEPT" << std::endl;
+          if (m_running_task->deadline_us != 0) {
+            m_deadline_missed.fetch_add(1, std::memory_order_relaxed);
+          }
           m_finished_queue.PushBack(m_running_task);
           if (m_running_task->co->GetException()) {
             std::exception_ptr ex_ptr =
@@ -153,7 +294,7 @@ void CoExecutor::Process(uint64_t timeout_miliseconds) {
         default:
           break;
       }
-      st_cur_co.reset();
+      st_cur_co = nullptr;
       if (m_finished_queue.Size() >= TRIGGER_GC_TASK_SIZE) {
         Clean();
       }
@@ -161,41 +302,299 @@ void CoExecutor::Process(uint64_t timeout_miliseconds) {
   }
 }
 
+// EDF堆的比较函数，截止时间晚的任务排在后面，没有截止时间的任务排在最后，截止时间相同时先入队的先执行
+static bool EdfLater(const TaskPtr &a, const TaskPtr &b) {
+  uint64_t da = a->deadline_us != 0 ? a->deadline_us : NO_TIMER_US;
+  uint64_t db = b->deadline_us != 0 ? b->deadline_us : NO_TIMER_US;
+  if (da != db) {
+    return da > db;
+  }
+  return a->enqueue_us > b->enqueue_us;
+}
+
+void CoExecutor::SetQueueMode(QueueMode mode, LatePolicy late_policy) {
+  m_queue_mode = mode;
+  m_late_policy = late_policy;
+}
+
+void CoExecutor::DrainIntoEdfHeap(ThreadSafeDeque<CoTaskPtr> &queue) {
+  std::lock_guard<std::mutex> lk(queue.LockRef());
+  for (auto &tk : queue) {
+    m_edf_heap.push_back(tk);
+    std::push_heap(m_edf_heap.begin(), m_edf_heap.end(), EdfLater);
+  }
+  queue.ClearUnsafe();
+}
+
+bool CoExecutor::AssignEdfTask() {
+  // runnable队列和awoken队列作为收件箱，其它线程添加的任务先放在里面
+  DrainIntoEdfHeap(m_runnable_queue);
+  DrainIntoEdfHeap(m_awoken_queue);
+  uint64_t now = GetCurrentUs();
+  while (!m_edf_heap.empty()) {
+    std::pop_heap(m_edf_heap.begin(), m_edf_heap.end(), EdfLater);
+    CoTaskPtr tk = m_edf_heap.back();
+    m_edf_heap.pop_back();
+    if (ShedIfQueuedTooLong(tk, now)) {
+      continue;
+    }
+    if (m_late_policy != LATE_RUN && tk->deadline_us != 0 && now > tk->deadline_us) {
+      if (m_late_policy == LATE_DROP && tk->co->GetStatus() == Coroutine::Status::IDLE) {
+        // 还没有开始执行，直接丢弃
+        m_deadline_missed.fetch_add(1, std::memory_order_relaxed);
+        m_deadline_dropped.fetch_add(1, std::memory_order_relaxed);
+        m_queue_depth.fetch_sub(1, std::memory_order_relaxed);
+        continue;
+      }
+      // 已经开始执行的任务不能丢弃，和降级的任务一起等到没有其它任务时再执行
+      m_late_queue.push_back(tk);
+      continue;
+    }
+    m_running_task = tk;
+    break;
+  }
+  if (!m_running_task && !m_late_queue.empty()) {
+    m_running_task = m_late_queue.front();
+    m_late_queue.pop_front();
+  }
+  if (!m_running_task) {
+    return false;
+  }
+  if (m_running_task->co->GetStatus() == Coroutine::Status::IDLE && m_running_task->enqueue_us != 0) {
+    // 只记录第一次执行前的排队时间
+    uint64_t delay = now - std::min(now, m_running_task->enqueue_us);
+    uint64_t avg = m_queue_delay_us.load(std::memory_order_relaxed);
+    m_queue_delay_us.store((avg * 7 + delay) / 8, std::memory_order_relaxed);
+  }
+  return true;
+}
+
+void CoExecutor::WaitForTasks(uint64_t timeout_miliseconds) {
+  if (m_next_timer_us != NO_TIMER_US) {
+    WaitForTimer(); // 有挂起的任务需要定时唤醒，不能超时退出
+  } else if (timeout_miliseconds == 0) {
+    WaitForCondition(); // 等待任务加入
+  } else {
+    WaitForConditionFor(timeout_miliseconds);
+  }
+  if (m_clean_right_now && !m_finished_queue.Empty()) {
+    m_clean_right_now = false;
+    Clean();
+  }
+}
+
 void CoExecutor::HoldThere(CoTaskPtr tk, CoExecutor::RecoveryEntry &out) {
   // std::cout << "Try to hold co-" << m_running_task->co->get_id()
   //                       << " in thread-" << get_thread_id();
   AHRI_ASSERT(tk == m_running_task);
   AHRI_ASSERT(tk->co->GetStatus() == Coroutine::Status::RUNNING);
   // 获取下一个任务，将当前任务移除
+  tk->hold_result = AWOKEN;
+  // 每次挂起使用新的句柄，之前挂起得到的入口全部失效，不会唤醒这一次挂起
+  if (tk->handle == 0) {
+    tk->handle = TaskHandles().Register(tk.get());
+  } else {
+    tk->handle = TaskHandles().Renew(tk->handle);
+  }
   m_waiting_queue.PushBack(m_running_task);
-  out = RecoveryEntry{CoTaskWeakPtr(tk), m_id};
+  out = RecoveryEntry(tk->handle, m_id);
+  // 记录最近需要自动唤醒的时间
+  uint64_t wake_at = tk->wake_at_us;
+  if (tk->deadline_us != 0 && (wake_at == 0 || tk->deadline_us < wake_at)) {
+    wake_at = tk->deadline_us;
+  }
+  if (wake_at != 0 && wake_at < m_next_timer_us) {
+    m_next_timer_us = wake_at;
+  }
+  // 令牌被取消时提前唤醒，如果已经取消了会立即放入awoken队列
+  RecoveryEntry entry = out;
+  uint64_t cb_id = tk->token.Register([entry]() {
+    auto task = entry.Lock();
+    CoExecutor *proc = task ? task->proc.load() : nullptr;
+    if (proc) {
+      proc->WakeupFromEntry(entry, CANCELLED);
+    }
+  });
   m_running_task->co->GiveUp();
+  tk->token.Unregister(cb_id);
 }
 
-bool CoExecutor::WakeupFromEntry(const CoExecutor::RecoveryEntry &entry) {
+bool CoExecutor::WakeupFromEntry(const CoExecutor::RecoveryEntry &entry, HoldResult reason) {
   // std::cout << "CoExecutor::WakeupFromEntry entry is not null, recovery is allowed";
   // 将任务重新放回到m_awoken_queue中，将其从waiting中移除
-  auto it = std::find(m_waiting_queue.begin(), m_waiting_queue.end(), entry.tk.lock());
-  if (it == m_waiting_queue.end()) {
+  auto tk = entry.Lock();
+  if (!tk) {
     return false;
   }
-  m_waiting_queue.Erase(it);
-  m_awoken_queue.PushBack(entry.tk.lock());  // 放入被唤醒的任务队列
+  {
+    std::lock_guard<std::mutex> lk(m_waiting_queue.LockRef());
+    auto it = std::find(m_waiting_queue.begin(), m_waiting_queue.end(), tk);
+    if (it == m_waiting_queue.end()) {
+      // 任务可能在查找前被转交给了其它执行器
+      CoExecutor *heir = tk->proc;
+      if (heir && heir != this) {
+        return heir->WakeupFromEntry(entry, reason);
+      }
+      return false;
+    }
+    if (tk->handle != entry.handle) {
+      // 入口在句柄更新之前已经解析出了任务，属于之前的一次挂起
+      return false;
+    }
+    m_waiting_queue.EraseUnsafe(it);
+  }
+  if (GetCurrentExecutor() == this && tk != m_running_task) {
+    ResumeAwokenTask(tk, reason);
+  } else {
+    // 其它线程唤醒的任务可能还没有换出，先放入收件箱，由执行器取出时再决定是否迁移
+    PushAwokenTask(tk, reason);
+  }
   return true;
 }
 
+void CoExecutor::PushAwokenTask(const CoTaskPtr &tk, HoldResult reason) {
+  tk->hold_result = reason;
+  tk->proc = this;
+  m_queue_depth.fetch_add(1, std::memory_order_relaxed);
+  if (GetCurrentExecutor() == this) {
+    m_awoken_queue.PushBack(tk);  // 在本执行器的线程中，直接放入被唤醒的任务队列
+    return;
+  }
+  // 收件箱原来不为空时已经有线程负责通知，执行器在等待前会检查收件箱
+  if (m_inbox.Push(tk) && m_waiting) {
+    // 持有锁再通知，避免执行器检查完条件之后、开始等待之前的通知丢失
+    std::lock_guard<std::mutex> lk(m_mtx);
+    m_doorbell_cnt.fetch_add(1, std::memory_order_relaxed);
+    m_cv.notify_all();
+  }
+}
+
+void CoExecutor::Poke() {
+  // 只有第一次通知需要唤醒，执行器在等待前会检查m_poked
+  if (!m_poked.exchange(true) && m_waiting) {
+    std::lock_guard<std::mutex> lk(m_mtx);
+    m_doorbell_cnt.fetch_add(1, std::memory_order_relaxed);
+    m_cv.notify_all();
+  }
+}
+
+void CoExecutor::DrainInbox() {
+  // 在Process开始处调用，收件箱中的任务都已经换出，可以迁移到其它执行器
+  m_inbox.ConsumeAll([this](CoTaskPtr &tk) {
+    if (m_wakeup_hook && tk->Movable() && m_wakeup_hook(tk, tk->hold_result)) {
+      m_queue_depth.fetch_sub(1, std::memory_order_relaxed);
+    } else {
+      m_awoken_queue.PushBack(tk);
+    }
+  });
+}
+
+void CoExecutor::ResumeAwokenTask(const CoTaskPtr &tk, HoldResult reason) {
+  // 协程的栈和上下文不依赖原来的线程，可以在有空闲的执行器中恢复
+  if (m_wakeup_hook && tk->Movable() && m_wakeup_hook(tk, reason)) {
+    return;
+  }
+  PushAwokenTask(tk, reason);
+}
+
+void CoExecutor::CheckTimers() {
+  uint64_t now = GetCurrentUs();
+  if (now < m_next_timer_us) {
+    return;
+  }
+  uint64_t next_timer = NO_TIMER_US;
+  std::vector<CoTaskPtr> expired;
+  {
+    std::lock_guard<std::mutex> lk(m_waiting_queue.LockRef());
+    for (auto it = m_waiting_queue.begin(); it != m_waiting_queue.end();) {
+      const CoTaskPtr &tk = *it;
+      if (tk->deadline_us != 0 && now >= tk->deadline_us) {
+        tk->hold_result = TIMEDOUT;
+      } else if (tk->wake_at_us != 0 && now >= tk->wake_at_us) {
+        tk->hold_result = AWOKEN;
+      } else {
+        if (tk->deadline_us != 0) {
+          next_timer = std::min(next_timer, tk->deadline_us);
+        }
+        if (tk->wake_at_us != 0) {
+          next_timer = std::min(next_timer, tk->wake_at_us);
+        }
+        ++it;
+        continue;
+      }
+      expired.push_back(tk);
+      it = m_waiting_queue.EraseUnsafe(it);
+    }
+  }
+  m_next_timer_us = next_timer;
+  for (auto &tk : expired) {
+    ResumeAwokenTask(tk, tk->hold_result);
+  }
+}
+
 void CoExecutor::WakeupAllTasks() {
   // 全部放回到runnable中排队
   while (!m_waiting_queue.Empty()) {
     m_awoken_queue.PushBack(m_waiting_queue.Front());
     m_waiting_queue.PopFront();
+    m_queue_depth.fetch_add(1, std::memory_order_relaxed);
   }
 }
 
-void CoExecutor::AddTask(CoTaskPtr tk) {
+bool CoExecutor::AddTask(CoTaskPtr tk) {
   if (!tk) {
-    return;
+    return false;
+  }
+  while (true) {
+    AdmitResult result = TryAddTask(tk);
+    if (result != QUEUE_FULL) {
+      return result == ADMITTED;
+    }
+    if (IsStopped()) {
+      return false;
+    }
+    // 在协程中挂起生产者协程，否则睡眠当前线程。生产者协程已经被取消或者超时时不会挂起，继续重试会
+    // 一直占用执行器线程，队列在同一个执行器上时永远不会被取走，直接拒绝
+    if (HoldFor(std::chrono::microseconds(ADMISSION_RETRY_US)) != AWOKEN) {
+      m_rejected_cnt.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+  }
+}
+
+bool CoExecutor::AddTask(std::function<void()> &&fn) {
+  return AddTask(MakeIntrusive<CoTask>(std::move(fn)));
+}
+
+CoExecutor::AdmitResult CoExecutor::TryAddTask(const CoTaskPtr &tk) {
+  if (!tk) {
+    return REJECTED;
+  }
+  // 先占位再检查，多个生产者并发时也不会超过上限
+  size_t depth = m_queue_depth.fetch_add(1, std::memory_order_relaxed);
+  if (m_queue_limit != 0 && depth >= m_queue_limit) {
+    if (m_overflow_policy == OVERFLOW_DROP_OLDEST && ShedOldest()) {
+      // 丢弃的任务已经减去了计数，占的位置留给新任务
+    } else {
+      m_queue_depth.fetch_sub(1, std::memory_order_relaxed);
+      if (m_overflow_policy == OVERFLOW_BLOCK) {
+        return QUEUE_FULL;
+      }
+      m_rejected_cnt.fetch_add(1, std::memory_order_relaxed);
+      return REJECTED;
+    }
   }
+  PushReservedTask(tk);
+  return ADMITTED;
+}
+
+void CoExecutor::PushTask(const CoTaskPtr &tk) {
+  m_queue_depth.fetch_add(1, std::memory_order_relaxed);
+  PushReservedTask(tk);
+}
+
+void CoExecutor::PushReservedTask(const CoTaskPtr &tk) {
+  tk->enqueue_us = GetCurrentUs();
   m_runnable_queue.PushBack(tk);
   if (m_waiting) {
     m_cv.notify_all();
@@ -204,8 +603,33 @@ void CoExecutor::AddTask(CoTaskPtr tk) {
   std::cout << "Task added for executor-" << m_id << std::endl;
 }
 
-void CoExecutor::AddTask(std::function<void()> &&fn) {
-  AddTask(std::make_shared<CoTask>(std::move(fn)));
+void CoExecutor::SetQueueLimit(size_t max_queued, OverflowPolicy policy) {
+  m_queue_limit = max_queued;
+  m_overflow_policy = policy;
+}
+
+bool CoExecutor::ShedOldest() {
+  std::lock_guard<std::mutex> lk(m_runnable_queue.LockRef());
+  for (auto it = m_runnable_queue.begin(); it != m_runnable_queue.end(); ++it) {
+    // 已经开始执行的协程不能丢弃，否则栈上的对象不会被析构
+    if ((*it)->co->GetStatus() == Coroutine::Status::IDLE) {
+      m_runnable_queue.EraseUnsafe(it);
+      m_queue_depth.fetch_sub(1, std::memory_order_relaxed);
+      m_shed_cnt.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool CoExecutor::ShedIfQueuedTooLong(const CoTaskPtr &tk, uint64_t now) {
+  if (m_max_queue_time_us == 0 || tk->enqueue_us == 0 || tk->enqueue_us + m_max_queue_time_us >= now ||
+      tk->co->GetStatus() != Coroutine::Status::IDLE) {
+    return false;
+  }
+  m_queue_depth.fetch_sub(1, std::memory_order_relaxed);
+  m_shed_cnt.fetch_add(1, std::memory_order_relaxed);
+  return true;
 }
 
 void CoExecutor::WaitForCondition() {
@@ -230,9 +654,14 @@ void CoExecutor::WaitForConditionFor(uint64_t miliseconds) {
   if (!m_cv.wait_for(lk, std::chrono::milliseconds(miliseconds),
                      [this]() { return this->Predicate(); })) {
     // 超时仍未就绪
-    std::cout << "Waiting for condition variable timedout ("
-              << miliseconds << " millisecond(s))" << std::endl;
-    m_is_stopping = true;
+    if (m_linger_while_holding && !m_waiting_queue.Empty()) {
+      std::cout << "CoExecutor-" << m_id << " is idle but still holds " << m_waiting_queue.Size()
+                << " task(s), keep running" << std::endl;
+    } else {
+      std::cout << "Waiting for condition variable timedout ("
+                << miliseconds << " millisecond(s))" << std::endl;
+      m_is_stopping = true;
+    }
   }
 
   if ((GetCurrentMs() - this->m_last_gc_tick) > GC_INTERVAL_MS) {
@@ -242,6 +671,18 @@ void CoExecutor::WaitForConditionFor(uint64_t miliseconds) {
   m_waiting = false;
 }
 
+void CoExecutor::WaitForTimer() {
+  std::unique_lock<std::mutex> lk(m_mtx);
+  m_waiting = true;
+  uint64_t now = GetCurrentUs();
+  uint64_t next_timer = m_next_timer_us;
+  if (next_timer > now) {
+    m_cv.wait_for(lk, std::chrono::microseconds(next_timer - now),
+                  [this]() { return this->Predicate(); });
+  }
+  m_waiting = false;
+}
+
 void CoExecutor::NotifyCondition() {
   std::unique_lock<std::mutex> lk(m_mtx);
   if (!m_runnable_queue.Empty() &&
@@ -260,17 +701,133 @@ void CoExecutor::Clean() {
 void CoExecutor::YieldCurrent() {
   auto tk = GetCurrentTask();
   AHRI_ASSERT(tk != nullptr);
+  GetCurrentExecutor()->m_yield_requested = true;
+  tk->co->GiveUp();
+}
+
+void CoExecutor::HandOffCurrent(const std::function<void(const CoTaskPtr &)> &fn) {
+  auto tk = GetCurrentTask();
+  AHRI_ASSERT(tk != nullptr);
+  GetCurrentExecutor()->m_handoff = fn;
   tk->co->GiveUp();
 }
 
-void CoExecutor::GiveUpTasks(ThreadSafeDeque<CoTaskPtr> &giveups, size_t n) {
+bool CoExecutor::MaybeYieldCurrent() {
+  CoExecutor *proc = GetCurrentExecutor();
+  if (!proc || !proc->m_running_task) {
+    return false;
+  }
+  if (--proc->m_slice_check_countdown > 0) {
+    return false;
+  }
+  proc->m_slice_check_countdown = MAYBE_YIELD_CHECK_INTERVAL;
+  if (GetCurrentUs() < proc->m_slice_end_us) {
+    return false;
+  }
+  ++proc->m_preempt_cnt;
+  YieldCurrent();
+  return true;
+}
+
+void CoExecutor::GiveUpTasks(ThreadSafeDeque<CoTaskPtr> &giveups, size_t n, bool include_pinned) {
   std::cout << "CoExecutor-" << m_id << " is ready to give up "
             << (n == 0 ? m_runnable_queue.Size() : n) << " tasks" << std::endl;
   std::lock_guard<std::mutex> lk(m_runnable_queue.LockRef());
-  if (n > 0) { // give up some
-    m_runnable_queue.PopBackAndAppendUnsafe(n, giveups);
-  } else { // give up all
-    m_runnable_queue.PopBackAndAppendUnsafe(m_runnable_queue.SizeNoLock(), giveups);
+  size_t before = m_runnable_queue.SizeNoLock();
+  if (n == 0) { // give up all
+    n = before;
+  }
+  std::lock_guard<std::mutex> out_lk(giveups.LockRef());
+  if (include_pinned && n >= before) {
+    // 全部交出时整体移动，不需要逐个检查
+    m_runnable_queue.DrainToUnsafe(giveups);
+  } else {
+    // 从队尾开始放弃，跳过绑定在本执行器上的任务
+    std::vector<CoTaskPtr> taken;
+    auto it = m_runnable_queue.end();
+    while (taken.size() < n && it != m_runnable_queue.begin()) {
+      --it;
+      if (!(*it)->Movable() && !include_pinned) {
+        continue;
+      }
+      taken.push_back(std::move(*it));
+      it = m_runnable_queue.EraseUnsafe(it);
+    }
+    // 保持任务原来的先后顺序
+    for (auto rit = taken.rbegin(); rit != taken.rend(); ++rit) {
+      giveups.PushBackUnsafe(std::move(*rit));
+    }
+  }
+  m_queue_depth.fetch_sub(before - m_runnable_queue.SizeNoLock(), std::memory_order_relaxed);
+}
+
+void CoExecutor::RequestStop() {
+  m_is_stopping = true;
+  m_cv.notify_all();
+}
+
+bool CoExecutor::HandOverTasks(ThreadSafeDeque<CoTaskPtr> &runnables, CoExecutor *heir) {
+  AHRI_ASSERT(heir != this);
+  // 被唤醒的任务和可执行的任务都交出去，绑定的任务由调用者按照key重新放置
+  TakeQueuedTasks(runnables, true);
+  // Process已经返回，可以在当前线程中访问EDF堆
+  for (auto &task : m_edf_heap) {
+    runnables.PushBack(std::move(task));
+  }
+  for (auto &task : m_late_queue) {
+    runnables.PushBack(std::move(task));
+  }
+  m_queue_depth.fetch_sub(m_edf_heap.size() + m_late_queue.size(), std::memory_order_relaxed);
+  m_edf_heap.clear();
+  m_late_queue.clear();
+  if (!heir) {
+    return true;
+  }
+  // 持有本执行器waiting队列的锁时先放入heir的waiting队列再修改proc，
+  // 在此期间唤醒的线程会在本执行器找不到任务，然后根据proc转到heir中查找
+  std::lock_guard<std::mutex> lk(m_waiting_queue.LockRef());
+  // 持有heir的锁，heir不会在转交的过程中因为等待超时而退出
+  std::lock_guard<std::mutex> heir_lk(heir->m_mtx);
+  if (heir->m_is_stopping) {
+    return false;
+  }
+  size_t count = m_waiting_queue.SizeNoLock();
+  uint64_t next_timer = NO_TIMER_US;
+  for (auto &task : m_waiting_queue) {
+    heir->m_waiting_queue.PushBack(task);
+    if (task->deadline_us != 0) {
+      next_timer = std::min(next_timer, task->deadline_us);
+    }
+    if (task->wake_at_us != 0) {
+      next_timer = std::min(next_timer, task->wake_at_us);
+    }
+  }
+  for (auto &task : m_waiting_queue) {
+    task->proc = heir;
+  }
+  m_waiting_queue.ClearUnsafe();
+  // 更新heir最近的定时器，并且唤醒heir重新计算等待时间
+  uint64_t cur_timer = heir->m_next_timer_us;
+  while (next_timer < cur_timer && !heir->m_next_timer_us.compare_exchange_weak(cur_timer, next_timer)) {
+  }
+  heir->m_cv.notify_all();
+  std::cout << "CoExecutor-" << m_id << " handed over " << count
+            << " held task(s) to executor-" << heir->m_id << std::endl;
+  return true;
+}
+
+void CoExecutor::TakeQueuedTasks(ThreadSafeDeque<CoTaskPtr> &out, bool include_pinned) {
+  GiveUpTasks(out, 0, include_pinned);
+  m_inbox.ConsumeAll([this](CoTaskPtr &tk) { m_awoken_queue.PushBack(std::move(tk)); });
+  std::lock_guard<std::mutex> lk(m_awoken_queue.LockRef());
+  for (auto it = m_awoken_queue.begin(); it != m_awoken_queue.end();) {
+    if (!(*it)->Movable() && !include_pinned) {
+      ++it;
+      continue;
+    }
+    out.PushBack(std::move(*it));
+    it = m_awoken_queue.EraseUnsafe(it);
+    m_queue_depth.fetch_sub(1, std::memory_order_relaxed);
   }
 }
 
@@ -288,8 +845,9 @@ bool CoExecutor::Predicate() const {
                  && this->m_last_gc_tick != 0
                  && has_done_task
                  && timeout;
-  bool has_task_awoken = !m_awoken_queue.Empty();
-  return has_task || gonna_stop || need_gc || has_task_awoken;
+  bool has_task_awoken = !m_awoken_queue.Empty() || !m_inbox.Empty() || m_poked;
+  bool timer_due = GetCurrentUs() >= m_next_timer_us;
+  return has_task || gonna_stop || need_gc || has_task_awoken || timer_due;
 }
 
 void CoExecutor::CoYield() {
@@ -299,12 +857,31 @@ void CoExecutor::CoYield() {
   }
 }
 
+uint64_t TimePointToUs(const CoExecutor::TimePoint &tp) {
+  if (tp == CoExecutor::TimePoint::max()) {
+    return 0;
+  }
+  // high_resolution_clock不一定和gettimeofday使用同样的时间起点(libc++中是steady_clock)，
+  // 按照和当前时间的差值换算成GetCurrentUs()的时间戳
+  int64_t diff_us =
+      std::chrono::duration_cast<std::chrono::microseconds>(tp - CoExecutor::TimePoint::clock::now()).count();
+  int64_t now_us = (int64_t) GetCurrentUs();
+  if (diff_us <= -now_us) {
+    return 1;  // 早已过去的时间，不能返回0
+  }
+  return (uint64_t) (now_us + diff_us);
+}
+
 namespace this_coroutine {
 
 void Yield() {
   CoExecutor::CoYield();
 }
 
+bool MaybeYield() {
+  return CoExecutor::MaybeYieldCurrent();
+}
+
 int32_t GetId() {
   TaskPtr tk = CoExecutor::GetCurrentTask();
   if (tk && tk.use_count() != 0 && tk->co) {
@@ -313,6 +890,26 @@ int32_t GetId() {
   return -1;
 }
 
+bool IsCancelled() {
+  TaskPtr tk = CoExecutor::GetCurrentTask();
+  if (!tk) {
+    return false;
+  }
+  return tk->token.IsCancelled() || (tk->deadline_us != 0 && GetCurrentUs() >= tk->deadline_us);
+}
+
+CancellationToken GetCancellationToken() {
+  TaskPtr tk = CoExecutor::GetCurrentTask();
+  return tk ? tk->token : CancellationToken();
+}
+
+void SetThreadAffine(bool affine) {
+  TaskPtr tk = CoExecutor::GetCurrentTask();
+  if (tk) {
+    tk->thread_affine = affine;
+  }
+}
+
 } // namespace this_coroutine
 
 } // namespace src
@@ -1,17 +1,31 @@
 #pragma once
 
 #include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <limits>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <vector>
 
+#include "cancellation.h"
 #include "containers.hpp"
 #include "coroutine.h"
+#include "intrusive.hpp"
+#include "slab.hpp"
 
 #define TRIGGER_GC_TASK_SIZE 64
 #define COROUTINE_TIMEDOUT_MS 100
 #define COROUTINE_TIMEDOUT_US COROUTINE_TIMEDOUT_MS * 1000
 #define GC_INTERVAL_MS 2000
+// 协程默认的时间片长度
+#define COROUTINE_TIME_SLICE_US 10 * 1000
+// MaybeYield每调用多少次才检查一次时间
+#define MAYBE_YIELD_CHECK_INTERVAL 32
+#define NO_TIMER_US std::numeric_limits<uint64_t>::max()
+// 队列满时阻塞的生产者重试的间隔
+#define ADMISSION_RETRY_US 500
 
 namespace ahri {
 class Coroutine;
@@ -22,56 +36,148 @@ class Coroutine;
  */
 class CoExecutor {
   friend class CoScheduler;
+  friend class ShardedScheduler;
 
 public:
   using TimePoint = std::chrono::time_point<std::chrono::high_resolution_clock>;
 
   /**
-   * @brief 表示一个任务
+   * @brief 挂起后被唤醒的原因
    *
    */
-  struct CoTask {
+  enum HoldResult {
+    AWOKEN,    // 被正常唤醒，或者HoldFor/HoldUntil的时间到了
+    CANCELLED, // 任务的取消令牌被取消
+    TIMEDOUT   // 任务的截止时间已过
+  };
+
+  /**
+   * @brief 选择下一个任务的方式
+   *
+   */
+  enum QueueMode {
+    FIFO_QUEUE, // runnable队列和awoken队列交替按照先进先出执行
+    EDF_QUEUE   // 截止时间最早的任务先执行(earliest deadline first)，没有截止时间的任务排在最后
+  };
+
+  /**
+   * @brief EDF模式下如何处理已经错过截止时间的任务
+   *
+   */
+  enum LatePolicy {
+    LATE_RUN,          // 照常按照截止时间执行
+    LATE_DEPRIORITIZE, // 没有其它任务时才执行
+    LATE_DROP          // 还没有开始执行的任务直接丢弃，已经开始执行的任务降级执行
+  };
+
+  /**
+   * @brief 队列达到上限时如何处理新任务
+   *
+   */
+  enum OverflowPolicy {
+    OVERFLOW_REJECT,     // 拒绝新任务
+    OVERFLOW_BLOCK,      // 阻塞生产者直到有空位，在协程中添加任务时挂起生产者协程
+    OVERFLOW_DROP_OLDEST // 丢弃最早入队并且还没有开始执行的任务，没有可以丢弃的任务时拒绝新任务
+  };
+
+  /**
+   * @brief 尝试添加任务的结果
+   *
+   */
+  enum AdmitResult {
+    ADMITTED,  // 已经加入队列
+    REJECTED,  // 被拒绝
+    QUEUE_FULL // 队列已满，OVERFLOW_BLOCK时由调用者等待后重试
+  };
+
+  /**
+   * @brief 表示一个任务，引用计数在任务对象内部，复制CoTaskPtr不需要访问单独的控制块。
+   * 任务和它的协程对象都从slab分配
+   *
+   */
+  struct CoTask : public RefCounted<CoTask>, public SlabAllocated<CoTask> {
     // 任务协程
     std::shared_ptr<Coroutine> co;
-    // 处理器指针，该任务属于哪个处理器处理
-    CoExecutor *proc;
+    // 处理器指针，该任务属于哪个处理器处理；执行器退出时挂起的任务会转交给其它执行器
+    std::atomic<CoExecutor *> proc{nullptr};
+    // 取消令牌，令牌被取消时挂起的任务会被提前唤醒
+    CancellationToken token;
+    // 任务的截止时间戳(单位us)，为0表示没有截止时间
+    uint64_t deadline_us = 0;
+    // 挂起后自动唤醒的时间戳(单位us)，为0表示不自动唤醒
+    uint64_t wake_at_us = 0;
+    // 最近一次被唤醒的原因
+    HoldResult hold_result = AWOKEN;
+    // 任务每次被换入后可以连续执行的时间(单位us)，为0表示使用执行器的默认时间片
+    uint64_t time_slice_us = 0;
+    // 任务进入runnable队列的时间戳(单位us)
+    uint64_t enqueue_us = 0;
+    // 绑定在所属的执行器上，不会被均衡任务或者监控线程转移到其它执行器
+    bool pinned = false;
+    // 绑定任务的key，相同key的任务由同一个执行器执行
+    uint64_t affinity_key = 0;
+    // 协程依赖线程局部变量等线程相关的状态，开始执行后只能在同一个线程中恢复
+    bool thread_affine = false;
+    // 任务在TaskHandles()中的句柄，第一次挂起时分配，之后每次挂起更新代数，为0表示还没有分配
+    uint64_t handle = 0;
 
     CoTask(std::shared_ptr<Coroutine> &c) : co(c) {}
 
-    CoTask(std::function<void()> &&f) : co(std::make_shared<Coroutine>(std::move(f), 0)) {}
+    CoTask(std::function<void()> &&f)
+        : co(std::allocate_shared<Coroutine>(SlabAllocator<Coroutine>(), std::move(f), 0)) {}
+
+    CoTask(std::function<void()> &f) : co(std::allocate_shared<Coroutine>(SlabAllocator<Coroutine>(), f, 0)) {}
 
-    CoTask(std::function<void()> &f) : co(std::make_shared<Coroutine>(f, 0)) {}
+    /**
+     * @brief 任务是否可以转移到其它执行器中执行
+     *
+     */
+    bool Movable() const;
+
+    ~CoTask();
   };
 
-  using CoTaskWeakPtr = std::weak_ptr<CoTask>;
-  using CoTaskPtr = std::shared_ptr<CoTask>;
+  using CoTaskPtr = IntrusivePtr<CoTask>;
+
+  /**
+   * @brief 所有挂起过的任务的句柄表，任务析构时注销自己的句柄
+   *
+   */
+  static HandleTable<CoTask> &TaskHandles();
 
   /**
-   * @brief 挂起后的恢复入口
+   * @brief 挂起后的恢复入口，用带代数的句柄代替弱引用，任务结束后入口自动失效
    *
    */
   struct RecoveryEntry {
-    // 任务的弱引用
-    CoTaskWeakPtr tk;
+    // 任务在TaskHandles()中的句柄
+    uint64_t handle;
     // executor所属id
     int32_t id;
 
-    explicit operator bool() const { return tk.lock() != nullptr && id != 0; }
+    RecoveryEntry() : handle(0), id(0) {}
+
+    RecoveryEntry(uint64_t h, int32_t i) : handle(h), id(i) {}
+
+    // 执行器的id可以为0，只根据任务是否存在判断，只比较代数，不需要增加引用计数
+    explicit operator bool() const { return TaskHandles().Alive(handle); }
+
+    /**
+     * @brief 获取任务的引用
+     *
+     * @return CoTaskPtr 任务已经结束时为空
+     */
+    CoTaskPtr Lock() const { return TaskHandles().Resolve(handle); }
 
     friend bool operator==(const RecoveryEntry &one, const RecoveryEntry &oth) {
-      return one.tk.lock() == oth.tk.lock() && one.id == oth.id;
+      return one.handle == oth.handle && one.id == oth.id;
     }
 
     friend bool operator<(const RecoveryEntry &one, const RecoveryEntry &oth) {
-      return one.tk.lock() < oth.tk.lock() && one.id < oth.id;
+      return one.handle < oth.handle || (one.handle == oth.handle && one.id < oth.id);
     }
 
-    inline bool Expired() const {
-      if (!tk.lock()) {
-        return false;
-      }
-      return true;
-    }
+    inline bool Expired() const { return TaskHandles().Alive(handle); }
   };
 
 public:
@@ -87,6 +193,18 @@ public:
 
   inline size_t GetValidTasksCount() const { return m_runnable_queue.Size() + m_waiting_queue.Size(); }
 
+  /**
+   * @brief 获取等待执行和正在执行的任务数量(runnable队列、awoken队列和当前任务)，不加锁，供放置策略快速读取
+   *
+   */
+  inline size_t GetQueueDepth() const { return m_queue_depth.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief 获取任务在runnable队列中的平均排队时间(单位us)，为最近若干个任务的指数移动平均
+   *
+   */
+  inline uint64_t GetQueueDelayUs() const { return m_queue_delay_us.load(std::memory_order_relaxed); }
+
   inline uint64_t GetStartElapse() const { return m_start_elapse; }
 
   inline uint64_t GetCurrentElapse() const { return GetCurrentMs() - m_start_elapse; }
@@ -121,6 +239,23 @@ public:
    */
   static void YieldCurrent();
 
+  /**
+   * @brief 当前协程的时间片用完时才挂起当前协程，否则直接返回
+   * 每MAYBE_YIELD_CHECK_INTERVAL次调用才读取一次时间，适合在计算密集的循环中调用
+   *
+   * @return true 让出了执行权
+   * @return false 时间片还没有用完
+   */
+  static bool MaybeYieldCurrent();
+
+  /**
+   * @brief 换出当前协程，换出之后由执行器调用fn决定任务的去向
+   * 任务不会进入本执行器的任何队列，fn通常把任务加入其它执行器，任务可能马上在其它线程中被换入
+   *
+   * @param fn 处理被换出的任务
+   */
+  static void HandOffCurrent(const std::function<void(const CoTaskPtr &)> &fn);
+
   /**
    * Get master coroutine in current executor
    * @return
@@ -129,23 +264,48 @@ public:
 
   /**
    * @brief 挂起当前的协程
+   * 如果任务的取消令牌已经被取消或者截止时间已过，则不挂起直接返回
+   *
+   * @param out 返回参数，重新唤醒的入口
+   * @return HoldResult 被唤醒的原因
+   */
+  static HoldResult Hold(CoExecutor::RecoveryEntry &out);
+
+  /**
+   * @brief 挂起当前的协程，协程换出之后在执行器的线程中调用after
+   * after调用时out已经可以用来唤醒协程，适合把唤醒的工作交给其它线程；
+   * 没有挂起时(不在协程中、已经取消或者超时)在返回前调用after
    *
    * @param out 返回参数，重新唤醒的入口
+   * @param after 换出之后调用的函数，只调用一次
+   * @return HoldResult 被唤醒的原因
    */
-  static void Hold(CoExecutor::RecoveryEntry &out);
+  static HoldResult HoldThen(CoExecutor::RecoveryEntry &out, const std::function<void()> &after);
+
+  /**
+   * @brief 和HoldThen相同，但是挂起期间不受任务的取消令牌和截止时间影响，只能被Wakeup唤醒。
+   * 用于已经把恢复入口交给了其它线程、并且对方可能还在使用当前协程的栈的场合，
+   * 这时提前返回只能阻塞线程等待。WakeupAll也会唤醒协程，调用者需要自己检查条件后重新挂起
+   *
+   * @param out 返回参数，重新唤醒的入口
+   * @param after 换出之后调用的函数，只调用一次
+   */
+  static void HoldUninterruptibly(CoExecutor::RecoveryEntry &out, const std::function<void()> &after);
 
   /**
    * @brief 挂起当前协程, 并在指定时间后自动唤醒
    * 
-   * @param dur 挂起时间，毫秒
+   * @param dur 挂起时间，微秒
+   * @return HoldResult 被唤醒的原因
    */
-  static void HoldFor(const std::chrono::microseconds &dur);
+  static HoldResult HoldFor(const std::chrono::microseconds &dur);
 
   /**
    * Hold current coroutine until certain timepoint
    * @param tp
+   * @return reason of wakeup
    */
-  static void HoldUntil(const TimePoint &tp);
+  static HoldResult HoldUntil(const TimePoint &tp);
 
   /**
    * @brief 唤醒协程
@@ -170,6 +330,15 @@ public:
    */
   inline bool IsStopped() const { return m_is_stopping; }
 
+  /**
+   * @brief 设置Process等待超时时，如果还有挂起的任务是否继续运行。
+   * 打开后执行器只有在空闲并且没有挂起的任务时才会超时退出，挂起的任务不会因为执行器退出而无法唤醒
+   *
+   */
+  inline void SetLingerWhileHolding(bool linger) { m_linger_while_holding = linger; }
+
+  inline bool IsLingerWhileHolding() const { return m_linger_while_holding; }
+
   /**
    * @brief 判断是否阻塞在某个协程上（某个协程执行耗时太久）
    * 如果当前的协程执行的时间超过设定的超时时间，
@@ -181,20 +350,173 @@ public:
   inline bool IsBlocking() const { return GetCurrentUs() - m_tick > COROUTINE_TIMEDOUT_US && m_switch_cnt != m_switched_cnt; }
 
   /**
-   * @brief 添加单个任务
+   * @brief 判断当前协程是否已经连续执行超过指定时间
+   *
+   * @param us 阈值，单位us
+   * @return true 阻塞了
+   * @return false 没有阻塞
+   */
+  inline bool IsBlockingFor(uint64_t us) const { return m_switch_cnt != m_switched_cnt && GetCurrentUs() - m_tick > us; }
+
+  /**
+   * @brief 是否被监控线程标记为阻塞，当前协程换出后清除标记
+   *
+   */
+  inline bool IsMarkedBlocked() const { return m_blocked.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief 设置执行器默认的时间片长度
+   *
+   * @param us 时间片长度，单位us
+   */
+  inline void SetTimeSlice(uint64_t us) { m_time_slice_us = us; }
+
+  inline uint64_t GetTimeSlice() const { return m_time_slice_us; }
+
+  /**
+   * @brief 获取因为时间片用完而让出的次数
+   *
+   */
+  inline uint64_t GetPreemptCount() const { return m_preempt_cnt; }
+
+  /**
+   * @brief 设置选择下一个任务的方式，需要在Process之前调用
+   *
+   * @param mode 队列模式，默认为FIFO_QUEUE
+   * @param late_policy EDF模式下错过截止时间的任务的处理方式
+   */
+  void SetQueueMode(QueueMode mode, LatePolicy late_policy = LATE_DEPRIORITIZE);
+
+  inline QueueMode GetQueueMode() const { return m_queue_mode; }
+
+  /**
+   * @brief 获取在截止时间之前完成的任务数量，只统计有截止时间的任务
+   *
+   */
+  inline uint64_t GetDeadlineMetCount() const { return m_deadline_met.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief 获取错过截止时间的任务数量，包括被丢弃的任务
+   *
+   */
+  inline uint64_t GetDeadlineMissedCount() const { return m_deadline_missed.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief 获取EDF模式下因为错过截止时间而被丢弃的任务数量
+   *
+   */
+  inline uint64_t GetDeadlineDroppedCount() const { return m_deadline_dropped.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief 将当前线程绑定到指定cpu上，需要在执行Process的线程中调用
+   *
+   * @param cpu 逻辑cpu编号
+   * @return true 绑定成功
+   * @return false 绑定失败
+   */
+  bool BindCpu(int cpu);
+
+  /**
+   * @brief 获取执行器绑定的cpu，没有绑定时返回-1
+   *
+   */
+  inline int GetCpu() const { return m_cpu; }
+
+  /**
+   * @brief 获取执行器绑定的cpu所在的L3缓存id，未知时返回-1
+   *
+   */
+  inline int GetL3Id() const { return m_l3_id; }
+
+  /**
+   * @brief 获取执行器所属的执行器组名，不属于任何组时为空
+   *
+   */
+  inline const std::string &GetGroupName() const { return m_group; }
+
+  /**
+   * @brief 设置挂起的任务被唤醒时的迁移回调
+   * 回调返回true表示已经把任务放入了其它执行器的awoken队列，返回false时任务在本执行器中恢复。
+   * 绑定在执行器上和线程相关的任务不会调用回调，回调在本执行器的线程中调用，此时任务已经换出
+   *
+   * @param hook 迁移回调，为空表示不迁移
+   */
+  inline void SetWakeupHook(const std::function<bool(const CoTaskPtr &, HoldResult)> &hook) { m_wakeup_hook = hook; }
+
+  /**
+   * @brief 设置轮询回调，执行器被Poke之后在下一轮调度开始时调用，用来把外部队列中的消息转成任务
+   * 回调在执行器的线程中调用，需要在Process之前设置
+   *
+   * @param poller 轮询回调，返回添加的任务数量
+   */
+  inline void SetPoller(const std::function<size_t()> &poller) { m_poller = poller; }
+
+  /**
+   * @brief 通知执行器调用轮询回调，可以在任意线程中调用
+   * 上一次通知还没有被处理时不会重复唤醒执行器
+   *
+   */
+  void Poke();
+
+  /**
+   * @brief 设置队列上限，队列中等待执行和正在执行的任务(GetQueueDepth)达到上限后按照policy处理新任务
+   * 上限只对AddTask和TryAddTask生效，内部转移任务不受限制
+   *
+   * @param max_queued 上限，为0表示不限制
+   * @param policy 达到上限时的处理方式
+   */
+  void SetQueueLimit(size_t max_queued, OverflowPolicy policy = OVERFLOW_REJECT);
+
+  /**
+   * @brief 设置任务的最大排队时间，排队超过该时间并且还没有开始执行的任务被丢弃
+   *
+   * @param us 最大排队时间，单位us，为0表示不限制
+   */
+  inline void SetMaxQueueTime(uint64_t us) { m_max_queue_time_us = us; }
+
+  /**
+   * @brief 获取因为队列已满而被拒绝的任务数量
+   *
+   */
+  inline uint64_t GetRejectedCount() const { return m_rejected_cnt.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief 获取因为队列已满或者排队超时而被丢弃的任务数量
+   *
+   */
+  inline uint64_t GetShedCount() const { return m_shed_cnt.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief 获取其它线程唤醒任务时通知本执行器的次数，同一批唤醒只通知一次
+   *
+   */
+  inline uint64_t GetDoorbellCount() const { return m_doorbell_cnt.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief 添加单个任务，队列已满时按照SetQueueLimit设置的方式处理
    *
    * @param tk
+   * @return true 任务已经加入队列
+   * @return false 任务被拒绝或者执行器已经停止
    */
-  void AddTask(CoTaskPtr tk);
+  bool AddTask(CoTaskPtr tk);
 
   /**
    * @brief 以函数的形式添加任务
    *
    */
-  void AddTask(std::function<void()> &&fn);
+  bool AddTask(std::function<void()> &&fn);
+
+  /**
+   * @brief 尝试添加单个任务，不会阻塞
+   *
+   * @param tk
+   * @return AdmitResult OVERFLOW_BLOCK并且队列已满时返回QUEUE_FULL
+   */
+  AdmitResult TryAddTask(const CoTaskPtr &tk);
 
   /**
-   * @brief 批量添加任务
+   * @brief 批量添加任务，不受队列上限的限制。传入std::move_iterator时任务会被移走，不会修改引用计数
    *
    * @tparam Iterator
    * @param begin
@@ -209,10 +531,16 @@ public:
       ++begin;
       ++count;
     }
-    if (m_waiting) {
-      m_cv.notify_all();
-    }
-    std::cout << count << " task(s) added for executor-" << m_id << std::endl;
+    OnTasksAdded(count);
+  }
+
+  /**
+   * @brief 把tasks中的所有任务移动到可执行队列末尾，tasks变为空，不受队列上限的限制
+   *
+   * @param tasks
+   */
+  void AddTask(ThreadSafeDeque<CoTaskPtr> &tasks) {
+    OnTasksAdded(m_runnable_queue.Splice(tasks));
   }
 
 public:
@@ -223,7 +551,7 @@ public:
    */
   void Process(uint64_t timeout_miliseconds = 0);
 
-  bool WakeupFromEntry(const RecoveryEntry &entry);
+  bool WakeupFromEntry(const RecoveryEntry &entry, HoldResult reason = AWOKEN);
 
   void WakeupAllTasks();
 
@@ -241,6 +569,71 @@ public:
   CoExecutor &operator=(const CoExecutor &&) = delete;
 
 private:
+  /**
+   * @brief 将被唤醒的任务放入awoken队列，在其它线程中调用时先放入收件箱，
+   * 收件箱从空变为非空并且执行器正在等待时才通知执行器
+   *
+   * @param tk 被唤醒的任务
+   * @param reason 唤醒的原因
+   */
+  void PushAwokenTask(const CoTaskPtr &tk, HoldResult reason);
+
+  /**
+   * @brief 把收件箱中的任务全部移到awoken队列中，可以迁移的任务先交给迁移回调
+   *
+   */
+  void DrainInbox();
+
+  /**
+   * @brief 批量放入count个可执行任务之后更新负载并且通知执行器
+   *
+   */
+  void OnTasksAdded(size_t count) {
+    m_queue_depth.fetch_add(count, std::memory_order_relaxed);
+    if (m_waiting) {
+      m_cv.notify_all();
+    }
+    std::cout << count << " task(s) added for executor-" << m_id << std::endl;
+  }
+
+  /**
+   * @brief 通过迁移回调把被唤醒的任务放到其它执行器中，失败时放入本执行器的awoken队列
+   * 只在执行器自己的线程中调用，任务已经换出
+   *
+   * @param tk 被唤醒的任务
+   * @param reason 唤醒的原因
+   */
+  void ResumeAwokenTask(const CoTaskPtr &tk, HoldResult reason);
+
+  /**
+   * @brief 不受队列上限限制地添加任务
+   *
+   */
+  void PushTask(const CoTaskPtr &tk);
+
+  /**
+   * @brief 添加任务，任务的m_queue_depth计数已经由调用者加上
+   *
+   */
+  void PushReservedTask(const CoTaskPtr &tk);
+
+  /**
+   * @brief 丢弃runnable队列中最早入队并且还没有开始执行的任务
+   *
+   * @return true 丢弃了一个任务
+   * @return false 没有可以丢弃的任务
+   */
+  bool ShedOldest();
+
+  /**
+   * @brief 任务排队时间超过上限时丢弃，只丢弃还没有开始执行的任务
+   *
+   * @param tk 刚从队列中取出的任务
+   * @param now 当前时间戳(单位us)
+   * @return true 任务被丢弃
+   */
+  bool ShedIfQueuedTooLong(const CoTaskPtr &tk, uint64_t now);
+
   /**
    * @brief 条件变量等待，等待有任务可以处理
    *
@@ -254,6 +647,18 @@ private:
    */
   void WaitForConditionFor(uint64_t miliseconds);
 
+  /**
+   * @brief 条件变量等待到最近的定时器到期，超时不会停止执行器
+   *
+   */
+  void WaitForTimer();
+
+  /**
+   * @brief 将到期或者已经被取消的挂起任务放入awoken队列
+   *
+   */
+  void CheckTimers();
+
   /**
    * @brief 在条件变量上唤醒，通知处理
    *
@@ -275,12 +680,13 @@ private:
   void HoldThere(CoTaskPtr tk, CoExecutor::RecoveryEntry &out);
 
   /**
-   * @brief 主动放弃一些没来得及处理的任务
+   * @brief 主动放弃一些没来得及处理的任务，从队尾开始放弃
    * 
-   * @param giveups 放弃任务的数量，为0表示放弃当前所有未处理的任务
-   * @param n 返回结果
+   * @param giveups 返回结果
+   * @param n 放弃任务的数量，为0表示放弃当前所有未处理的任务
+   * @param include_pinned 是否也放弃绑定在执行器上的任务和已经开始执行的线程相关的任务，默认跳过这些任务
    */
-  void GiveUpTasks(ThreadSafeDeque<CoTaskPtr> &giveups, size_t n = 0);
+  void GiveUpTasks(ThreadSafeDeque<CoTaskPtr> &giveups, size_t n = 0, bool include_pinned = false);
 
   /**
    * @brief 条件变量的等待判断条件
@@ -295,10 +701,57 @@ private:
    * 
    * @param from_awoken 从哪里分配
    * @return true 从awoken队列中分配了
-   * @return false 从runnable队列中分配了
+   * @return false 从runnable队列中分配了；队列被其它线程取空时m_running_task为空
    */
   bool AssignRunnableTask(bool from_awoken);
 
+  /**
+   * @brief EDF模式下指定下一个要运行的任务
+   * runnable队列和awoken队列中的任务先全部移到按截止时间排序的堆中，再取出截止时间最早的任务
+   *
+   * @return true 分配了任务
+   * @return false 没有可以运行的任务
+   */
+  bool AssignEdfTask();
+
+  /**
+   * @brief 将队列中的任务全部移到EDF堆中
+   *
+   */
+  void DrainIntoEdfHeap(ThreadSafeDeque<CoTaskPtr> &queue);
+
+  /**
+   * @brief 没有任务时等待，有挂起的任务需要定时唤醒时等待到最近的定时器
+   *
+   * @param timeout_miliseconds 持续没有任务执行退出等待时间，为0表示一直等待
+   */
+  void WaitForTasks(uint64_t timeout_miliseconds);
+
+  /**
+   * @brief 通知执行器停止，正在执行的任务换出后退出Process
+   *
+   */
+  void RequestStop();
+
+  /**
+   * @brief 执行器退出后交出所有任务
+   * runnable队列、awoken队列和EDF堆中的任务放入runnables，挂起的任务转交给heir，
+   * 转交过程中唤醒挂起的任务不会丢失。需要在执行器的线程中、Process返回之后调用
+   *
+   * @param runnables 返回可以执行的任务
+   * @param heir 接管挂起任务的执行器
+   * @return false heir已经停止，挂起的任务没有转交，可以换一个执行器再次调用
+   */
+  bool HandOverTasks(ThreadSafeDeque<CoTaskPtr> &runnables, CoExecutor *heir);
+
+  /**
+   * @brief 取走runnable队列和awoken队列中所有等待执行的任务，正在执行的任务不受影响
+   *
+   * @param out 返回取走的任务
+   * @param include_pinned 是否也取走不能转移的任务(见CoTask::Movable)
+   */
+  void TakeQueuedTasks(ThreadSafeDeque<CoTaskPtr> &out, bool include_pinned = false);
+
 public:
   static void CoYield();
 
@@ -307,6 +760,12 @@ private:
   int32_t m_id;
   // 运行所在的线程id
   int32_t m_process_tid = -1;
+  // 所属的执行器组
+  std::string m_group;
+  // 绑定的cpu
+  int m_cpu = -1;
+  // 绑定的cpu所在的L3缓存id
+  int m_l3_id = -1;
   // 可以运行的协程队列
   ThreadSafeDeque<CoTaskPtr> m_runnable_queue;
   // 正在hold状态的协程任务
@@ -315,6 +774,18 @@ private:
   ThreadSafeDeque<CoTaskPtr> m_finished_queue;
   // hold了之后的协程的等待队列
   ThreadSafeDeque<CoTaskPtr> m_awoken_queue;
+  // 其它线程唤醒的任务先放在收件箱中，由执行器自己移到awoken队列
+  MpscQueue<CoTaskPtr> m_inbox;
+  // 其它线程唤醒任务时通知执行器的次数
+  std::atomic<uint64_t> m_doorbell_cnt{0};
+  // 轮询回调
+  std::function<size_t()> m_poller;
+  // 是否需要调用轮询回调
+  std::atomic_bool m_poked{false};
+  // runnable队列、awoken队列中以及正在执行的任务数量
+  std::atomic<size_t> m_queue_depth{0};
+  // 任务在runnable队列中排队时间的指数移动平均(单位us)
+  std::atomic<uint64_t> m_queue_delay_us{0};
   // 当前正在运行的协程
   CoTaskPtr m_running_task = nullptr;
   // 条件变量
@@ -325,6 +796,10 @@ private:
   std::atomic_bool m_waiting;
   // 是否将要停止
   std::atomic_bool m_is_stopping{false};
+  // 等待超时时还有挂起的任务则继续运行
+  std::atomic_bool m_linger_while_holding{false};
+  // 由调度器扩容出来，空闲keep-alive时间后退出，退出时挂起的任务会转交给其它执行器
+  bool m_elastic = false;
   // 协程调度次数
   volatile uint64_t m_switch_cnt = 0;
   // 调度完成的次数
@@ -333,23 +808,98 @@ private:
   bool m_active = false;
   // 当前执行的协程开始的时间戳(单位us)
   volatile uint64_t m_tick = 0;
+  // 当前协程被监控线程判定为阻塞
+  std::atomic_bool m_blocked{false};
+  // 默认的时间片长度(单位us)
+  uint64_t m_time_slice_us = COROUTINE_TIME_SLICE_US;
+  // 当前执行的协程的时间片到期时间戳(单位us)
+  uint64_t m_slice_end_us = 0;
+  // 距离下一次检查时间片还剩余的MaybeYield调用次数
+  uint32_t m_slice_check_countdown = MAYBE_YIELD_CHECK_INTERVAL;
+  // 当前协程是主动让出而不是挂起，换出后需要放回runnable队列
+  bool m_yield_requested = false;
+  // 挂起的任务被唤醒时的迁移回调
+  std::function<bool(const CoTaskPtr &, HoldResult)> m_wakeup_hook;
+  // 当前协程换出后的去向，为空时按照协程状态处理
+  std::function<void(const CoTaskPtr &)> m_handoff;
+  // 当前协程挂起并且换出之后调用的函数
+  std::function<void()> m_after_hold;
+  // 因为时间片用完而让出的次数
+  uint64_t m_preempt_cnt = 0;
+  // 选择下一个任务的方式
+  QueueMode m_queue_mode = FIFO_QUEUE;
+  // EDF模式下错过截止时间的任务的处理方式
+  LatePolicy m_late_policy = LATE_DEPRIORITIZE;
+  // EDF模式下按照截止时间排序的最小堆，只在执行器线程中访问
+  std::vector<CoTaskPtr> m_edf_heap;
+  // EDF模式下被降级的任务，只在执行器线程中访问
+  std::deque<CoTaskPtr> m_late_queue;
+  // 在截止时间之前完成的任务数量
+  std::atomic<uint64_t> m_deadline_met{0};
+  // 错过截止时间的任务数量
+  std::atomic<uint64_t> m_deadline_missed{0};
+  // 错过截止时间被丢弃的任务数量
+  std::atomic<uint64_t> m_deadline_dropped{0};
+  // 队列上限，为0表示不限制
+  size_t m_queue_limit = 0;
+  // 队列达到上限时的处理方式
+  OverflowPolicy m_overflow_policy = OVERFLOW_REJECT;
+  // 任务的最大排队时间(单位us)，为0表示不限制
+  uint64_t m_max_queue_time_us = 0;
+  // 被拒绝的任务数量
+  std::atomic<uint64_t> m_rejected_cnt{0};
+  // 被丢弃的任务数量
+  std::atomic<uint64_t> m_shed_cnt{0};
   // 执行器开始执行的开始时间
   uint64_t m_start_elapse = GetCurrentMs();
   // 上次回收垃圾的时间戳
   uint64_t m_last_gc_tick = 0;
   // 马上gc
   bool m_clean_right_now = false;
+  // 挂起任务中最近的自动唤醒时间戳(单位us)
+  std::atomic<uint64_t> m_next_timer_us{NO_TIMER_US};
 };
 
 typedef CoExecutor::CoTaskPtr TaskPtr;
 typedef CoExecutor::CoTask Task;
 
+/**
+ * @brief 将TimePoint转换为和GetCurrentUs()相同起点的时间戳(单位us)，TimePoint::max()转换为0表示没有截止时间
+ *
+ */
+uint64_t TimePointToUs(const CoExecutor::TimePoint &tp);
+
 namespace this_coroutine {
 
 void Yield();
 
+/**
+ * @brief 时间片用完时才让出，详见CoExecutor::MaybeYieldCurrent
+ *
+ */
+bool MaybeYield();
+
 int32_t GetId();
 
+/**
+ * @brief 当前协程的任务是否已经被取消或者截止时间已过
+ *
+ */
+bool IsCancelled();
+
+/**
+ * @brief 获取当前协程任务的取消令牌
+ *
+ */
+CancellationToken GetCancellationToken();
+
+/**
+ * @brief 设置当前协程是否和线程相关，和线程相关的协程挂起后只在原来的线程中恢复，不会被迁移或者窃取
+ *
+ * @param affine 是否和线程相关
+ */
+void SetThreadAffine(bool affine = true);
+
 } // namespace this_coroutine;
 
 } // namespace src
\ No newline at end of file
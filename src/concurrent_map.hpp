@@ -0,0 +1,341 @@
+#ifndef __AHRI_CONCURRENT_MAP_HPP__
+#define __AHRI_CONCURRENT_MAP_HPP__
+
+#include <stdlib.h>
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+#include "coexecutor.h"
+#include "mutexes.h"
+
+// 默认的分片数量
+#define CONCURRENT_MAP_SHARDS 64
+// 协程在挂起之前重试上锁的次数
+#define CONCURRENT_MAP_SPIN_TRIES 64
+
+namespace ahri {
+
+/**
+ * @brief 分片的并发哈希表，每个分片有自己的读写锁，不同分片上的操作互不影响
+ * 分片按照缓存行对齐，相邻分片的锁不会伪共享；元素数量由每个分片的原子计数器维护，Size不需要加锁。
+ * 在协程中调用时，锁被占用的协程短暂重试后挂起，由释放分片的线程唤醒，不会阻塞执行器的线程；
+ * 不在协程中时直接阻塞在读写锁上。传入的回调函数在持有分片的锁时执行，不能挂起或者再访问同一个表
+ *
+ * @tparam K 键
+ * @tparam V 值，Find等读取操作会复制一份
+ * @tparam Hash 哈希函数
+ */
+template <typename K, typename V, typename Hash = std::hash<K>>
+class ConcurrentHashMap {
+private:
+  struct Shard {
+    RWMutex lock;
+    std::unordered_map<K, V, Hash> map;
+    std::atomic<size_t> size{0};
+    // 在这个分片上挂起的协程
+    std::atomic<size_t> n_waiters{0};
+    std::mutex wait_mtx;
+    std::vector<CoExecutor::RecoveryEntry> waiters;
+  };
+
+  // 每个分片占用整数个缓存行
+  struct PaddedShard {
+    Shard shard;
+    char padding[64 - sizeof(Shard) % 64];
+  };
+
+public:
+  /**
+   * @brief 创建哈希表
+   *
+   * @param shard_count 分片数量，会向上取整到2的幂
+   */
+  explicit ConcurrentHashMap(size_t shard_count = CONCURRENT_MAP_SHARDS) {
+    size_t n = 1;
+    while (n < shard_count) {
+      n <<= 1;
+    }
+    m_mask = n - 1;
+    void *mem = nullptr;
+    if (posix_memalign(&mem, 64, n * sizeof(PaddedShard)) != 0) {
+      throw std::bad_alloc();
+    }
+    m_shards = static_cast<PaddedShard *>(mem);
+    for (size_t i = 0; i < n; ++i) {
+      new (&m_shards[i]) PaddedShard();
+    }
+  }
+
+  ~ConcurrentHashMap() {
+    for (size_t i = 0; i <= m_mask; ++i) {
+      m_shards[i].~PaddedShard();
+    }
+    free(m_shards);
+  }
+
+  ConcurrentHashMap(const ConcurrentHashMap &) = delete;
+
+  ConcurrentHashMap &operator=(const ConcurrentHashMap &) = delete;
+
+  size_t ShardCount() const { return m_mask + 1; }
+
+  /**
+   * @brief 元素数量，有其它线程同时修改时只是近似值
+   *
+   */
+  size_t Size() const {
+    size_t total = 0;
+    for (size_t i = 0; i <= m_mask; ++i) {
+      total += m_shards[i].shard.size.load(std::memory_order_relaxed);
+    }
+    return total;
+  }
+
+  bool Empty() const { return Size() == 0; }
+
+  /**
+   * @brief 查找key并复制值
+   *
+   * @param key 键
+   * @param out 找到时的值
+   * @return true
+   * @return false 不存在
+   */
+  bool Find(const K &key, V &out) const {
+    Shard &shard = ShardOf(key);
+    LockShard(shard, false);
+    auto it = shard.map.find(key);
+    bool found = it != shard.map.end();
+    if (found) {
+      out = it->second;
+    }
+    UnlockShard(shard);
+    return found;
+  }
+
+  bool Contains(const K &key) const {
+    Shard &shard = ShardOf(key);
+    LockShard(shard, false);
+    bool found = shard.map.count(key) != 0;
+    UnlockShard(shard);
+    return found;
+  }
+
+  /**
+   * @brief key不存在时插入
+   *
+   * @return true 插入成功
+   * @return false 已经存在，原来的值不变
+   */
+  bool Insert(const K &key, V value) {
+    Shard &shard = ShardOf(key);
+    LockShard(shard, true);
+    bool inserted = shard.map.emplace(key, std::move(value)).second;
+    if (inserted) {
+      shard.size.fetch_add(1, std::memory_order_relaxed);
+    }
+    UnlockShard(shard);
+    return inserted;
+  }
+
+  /**
+   * @brief 插入或者覆盖
+   *
+   * @return true 新插入
+   * @return false 覆盖了原来的值
+   */
+  bool InsertOrAssign(const K &key, V value) {
+    Shard &shard = ShardOf(key);
+    LockShard(shard, true);
+    auto it = shard.map.find(key);
+    bool inserted = it == shard.map.end();
+    if (inserted) {
+      shard.map.emplace(key, std::move(value));
+      shard.size.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      it->second = std::move(value);
+    }
+    UnlockShard(shard);
+    return inserted;
+  }
+
+  /**
+   * @brief 删除key
+   *
+   * @return true
+   * @return false 不存在
+   */
+  bool Erase(const K &key) {
+    Shard &shard = ShardOf(key);
+    LockShard(shard, true);
+    bool erased = shard.map.erase(key) != 0;
+    if (erased) {
+      shard.size.fetch_sub(1, std::memory_order_relaxed);
+    }
+    UnlockShard(shard);
+    return erased;
+  }
+
+  /**
+   * @brief key存在时在写锁内用fn(V&)原地修改
+   *
+   * @return true
+   * @return false 不存在
+   */
+  template <typename F>
+  bool Update(const K &key, F fn) {
+    Shard &shard = ShardOf(key);
+    LockShard(shard, true);
+    auto it = shard.map.find(key);
+    bool found = it != shard.map.end();
+    if (found) {
+      fn(it->second);
+    }
+    UnlockShard(shard);
+    return found;
+  }
+
+  /**
+   * @brief key不存在时先插入init，然后在写锁内用fn(V&)原地修改，整个过程是原子的
+   *
+   * @return V 修改后的值
+   */
+  template <typename F>
+  V Upsert(const K &key, const V &init, F fn) {
+    Shard &shard = ShardOf(key);
+    LockShard(shard, true);
+    auto ret = shard.map.emplace(key, init);
+    if (ret.second) {
+      shard.size.fetch_add(1, std::memory_order_relaxed);
+    }
+    fn(ret.first->second);
+    V value = ret.first->second;
+    UnlockShard(shard);
+    return value;
+  }
+
+  /**
+   * @brief 逐个分片持有读锁遍历，fn(const K&, const V&)，不是整个表的快照
+   *
+   */
+  template <typename F>
+  void ForEach(F fn) const {
+    for (size_t i = 0; i <= m_mask; ++i) {
+      Shard &shard = m_shards[i].shard;
+      LockShard(shard, false);
+      for (auto &kv : shard.map) {
+        fn(kv.first, kv.second);
+      }
+      UnlockShard(shard);
+    }
+  }
+
+  void Clear() {
+    for (size_t i = 0; i <= m_mask; ++i) {
+      Shard &shard = m_shards[i].shard;
+      LockShard(shard, true);
+      shard.map.clear();
+      shard.size.store(0, std::memory_order_relaxed);
+      UnlockShard(shard);
+    }
+  }
+
+private:
+  Shard &ShardOf(const K &key) const {
+    // 打散哈希值的高位，std::hash对整数是恒等映射
+    size_t h = m_hasher(key);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return m_shards[h & m_mask].shard;
+  }
+
+  static bool TryLockShard(Shard &shard, bool write) {
+    return write ? shard.lock.TryWrLock() : shard.lock.TryRdLock();
+  }
+
+  /**
+   * @brief 给分片上锁，在协程中锁被占用时挂起当前协程
+   *
+   */
+  static void LockShard(Shard &shard, bool write) {
+    if (TryLockShard(shard, write)) {
+      return;
+    }
+    if (!CoExecutor::GetCurrentTask()) {
+      write ? shard.lock.WrLock() : shard.lock.RdLock();
+      return;
+    }
+    for (int i = 0; i < CONCURRENT_MAP_SPIN_TRIES; ++i) {
+      if (TryLockShard(shard, write)) {
+        return;
+      }
+    }
+    while (!TryLockShard(shard, write)) {
+      CoExecutor::RecoveryEntry entry;
+      CoExecutor::HoldResult ret = CoExecutor::HoldThen(entry, [&shard, &entry, write]() {
+        {
+          std::lock_guard<std::mutex> lk(shard.wait_mtx);
+          shard.waiters.push_back(entry);
+          shard.n_waiters.fetch_add(1);
+        }
+        // 登记之前锁可能已经释放，释放的线程看不到这次登记，再检查一次，锁空闲时唤醒所有等待者重新竞争
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (TryLockShard(shard, write)) {
+          UnlockShard(shard);
+        }
+      });
+      if (ret != CoExecutor::AWOKEN) {
+        // 被取消或者超时，移除登记，之后阻塞线程等待
+        RemoveWaiter(shard, entry);
+        write ? shard.lock.WrLock() : shard.lock.RdLock();
+        return;
+      }
+    }
+  }
+
+  static void UnlockShard(Shard &shard) {
+    shard.lock.Unlock();
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (shard.n_waiters.load(std::memory_order_relaxed) > 0) {
+      WakeWaiters(shard);
+    }
+  }
+
+  static void WakeWaiters(Shard &shard) {
+    std::vector<CoExecutor::RecoveryEntry> waiters;
+    {
+      std::lock_guard<std::mutex> lk(shard.wait_mtx);
+      waiters.swap(shard.waiters);
+      shard.n_waiters.store(0);
+    }
+    for (auto &entry : waiters) {
+      CoExecutor::Wakeup(entry);
+    }
+  }
+
+  static void RemoveWaiter(Shard &shard, const CoExecutor::RecoveryEntry &entry) {
+    std::lock_guard<std::mutex> lk(shard.wait_mtx);
+    for (auto it = shard.waiters.begin(); it != shard.waiters.end(); ++it) {
+      if (it->handle == entry.handle) {
+        shard.waiters.erase(it);
+        shard.n_waiters.fetch_sub(1);
+        break;
+      }
+    }
+  }
+
+private:
+  PaddedShard *m_shards;
+  size_t m_mask;
+  Hash m_hasher;
+};
+
+} // namespace src
+
+#endif
@@ -1,10 +1,17 @@
 #ifndef __AHRI_CONTAINERS_HPP__
 #define __AHRI_CONTAINERS_HPP__
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <deque>
+#include <iterator>
 #include <mutex>
+#include <new>
 #include <iostream>
+#include <type_traits>
 
+#include "slab.hpp"
 
 using std::deque;
 using std::lock_guard;
@@ -64,7 +71,7 @@ public:
 
   void PushBack(T&& value) {
     lock_guard<mutex> lk(m_mtx);
-    m_datas.push_back(value);
+    m_datas.push_back(std::move(value));
   }
 
   void PushBackUnsafe(const T& value) {
@@ -72,7 +79,7 @@ public:
   }
 
   void PushBackUnsafe(T&& value) {
-    m_datas.push_back(value);
+    m_datas.push_back(std::move(value));
   }
 
   d_iterator Erase(d_iterator pos) {
@@ -114,12 +121,12 @@ public:
   template <typename... Args>
   void EmplaceBack(Args&&... args) {
     lock_guard<mutex> lk(m_mtx);
-    m_datas.emplace_back(args...);
+    m_datas.emplace_back(std::forward<Args>(args)...);
   }
 
   template <typename... Args>
   void EmplaceBackUnsafe(Args&&... args) {
-    m_datas.emplace_back(args...);
+    m_datas.emplace_back(std::forward<Args>(args)...);
   }
 
   void PopBack() {
@@ -138,7 +145,7 @@ public:
 
   void PushFront(T&& value) {
     lock_guard<mutex> lk(m_mtx);
-    m_datas.push_front(value);
+    m_datas.push_front(std::move(value));
   }
 
   void PushFrontUnsafe(const T& value) {
@@ -146,7 +153,7 @@ public:
   }
 
   void PushFrontUnsafe(T&& value) {
-    m_datas.push_front(value);
+    m_datas.push_front(std::move(value));
   }
 
   void PopFront() {
@@ -158,15 +165,49 @@ public:
     m_datas.pop_front();
   }
 
+  /**
+   * @brief 取出第一个元素，队列为空时返回false
+   * 
+   * @param out 取出的元素
+   * @return true 
+   * @return false 
+   */
+  bool TryPopFront(T& out) {
+    lock_guard<mutex> lk(m_mtx);
+    if (m_datas.empty()) {
+      return false;
+    }
+    out = std::move(m_datas.front());
+    m_datas.pop_front();
+    return true;
+  }
+
+  /**
+   * @brief 取出最后一个元素，队列为空时返回false
+   * 
+   * @param out 取出的元素
+   * @return true 
+   * @return false 
+   */
+  bool TryPopBack(T& out) {
+    lock_guard<mutex> lk(m_mtx);
+    if (m_datas.empty()) {
+      return false;
+    }
+    out = std::move(m_datas.back());
+    m_datas.pop_back();
+    return true;
+  }
+
   template<typename... Args>
   void EmplaceFront(Args&&... args) {
     lock_guard<mutex> lk(m_mtx);
-    m_datas.emplace_front(args...);
+    m_datas.emplace_front(std::forward<Args>(args)...);
   }
 
   template<typename... Args>
   void EmplaceFrontUnsafe(Args&&... args) {
-    m_datas.emplace_front(args...);
+    m_datas.emplace_front(std::forward<Args>(args)...);
   }
 
   void Swap(ThreadSafeDeque& other) {
@@ -225,7 +266,7 @@ public:
     n = std::min(n, m_datas.size());
     auto begin = m_datas.begin();
     auto end = m_datas.begin() + n;
-    ans.m_datas.assign(begin, end);
+    ans.m_datas.assign(std::make_move_iterator(begin), std::make_move_iterator(end));
     m_datas.erase(begin, end);
   }
 
@@ -244,7 +285,7 @@ public:
     n = std::min(n, m_datas.size());
     auto begin = m_datas.begin() + m_datas.size() - n;
     auto end = m_datas.end();
-    ans.m_datas.assign(begin, end);
+    ans.m_datas.assign(std::make_move_iterator(begin), std::make_move_iterator(end));
     m_datas.erase(begin, end);
   }
 
@@ -263,7 +304,7 @@ public:
     n = std::min(n, m_datas.size());
     auto begin = m_datas.begin();
     auto end = m_datas.begin() + n;
-    out.m_datas.insert(out.m_datas.end(), begin, end);
+    out.m_datas.insert(out.m_datas.end(), std::make_move_iterator(begin), std::make_move_iterator(end));
     m_datas.erase(begin, end);
   }
 
@@ -282,10 +323,69 @@ public:
     n = std::min(n, m_datas.size());
     auto begin = m_datas.begin() + m_datas.size() - n;
     auto end = m_datas.end();
-    out.m_datas.insert(out.m_datas.end(), begin, end);
+    out.m_datas.insert(out.m_datas.end(), std::make_move_iterator(begin), std::make_move_iterator(end));
     m_datas.erase(begin, end);
   }
 
+  /**
+   * @brief 把所有元素移动到out末尾，两个队列各加一次锁；out为空时直接交换底层的deque
+   * 
+   * @param out 
+   * @return size_t 移动的数量
+   */
+  size_t DrainTo(ThreadSafeDeque& out) {
+    if (&out == this) {
+      return 0;
+    }
+    std::unique_lock<mutex> lk1(m_mtx, std::defer_lock);
+    std::unique_lock<mutex> lk2(out.m_mtx, std::defer_lock);
+    std::lock(lk1, lk2);
+    return DrainToUnsafe(out);
+  }
+
+  size_t DrainToUnsafe(ThreadSafeDeque& out) {
+    size_t n = m_datas.size();
+    if (out.m_datas.empty()) {
+      out.m_datas.swap(m_datas);
+    } else {
+      out.m_datas.insert(out.m_datas.end(), std::make_move_iterator(m_datas.begin()),
+                         std::make_move_iterator(m_datas.end()));
+      m_datas.clear();
+    }
+    return n;
+  }
+
+  /**
+   * @brief 把other的所有元素移动到本队列末尾，other变为空
+   * 
+   * @param other 
+   * @return size_t 移动的数量
+   */
+  size_t Splice(ThreadSafeDeque& other) {
+    return other.DrainTo(*this);
+  }
+
+  /**
+   * @brief 从队头取出最多n个元素，按照顺序移动到out，只加一次锁
+   * 
+   * @param n 最多取出的数量
+   * @param out 输出迭代器
+   * @return size_t 取出的数量
+   */
+  template <typename OutputIterator>
+  size_t PopBatch(size_t n, OutputIterator out) {
+    lock_guard<mutex> lk(m_mtx);
+    return PopBatchUnsafe(n, out);
+  }
+
+  template <typename OutputIterator>
+  size_t PopBatchUnsafe(size_t n, OutputIterator out) {
+    n = std::min(n, m_datas.size());
+    auto end = m_datas.begin() + n;
+    std::move(m_datas.begin(), end, out);
+    m_datas.erase(m_datas.begin(), end);
+    return n;
+  }
 
 /**
  * @brief 迭代器
@@ -332,6 +432,568 @@ private:
   mutable mutex m_mtx;
 };
 
+/**
+ * @brief 无锁的多生产者单消费者队列
+ * 生产者把元素压入一个原子链表，消费者一次取走整个链表，取出时不会和生产者争抢锁
+ *
+ * @tparam T
+ */
+template <typename T>
+class MpscQueue {
+private:
+  // 节点通常在生产者线程分配、在消费者线程释放，从slab分配不会竞争malloc的锁
+  struct Node : public SlabAllocated<Node> {
+    explicit Node(const T &v) : value(v), next(nullptr) {}
+
+    explicit Node(T &&v) : value(std::move(v)), next(nullptr) {}
+
+    T value;
+    Node *next;
+  };
+
+public:
+  MpscQueue() : m_head(nullptr) {}
+
+  ~MpscQueue() {
+    Node *node = m_head.exchange(nullptr);
+    while (node) {
+      Node *next = node->next;
+      delete node;
+      node = next;
+    }
+  }
+
+  MpscQueue(const MpscQueue &) = delete;
+
+  MpscQueue &operator=(const MpscQueue &) = delete;
+
+  /**
+   * @brief 放入元素，可以在任意线程中调用
+   *
+   * @param value
+   * @return true 放入前队列为空，消费者可能需要被通知
+   * @return false 队列中已经有元素，已经有生产者负责通知
+   */
+  bool Push(const T &value) { return PushNode(new Node(value)); }
+
+  bool Push(T &&value) { return PushNode(new Node(std::move(value))); }
+
+  bool Empty() const noexcept { return m_head.load() == nullptr; }
+
+  /**
+   * @brief 取走当前所有的元素，按照放入的顺序依次调用fn
+   * 整个链表通过一次原子交换取走，多个线程同时调用也是安全的
+   *
+   * @param fn 处理每个元素的函数
+   * @return size_t 取出的元素数量
+   */
+  template <typename F>
+  size_t ConsumeAll(F fn) {
+    Node *node = m_head.exchange(nullptr);
+    // 链表是后进先出的，反转后按照放入的顺序处理
+    Node *prev = nullptr;
+    while (node) {
+      Node *next = node->next;
+      node->next = prev;
+      prev = node;
+      node = next;
+    }
+    size_t count = 0;
+    while (prev) {
+      Node *next = prev->next;
+      fn(prev->value);
+      delete prev;
+      prev = next;
+      ++count;
+    }
+    return count;
+  }
+
+private:
+  bool PushNode(Node *node) {
+    Node *head = m_head.load(std::memory_order_relaxed);
+    do {
+      node->next = head;
+    } while (!m_head.compare_exchange_weak(head, node));
+    return head == nullptr;
+  }
+
+private:
+  std::atomic<Node *> m_head;
+};
+
+/**
+ * @brief 无锁的单生产者单消费者队列，没有容量限制
+ * 只能有一个线程放入、一个线程取出，头尾指针之间填充一个缓存行
+ *
+ * @tparam T 需要可以默认构造
+ */
+template <typename T>
+class SpscQueue {
+private:
+  struct Node : public SlabAllocated<Node> {
+    Node() : next(nullptr) {}
+
+    explicit Node(T &&v) : value(std::move(v)), next(nullptr) {}
+
+    T value;
+    std::atomic<Node *> next;
+  };
+
+public:
+  SpscQueue() : m_head(new Node()), m_padding(), m_tail(m_head) {}
+
+  ~SpscQueue() {
+    while (m_head) {
+      Node *next = m_head->next.load(std::memory_order_relaxed);
+      delete m_head;
+      m_head = next;
+    }
+  }
+
+  SpscQueue(const SpscQueue &) = delete;
+
+  SpscQueue &operator=(const SpscQueue &) = delete;
+
+  /**
+   * @brief 放入元素，只能在生产者线程中调用
+   *
+   */
+  void Push(T value) {
+    Node *node = new Node(std::move(value));
+    m_tail->next.store(node, std::memory_order_release);
+    m_tail = node;
+  }
+
+  /**
+   * @brief 取出元素，只能在消费者线程中调用
+   *
+   * @param out 取出的元素
+   * @return true 
+   * @return false 队列为空
+   */
+  bool Pop(T &out) {
+    Node *next = m_head->next.load(std::memory_order_acquire);
+    if (!next) {
+      return false;
+    }
+    // 取出的节点成为新的哨兵节点
+    out = std::move(next->value);
+    delete m_head;
+    m_head = next;
+    return true;
+  }
+
+private:
+  // 消费者使用的哨兵节点
+  Node *m_head;
+  // 避免头尾指针的伪共享
+  char m_padding[64 - sizeof(Node *)];
+  // 生产者使用的最后一个节点
+  Node *m_tail;
+};
+
+/**
+ * @brief 无锁的有界多生产者多消费者环形队列
+ * 每个位置带一个序号，生产者和消费者通过序号判断位置是否可以写入或者读取，
+ * 只需要一次CAS占住位置，之后读写这个位置不会和其它线程冲突。放入和取出的位置之间填充缓存行
+ *
+ * @tparam T 可以是只能移动的类型
+ */
+template <typename T>
+class MpmcQueue {
+private:
+  struct Slot {
+    // 等于pos时可以写入第pos个元素，等于pos + 1时可以读取第pos个元素
+    std::atomic<size_t> seq;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+    T *Value() { return reinterpret_cast<T *>(&storage); }
+  };
+
+public:
+  /**
+   * @brief 创建队列
+   *
+   * @param capacity 容量，会向上取整到2的幂
+   */
+  explicit MpmcQueue(size_t capacity) : m_padding0(), m_enqueue_pos(0), m_padding1(), m_dequeue_pos(0), m_padding2() {
+    size_t cap = 2;
+    while (cap < capacity) {
+      cap <<= 1;
+    }
+    m_mask = cap - 1;
+    m_slots = new Slot[cap];
+    for (size_t i = 0; i < cap; ++i) {
+      m_slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  ~MpmcQueue() {
+    size_t end = m_enqueue_pos.load(std::memory_order_relaxed);
+    for (size_t pos = m_dequeue_pos.load(std::memory_order_relaxed); pos != end; ++pos) {
+      m_slots[pos & m_mask].Value()->~T();
+    }
+    delete[] m_slots;
+  }
+
+  MpmcQueue(const MpmcQueue &) = delete;
+
+  MpmcQueue &operator=(const MpmcQueue &) = delete;
+
+  size_t Capacity() const noexcept { return m_mask + 1; }
+
+  /**
+   * @brief 队列中的元素数量，有其它线程同时操作时只是近似值
+   *
+   */
+  size_t Size() const noexcept {
+    size_t deq = m_dequeue_pos.load(std::memory_order_relaxed);
+    size_t enq = m_enqueue_pos.load(std::memory_order_relaxed);
+    return enq > deq ? enq - deq : 0;
+  }
+
+  bool Empty() const noexcept { return Size() == 0; }
+
+  /**
+   * @brief 在队尾构造元素
+   *
+   * @return true
+   * @return false 队列已满，参数没有被使用
+   */
+  template <typename... Args>
+  bool TryEmplace(Args &&...args) {
+    size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+      Slot &slot = m_slots[pos & m_mask];
+      intptr_t diff = (intptr_t) slot.seq.load(std::memory_order_acquire) - (intptr_t) pos;
+      if (diff == 0) {
+        if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          new (slot.Value()) T(std::forward<Args>(args)...);
+          slot.seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;  // 这个位置上一轮的元素还没有被取走
+      } else {
+        pos = m_enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool TryPush(const T &value) { return TryEmplace(value); }
+
+  /**
+   * @brief 放入元素，队列已满时value不会被移走
+   *
+   */
+  bool TryPush(T &&value) { return TryEmplace(std::move(value)); }
+
+  /**
+   * @brief 从队头取出元素
+   *
+   * @param out 取出的元素
+   * @return true
+   * @return false 队列为空
+   */
+  bool TryPop(T &out) {
+    size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+      Slot &slot = m_slots[pos & m_mask];
+      intptr_t diff = (intptr_t) slot.seq.load(std::memory_order_acquire) - (intptr_t) (pos + 1);
+      if (diff == 0) {
+        if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          Consume(slot, pos, out);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = m_dequeue_pos.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /**
+   * @brief 批量放入[first, last)中的元素，一次CAS占住所有能放下的位置。传入std::move_iterator时元素会被移走
+   *
+   * @return size_t 放入的数量，放入的是区间开头的这些元素
+   */
+  template <typename Iterator>
+  size_t TryPushBatch(Iterator first, Iterator last) {
+    size_t want = (size_t) std::distance(first, last);
+    size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    size_t n = ClaimBatch(m_enqueue_pos, pos, want, 0);
+    for (size_t i = 0; i < n; ++i, ++first) {
+      Slot &slot = m_slots[(pos + i) & m_mask];
+      new (slot.Value()) T(*first);
+      slot.seq.store(pos + i + 1, std::memory_order_release);
+    }
+    return n;
+  }
+
+  /**
+   * @brief 批量取出最多max_count个元素，一次CAS占住所有可以读取的位置
+   *
+   * @param out 输出迭代器，取出的元素按照顺序移动到这里
+   * @param max_count 最多取出的数量
+   * @return size_t 取出的数量
+   */
+  template <typename OutputIterator>
+  size_t TryPopBatch(OutputIterator out, size_t max_count) {
+    size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+    size_t n = ClaimBatch(m_dequeue_pos, pos, max_count, 1);
+    for (size_t i = 0; i < n; ++i, ++out) {
+      Slot &slot = m_slots[(pos + i) & m_mask];
+      *out = std::move(*slot.Value());
+      slot.Value()->~T();
+      slot.seq.store(pos + i + m_mask + 1, std::memory_order_release);
+    }
+    return n;
+  }
+
+private:
+  void Consume(Slot &slot, size_t pos, T &out) {
+    out = std::move(*slot.Value());
+    slot.Value()->~T();
+    // 下一轮写入这个位置的序号
+    slot.seq.store(pos + m_mask + 1, std::memory_order_release);
+  }
+
+  /**
+   * @brief 从pos开始占住最多want个连续的就绪位置，就绪指序号等于位置加上offset
+   * 位置的序号只会被占住它的线程修改，所以CAS成功时检查过的位置仍然就绪
+   *
+   * @param cursor 放入或者取出的位置
+   * @param pos 输出占住的第一个位置
+   * @param want 最多占住的数量
+   * @param offset 放入时为0，取出时为1
+   * @return size_t 占住的数量
+   */
+  size_t ClaimBatch(std::atomic<size_t> &cursor, size_t &pos, size_t want, size_t offset) {
+    while (want > 0) {
+      intptr_t diff = (intptr_t) m_slots[pos & m_mask].seq.load(std::memory_order_acquire) - (intptr_t) (pos + offset);
+      if (diff < 0) {
+        return 0;
+      }
+      if (diff > 0) {
+        pos = cursor.load(std::memory_order_relaxed);
+        continue;
+      }
+      size_t n = 1;
+      while (n < want && m_slots[(pos + n) & m_mask].seq.load(std::memory_order_acquire) == pos + n + offset) {
+        ++n;
+      }
+      if (cursor.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed)) {
+        return n;
+      }
+    }
+    return 0;
+  }
+
+private:
+  Slot *m_slots;
+  size_t m_mask;
+  char m_padding0[64];
+  // 下一个放入的位置
+  std::atomic<size_t> m_enqueue_pos;
+  char m_padding1[64 - sizeof(std::atomic<size_t>)];
+  // 下一个取出的位置
+  std::atomic<size_t> m_dequeue_pos;
+  char m_padding2[64 - sizeof(std::atomic<size_t>)];
+};
+
+/**
+ * @brief 无锁的有界单生产者单消费者环形队列
+ * 生产者和消费者各自缓存对方的位置，只有缓存的位置显示队列满或者空时才去读对方的缓存行；
+ * 批量放入和取出只发布一次位置。放入和取出都是无等待的
+ *
+ * @tparam T 可以是只能移动的类型
+ */
+template <typename T>
+class SpscRing {
+private:
+  typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Storage;
+
+public:
+  /**
+   * @brief 创建队列
+   *
+   * @param capacity 容量，会向上取整到2的幂
+   */
+  explicit SpscRing(size_t capacity)
+      : m_padding0(), m_tail(0), m_cached_head(0), m_padding1(), m_head(0), m_cached_tail(0), m_padding2() {
+    size_t cap = 2;
+    while (cap < capacity) {
+      cap <<= 1;
+    }
+    m_mask = cap - 1;
+    m_slots = new Storage[cap];
+  }
+
+  ~SpscRing() {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    for (size_t pos = m_head.load(std::memory_order_relaxed); pos != tail; ++pos) {
+      Value(pos)->~T();
+    }
+    delete[] m_slots;
+  }
+
+  SpscRing(const SpscRing &) = delete;
+
+  SpscRing &operator=(const SpscRing &) = delete;
+
+  size_t Capacity() const noexcept { return m_mask + 1; }
+
+  /**
+   * @brief 队列中的元素数量，在生产者和消费者以外的线程中调用时只是近似值
+   *
+   */
+  size_t Size() const noexcept {
+    size_t head = m_head.load(std::memory_order_acquire);
+    size_t tail = m_tail.load(std::memory_order_acquire);
+    return tail - head;
+  }
+
+  bool Empty() const noexcept { return Size() == 0; }
+
+  /**
+   * @brief 在队尾构造元素，只能在生产者线程中调用
+   *
+   * @return true
+   * @return false 队列已满，参数没有被使用
+   */
+  template <typename... Args>
+  bool TryEmplace(Args &&...args) {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    if (Writable(tail, 1) == 0) {
+      return false;
+    }
+    new (Value(tail)) T(std::forward<Args>(args)...);
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool TryPush(const T &value) { return TryEmplace(value); }
+
+  bool TryPush(T &&value) { return TryEmplace(std::move(value)); }
+
+  /**
+   * @brief 取出元素，只能在消费者线程中调用
+   *
+   * @param out 取出的元素
+   * @return true
+   * @return false 队列为空
+   */
+  bool TryPop(T &out) {
+    size_t head = m_head.load(std::memory_order_relaxed);
+    if (Readable(head, 1) == 0) {
+      return false;
+    }
+    out = std::move(*Value(head));
+    Value(head)->~T();
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief 批量放入[first, last)中能放下的元素，最后只发布一次。传入std::move_iterator时元素会被移走
+   *
+   * @return size_t 放入的数量，放入的是区间开头的这些元素
+   */
+  template <typename Iterator>
+  size_t TryPushBatch(Iterator first, Iterator last) {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    size_t n = Writable(tail, (size_t) std::distance(first, last));
+    for (size_t i = 0; i < n; ++i, ++first) {
+      new (Value(tail + i)) T(*first);
+    }
+    if (n > 0) {
+      m_tail.store(tail + n, std::memory_order_release);
+    }
+    return n;
+  }
+
+  /**
+   * @brief 批量取出最多max_count个元素，最后只发布一次
+   *
+   * @param out 输出迭代器，取出的元素按照顺序移动到这里
+   * @param max_count 最多取出的数量
+   * @return size_t 取出的数量
+   */
+  template <typename OutputIterator>
+  size_t TryPopBatch(OutputIterator out, size_t max_count) {
+    size_t head = m_head.load(std::memory_order_relaxed);
+    size_t n = Readable(head, max_count);
+    for (size_t i = 0; i < n; ++i, ++out) {
+      *out = std::move(*Value(head + i));
+      Value(head + i)->~T();
+    }
+    if (n > 0) {
+      m_head.store(head + n, std::memory_order_release);
+    }
+    return n;
+  }
+
+  /**
+   * @brief 依次用fn处理最多max_count个元素，不需要先移动到别的容器中
+   *
+   * @return size_t 处理的数量
+   */
+  template <typename F>
+  size_t ConsumeBatch(F fn, size_t max_count) {
+    size_t head = m_head.load(std::memory_order_relaxed);
+    size_t n = Readable(head, max_count);
+    for (size_t i = 0; i < n; ++i) {
+      fn(*Value(head + i));
+      Value(head + i)->~T();
+    }
+    if (n > 0) {
+      m_head.store(head + n, std::memory_order_release);
+    }
+    return n;
+  }
+
+private:
+  T *Value(size_t pos) { return reinterpret_cast<T *>(&m_slots[pos & m_mask]); }
+
+  /**
+   * @brief 生产者可以写入的数量，缓存的消费者位置不够时才重新读取
+   *
+   */
+  size_t Writable(size_t tail, size_t want) {
+    size_t cap = m_mask + 1;
+    if (tail - m_cached_head + want > cap) {
+      m_cached_head = m_head.load(std::memory_order_acquire);
+    }
+    return std::min(want, cap - (tail - m_cached_head));
+  }
+
+  /**
+   * @brief 消费者可以读取的数量，缓存的生产者位置不够时才重新读取
+   *
+   */
+  size_t Readable(size_t head, size_t want) {
+    if (m_cached_tail - head < want) {
+      m_cached_tail = m_tail.load(std::memory_order_acquire);
+    }
+    return std::min(want, m_cached_tail - head);
+  }
+
+private:
+  Storage *m_slots;
+  size_t m_mask;
+  char m_padding0[64];
+  // 生产者使用的缓存行
+  std::atomic<size_t> m_tail;
+  size_t m_cached_head;
+  char m_padding1[64 - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+  // 消费者使用的缓存行
+  std::atomic<size_t> m_head;
+  size_t m_cached_tail;
+  char m_padding2[64 - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+};
+
 } // namespace src
 
 #endif
\ No newline at end of file
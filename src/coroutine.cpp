@@ -127,13 +127,15 @@ void Coroutine::Resume() {
     m_stack = MemAllocator::alloc(m_stacksize);
     m_ctx.uc_stack.ss_sp = m_stack;
     m_ctx.uc_stack.ss_size = m_stacksize;
-    m_ctx.uc_link = &(ahri::CoExecutor::GetMasterCo()->m_ctx); // 执行完后自动切回当前线程的主协程中
+    // 不使用uc_link，协程可能在别的线程上执行完，结束时在StaticRun中切回当时的主协程
+    m_ctx.uc_link = nullptr;
     uintptr_t ptr = (uintptr_t) this;
     // 拿到地址的低32位和高32位
     // uint32_t会截断高32位
     makecontext(&m_ctx, (void (*)(void)) StaticRun, 2, (uint32_t) ptr, (uint32_t) (ptr >> 32));
-    m_master_co = CoExecutor::GetMasterCo();
   }
+  // 每次换入都使用当前线程的主协程，协程挂起后可以在其它线程上恢复
+  m_master_co = CoExecutor::GetMasterCo();
   // 换入
   SetStatus(RUNNING);
   // 主协程作为切换的中介
@@ -158,7 +160,7 @@ void Coroutine::Run() {
     SetStatus(EXCEPT);
     m_ex_ptr = std::current_exception();
   }
-  // 运行完成，换出此协程，并且换入主协程（上面设置了uc_link，所以完成后会自动切换）
+  // 运行完成，换出此协程，并且在StaticRun中换入主协程
   std::cout << "Coroutine-" << m_id << " (thread-" << GetThreadId() << ") ends running..." << std::endl;
 }
 
@@ -168,6 +170,8 @@ void Coroutine::StaticRun(uint32_t low32, uint32_t high32) {
   Coroutine &self = *(Coroutine * )(sptr);
   self.Run();
   self.m_func = std::function<void()>();  // 清理function对象
+  // 切回最近一次换入此协程的主协程，不会再返回
+  setcontext(&self.m_master_co->m_ctx);
 }
 
 } // namespace src
\ No newline at end of file
@@ -136,8 +136,8 @@ private:
   Status m_status = IDLE;
   // 如果发生异常后，保存异常对象指针
   std::exception_ptr m_ex_ptr = nullptr;
-  // 指向的主协程id
-  Coroutine *m_master_co;
+  // 最近一次换入此协程的线程的主协程
+  Coroutine *m_master_co = nullptr;
   // yield的次数
   uint64_t m_yield_cnt = 0;
   // 标记是否为主协程
@@ -1,7 +1,9 @@
+#include <algorithm>
 #include <map>
 #include <thread>
 
 #include "coscheduler.h"
+#include "topology.h"
 
 namespace ahri {
 
@@ -11,9 +13,17 @@ CoScheduler *CoScheduler::GetSched() {
   return sched;
 }
 
-CoScheduler::CoScheduler() {
+CoScheduler::CoScheduler() : m_default_group(std::make_shared<ExecutorGroup>()) {
+  m_default_group->name = DEFAULT_GROUP_NAME;
+  m_default_group->placement = std::make_shared<PowerOfTwoPlacement>();
   // 至少需要一个执行器
-  m_executors.emplace_back(new CoExecutor(0));
+  CoExecutor::Ptr main_exctr(new CoExecutor(0));
+  SetupExecutor(m_default_group, main_exctr);
+  // 主执行器空闲超时后退出，还有挂起的任务时继续运行
+  main_exctr->SetLingerWhileHolding(true);
+  m_default_group->executors.push_back(main_exctr);
+  m_default_group->ring.Add(main_exctr);
+  m_groups.push_back(m_default_group);
 }
 
 CoScheduler::~CoScheduler() {
@@ -39,33 +49,44 @@ void CoScheduler::Start(int n_min_thread, int n_max_thread) {
   if (n_max_thread == 0 || n_max_thread < n_min_thread) {
     n_max_thread = n_min_thread;
   }
-  m_min_thread_cnt = n_min_thread;
-  m_max_thread_cnt = n_max_thread;
-  m_executors.reserve(m_max_thread_cnt);
-  for (int i = 0; i < m_min_thread_cnt - 1; ++i) {
-    CreateNewExecutor();
-  }
-
-  if (m_max_thread_cnt > 1) {
-    // 启动调度线程
-    Thread dispatcher_t(std::bind(&CoScheduler::DispatcherThreadFunc, this),
-                        "sched-dispat");
-    m_dispatcher.Swap(dispatcher_t);
-  } else {
-    std::cout << "No dispatcher is needed\n";
-  }
-  std::cout << "CoScheduler start with m_min_thread_cnt = " << m_min_thread_cnt
-            << " m_max_thread_cnt = " << m_max_thread_cnt << std::endl;
-  // 每个调度器都有一个主执行器，也就是至少都需要有一个执行器
-  CoExecutor::Ptr main_exctr = m_executors.front();
-  std::cout << "Executor[0]=>" << m_executors[0]->Id() << " in thread-"
-            << GetThreadId() << std::endl;
-  for (size_t i = 1; i < m_executors.size(); ++i) {
-    std::cout << "Executor[" << i << "]=>" << m_executors[i]->Id()
-              << " in thread-" << m_executors[i]->m_process_tid << std::endl;
+  CoExecutor::Ptr main_exctr;
+  {
+    WrLockGuard lk(m_groups_mtx);
+    m_default_group->min_thread_cnt = n_min_thread;
+    m_default_group->max_thread_cnt = n_max_thread;
+    m_started = true;
+    if (m_bind_cpu) {
+      size_t n_cpus = m_allowed_cpus.empty() ? CpuTopology::Get().CpuCount() : m_allowed_cpus.size();
+      m_executor_cpus = CpuTopology::Get().PickCpus(n_cpus, m_allowed_cpus);
+    }
+    // 默认组先占用cpu，其它组按照创建顺序启动
+    bool need_dispatcher = false;
+    for (auto &group : m_groups) {
+      StartGroup(group);
+      need_dispatcher = need_dispatcher || group->max_thread_cnt > 1;
+    }
+    if (need_dispatcher) {
+      StartBackgroundThreads();
+    } else {
+      std::cout << "No dispatcher is needed\n";
+    }
+    std::cout << "CoScheduler start with m_min_thread_cnt = " << n_min_thread
+              << " m_max_thread_cnt = " << n_max_thread << std::endl;
+    // 每个调度器都有一个主执行器，也就是至少都需要有一个执行器
+    RdLockGuard group_lk(m_default_group->mtx);
+    main_exctr = m_default_group->executors.front();
+    std::cout << "Executor[0]=>" << main_exctr->Id() << " in thread-"
+              << GetThreadId() << std::endl;
+  }
+  // 主执行器在当前线程中运行，也需要绑核
+  int cpu = GetExecutorCpu(m_default_group, 0);
+  if (cpu >= 0) {
+    main_exctr->BindCpu(cpu);
   }
   // 阻塞当前线程调度
   main_exctr->Process(DEBUG_TIMEOUT_MS);
+  // 主执行器退出后从组中移除，不再接收新的任务
+  OnExecutorExit(m_default_group, main_exctr);
 }
 
 void CoScheduler::Begin(int n_min_thread, int n_max_thread) {
@@ -75,74 +96,642 @@ void CoScheduler::Begin(int n_min_thread, int n_max_thread) {
   t.Detach();
 }
 
+bool CoScheduler::CreateGroup(const std::string &name, int n_min_thread, int n_max_thread,
+                              const PlacementPolicy::Ptr &policy) {
+  if (m_stopping) {
+    std::cout << "CoScheduler is stopping, can not create group " << name << std::endl;
+    return false;
+  }
+  WrLockGuard lk(m_groups_mtx);
+  for (auto &group : m_groups) {
+    if (group->name == name) {
+      std::cout << "Executor group " << name << " already exists" << std::endl;
+      return false;
+    }
+  }
+  ExecutorGroup::Ptr group = std::make_shared<ExecutorGroup>();
+  group->name = name;
+  group->min_thread_cnt = std::max(n_min_thread, 1);
+  group->max_thread_cnt = std::max(n_max_thread, group->min_thread_cnt);
+  group->placement = policy ? policy : std::make_shared<PowerOfTwoPlacement>();
+  m_groups.push_back(group);
+  std::cout << "Executor group " << name << " created with min_thread_cnt = " << group->min_thread_cnt
+            << " max_thread_cnt = " << group->max_thread_cnt << std::endl;
+  if (m_started) {
+    StartGroup(group);
+    if (group->max_thread_cnt > 1) {
+      StartBackgroundThreads();
+    }
+  }
+  return true;
+}
+
+bool CoScheduler::HasGroup(const std::string &name) const {
+  return GetGroup(name) != nullptr;
+}
+
+CoScheduler::ExecutorGroup::Ptr CoScheduler::GetGroup(const std::string &name) const {
+  RdLockGuard lk(m_groups_mtx);
+  for (auto &group : m_groups) {
+    if (group->name == name) {
+      return group;
+    }
+  }
+  return nullptr;
+}
+
+std::vector<CoScheduler::ExecutorGroup::Ptr> CoScheduler::GetGroups() const {
+  RdLockGuard lk(m_groups_mtx);
+  return m_groups;
+}
+
+void CoScheduler::StartGroup(const ExecutorGroup::Ptr &group) {
+  group->cpu_offset = m_next_cpu_offset;
+  m_next_cpu_offset += group->max_thread_cnt;
+  // 默认组的主执行器在Start的线程中运行，其它执行器都需要新的线程
+  int n_threads = group->min_thread_cnt;
+  if (group == m_default_group) {
+    --n_threads;
+  }
+  for (int i = 0; i < n_threads; ++i) {
+    CoExecutor::Ptr executor = CreateNewExecutor(group);
+    if (executor) {
+      std::cout << "Executor[" << group->name << "]=>" << executor->Id() << std::endl;
+    }
+  }
+}
+
+void CoScheduler::StartBackgroundThreads() {
+  if (m_background_started) {
+    return;
+  }
+  m_background_started = true;
+  // 启动调度线程
+  Thread dispatcher_t(std::bind(&CoScheduler::DispatcherThreadFunc, this),
+                      "sched-dispat");
+  m_dispatcher.Swap(dispatcher_t);
+  // 启动监控线程
+  Thread sysmon_t(std::bind(&CoScheduler::SysmonThreadFunc, this), "sched-sysmon");
+  m_sysmon.Swap(sysmon_t);
+}
+
+void CoScheduler::SetCpuAffinity(bool enable, const std::vector<int> &allowed_cpus) {
+  m_bind_cpu = enable;
+  m_allowed_cpus = allowed_cpus;
+}
+
+int CoScheduler::GetExecutorCpu(const ExecutorGroup::Ptr &group, idx_t idx) const {
+  if (!m_bind_cpu || m_executor_cpus.empty()) {
+    return -1;
+  }
+  // 组内的执行器占用连续的cpu，cpu不够时循环使用
+  return m_executor_cpus[(group->cpu_offset + idx) % m_executor_cpus.size()];
+}
+
+void CoScheduler::SetPlacementPolicy(const PlacementPolicy::Ptr &policy, const std::string &name) {
+  ExecutorGroup::Ptr group = GetGroup(name);
+  if (policy && group) {
+    group->placement = policy;
+  }
+}
+
+PlacementPolicy::Ptr CoScheduler::GetPlacementPolicy(const std::string &name) const {
+  ExecutorGroup::Ptr group = GetGroup(name);
+  return group ? group->placement : nullptr;
+}
+
+void CoScheduler::SetQueueMode(CoExecutor::QueueMode mode, CoExecutor::LatePolicy late_policy,
+                               const std::string &name) {
+  ExecutorGroup::Ptr group = GetGroup(name);
+  if (!group) {
+    return;
+  }
+  WrLockGuard lk(group->mtx);
+  group->queue_mode = mode;
+  group->late_policy = late_policy;
+  for (auto &executor : group->executors) {
+    executor->SetQueueMode(mode, late_policy);
+  }
+}
+
+void CoScheduler::SetElasticPolicy(size_t backlog, uint64_t queue_delay_us, uint64_t keep_alive_ms) {
+  m_scale_up_backlog = backlog;
+  m_scale_up_delay_us = queue_delay_us;
+  m_keep_alive_ms = keep_alive_ms;
+}
+
+size_t CoScheduler::GetExecutorCount(const std::string &name) const {
+  ExecutorGroup::Ptr group = GetGroup(name);
+  if (!group) {
+    return 0;
+  }
+  RdLockGuard lk(group->mtx);
+  return group->executors.size();
+}
+
 void CoScheduler::Stop() {
   m_stopping = true;
-  for (size_t i = 0; i < m_executors.size(); ++i) {
-    m_executors[i]->m_is_stopping = true;  // 退出每一个执行器
+  for (auto &group : GetGroups()) {
+    WrLockGuard lk(group->mtx);
+    for (size_t i = 0; i < group->executors.size(); ++i) {
+      group->executors[i]->RequestStop();  // 退出每一个执行器
+    }
+    group->ring.Clear();
+    if (!group->executors.empty()) {
+      group->executors.clear();
+      std::vector<CoExecutor::Ptr>().swap(group->executors);
+    }
+  }
+}
+
+bool CoScheduler::SchedulerTask(std::function<void()> &&fn) {
+  TaskPtr tk = MakeIntrusive<Task>(fn);
+  return AdmitTask(m_default_group, tk);
+}
+
+bool CoScheduler::SchedulerTask(std::function<void()> &&fn, const CancellationToken &token,
+                                const CoExecutor::TimePoint &deadline) {
+  TaskPtr tk = MakeIntrusive<Task>(fn);
+  tk->token = token;
+  tk->deadline_us = TimePointToUs(deadline);
+  return AdmitTask(m_default_group, tk);
+}
+
+bool CoScheduler::SchedulerTask(std::function<void()> &&fn, const CoExecutor::TimePoint &deadline) {
+  TaskPtr tk = MakeIntrusive<Task>(fn);
+  tk->deadline_us = TimePointToUs(deadline);
+  return AdmitTask(m_default_group, tk);
+}
+
+bool CoScheduler::SchedulerTask(std::function<void()> &&fn, const std::chrono::microseconds &time_slice) {
+  TaskPtr tk = MakeIntrusive<Task>(fn);
+  tk->time_slice_us = time_slice.count();
+  return AdmitTask(m_default_group, tk);
+}
+
+bool CoScheduler::SchedulerTask(const std::string &name, std::function<void()> &&fn) {
+  ExecutorGroup::Ptr group = GetGroup(name);
+  if (!group) {
+    std::cout << "Executor group " << name << " not found, task dropped" << std::endl;
+    return false;
+  }
+  TaskPtr tk = MakeIntrusive<Task>(fn);
+  return AdmitTask(group, tk);
+}
+
+bool CoScheduler::SchedulerTask(uint64_t key, std::function<void()> &&fn) {
+  return SchedulerTask(DEFAULT_GROUP_NAME, key, std::move(fn));
+}
+
+bool CoScheduler::SchedulerTask(const std::string &name, uint64_t key, std::function<void()> &&fn) {
+  ExecutorGroup::Ptr group = GetGroup(name);
+  if (!group) {
+    std::cout << "Executor group " << name << " not found, task dropped" << std::endl;
+    return false;
+  }
+  TaskPtr tk = MakeIntrusive<Task>(fn);
+  tk->pinned = true;
+  tk->affinity_key = key;
+  return AdmitTask(group, tk);
+}
+
+std::string CoScheduler::SwitchCurrentToGroup(const std::string &name) {
+  CoExecutor *cur = CoExecutor::GetCurrentExecutor();
+  if (!cur || !CoExecutor::GetCurrentTask()) {
+    return std::string();
+  }
+  std::string prev = cur->GetGroupName();
+  if (prev == name) {
+    return prev;
+  }
+  ExecutorGroup::Ptr group = GetGroup(name);
+  if (!group) {
+    std::cout << "Executor group " << name << " not found, can not switch" << std::endl;
+    return std::string();
+  }
+  // 换出之后再放入目标组，避免任务在换出之前就被其它执行器换入
+  CoExecutor::HandOffCurrent([this, group](const TaskPtr &tk) { this->AddTask(group, tk); });
+  return prev;
+}
+
+bool CoScheduler::SuspendCurrent(const std::function<void(const std::function<void()> &)> &fn) {
+  CoExecutor *cur = CoExecutor::GetCurrentExecutor();
+  TaskPtr cur_task = CoExecutor::GetCurrentTask();
+  if (!cur || !cur_task || cur_task->thread_affine) {
+    return false;
   }
-  if (!m_executors.empty()) {
-    m_executors.clear();
-    std::vector<CoExecutor::Ptr>().swap(m_executors);
+  ExecutorGroup::Ptr group = GetGroup(cur->GetGroupName());
+  if (!group) {
+    return false;  // 执行器不由调度器管理
   }
+  // 换出之后才交出恢复函数，避免任务在换出之前就被其它执行器换入
+  CoExecutor::HandOffCurrent([this, group, fn](const TaskPtr &tk) {
+    fn([this, group, tk]() { this->AddTask(group, tk); });
+  });
+  return true;
 }
 
-void CoScheduler::SchedulerTask(std::function<void()> &&fn) {
-  TaskPtr tk = std::make_shared<Task>(fn);
-  AddTask(tk);
+CoExecutor *CoScheduler::PickExecutor(const ExecutorGroup::Ptr &group, const TaskPtr &tk) {
+  // 由放置策略找到一个合适的CoExecutor
+  const std::vector<CoExecutor::Ptr> &executors = group->executors;
+  if (executors.empty()) {
+    return nullptr;
+  } else if (tk->pinned && !group->ring.Empty()) {
+    return group->ring.Lookup(tk->affinity_key).get();
+  } else if (executors.size() == 1) {
+    return executors[0].get();
+  }
+  auto id = group->placement->Pick(executors);
+  std::cout << "CoScheduler assign new task to executor-" << id << std::endl;
+  return executors[id].get();
 }
 
-void CoScheduler::AddTask(const TaskPtr &tk) {
-  // 找到一个合适的CoExecutor将任务加进去
-  // TODO 现在先随机找一个放进去，改成找一个相对负载低的放进去
-  if (m_executors.size() == 1) {
-    m_executors[0]->AddTask(tk);
-  } else {
-    auto id = rand() % m_executors.size();
-    //     m_executors[0]->AddTask(tk);
-    m_executors[id]->AddTask(tk);
-    std::cout << "CoScheduler assign new task to executor-" << id << std::endl;
+void CoScheduler::AddTask(const ExecutorGroup::Ptr &group, const TaskPtr &tk) {
+  RdLockGuard lk(group->mtx);
+  CoExecutor *executor = PickExecutor(group, tk);
+  if (!executor) {
+    std::cout << "Executor group " << group->name << " has no executor, task dropped" << std::endl;
+    return;
   }
+  executor->PushTask(tk);
 }
 
-void CoScheduler::CreateNewExecutor() {
-  if ((int)m_executors.size() < m_max_thread_cnt) {
-    CoExecutor::Ptr co_executor(new CoExecutor(m_executors.size()));
-    size_t e_id = m_executors.size();
+bool CoScheduler::AdmitTask(const ExecutorGroup::Ptr &group, const TaskPtr &tk) {
+  while (!m_stopping) {
+    // 先检查整个调度器的上限
+    if (m_max_pending != 0 && GetPendingCount() >= m_max_pending) {
+      if (m_overflow_policy == CoExecutor::OVERFLOW_BLOCK) {
+        if (CoExecutor::HoldFor(std::chrono::microseconds(ADMISSION_RETRY_US)) == CoExecutor::AWOKEN) {
+          continue;
+        }
+        // 生产者协程已经被取消或者超时，不能再等待
+        m_rejected_cnt.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      if (m_overflow_policy == CoExecutor::OVERFLOW_REJECT || !ShedOldest()) {
+        m_rejected_cnt.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+    }
+    // 再检查执行器的上限，需要等待时不能持有组的读锁，否则会阻塞执行器的增减
+    CoExecutor::AdmitResult result;
+    {
+      RdLockGuard lk(group->mtx);
+      CoExecutor *executor = PickExecutor(group, tk);
+      if (!executor) {
+        std::cout << "Executor group " << group->name << " has no executor, task dropped" << std::endl;
+        return false;
+      }
+      result = executor->TryAddTask(tk);
+    }
+    if (result == CoExecutor::ADMITTED) {
+      m_admitted_cnt.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    } else if (result == CoExecutor::REJECTED) {
+      return false;
+    }
+    // 执行器队列已满，挂起生产者协程或者睡眠当前线程后重新选择执行器；生产者协程已经被取消或者超时时拒绝
+    if (CoExecutor::HoldFor(std::chrono::microseconds(ADMISSION_RETRY_US)) != CoExecutor::AWOKEN) {
+      m_rejected_cnt.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+  }
+  return false;
+}
+
+void CoScheduler::SetupExecutor(const ExecutorGroup::Ptr &group, const CoExecutor::Ptr &executor) {
+  executor->m_group = group->name;
+  executor->SetQueueMode(group->queue_mode, group->late_policy);
+  executor->SetQueueLimit(group->queue_limit, group->overflow_policy);
+  executor->SetMaxQueueTime(group->max_queue_time_us);
+  // 组持有执行器，回调中只保存组的弱引用
+  std::weak_ptr<ExecutorGroup> weak_group = group;
+  CoExecutor *origin = executor.get();
+  executor->SetWakeupHook([this, weak_group, origin](const TaskPtr &tk, CoExecutor::HoldResult reason) {
+    ExecutorGroup::Ptr group = weak_group.lock();
+    return group && this->MigrateAwokenTask(group, origin, tk, reason);
+  });
+}
+
+bool CoScheduler::MigrateAwokenTask(const ExecutorGroup::Ptr &group, CoExecutor *origin, const TaskPtr &tk,
+                                    CoExecutor::HoldResult reason) {
+  size_t origin_load = origin->GetQueueDepth();
+  if (!m_migrate_on_wakeup || m_stopping || origin_load < MIGRATE_IMBALANCE) {
+    return false;
+  }
+  // 持有读锁时放入目标执行器，目标执行器退出时会取走这个任务
+  RdLockGuard lk(group->mtx);
+  if (group->executors.size() < 2) {
+    return false;
+  }
+  CoExecutor *target = group->executors[m_wakeup_placement.Pick(group->executors)].get();
+  if (target == origin || target->IsStopped() || target->IsMarkedBlocked() ||
+      target->GetQueueDepth() + MIGRATE_IMBALANCE > origin_load) {
+    return false;
+  }
+  target->PushAwokenTask(tk, reason);
+  std::cout << "Awoken task migrated from executor-" << origin->Id() << " to executor-"
+            << target->Id() << std::endl;
+  return true;
+}
+
+bool CoScheduler::ShedOldest() {
+  std::vector<CoExecutor::Ptr> executors;
+  for (auto &group : GetGroups()) {
+    RdLockGuard lk(group->mtx);
+    executors.insert(executors.end(), group->executors.begin(), group->executors.end());
+  }
+  std::sort(executors.begin(), executors.end(),
+            [](const CoExecutor::Ptr &a, const CoExecutor::Ptr &b) {
+              return a->GetQueueDepth() > b->GetQueueDepth();
+            });
+  for (auto &executor : executors) {
+    if (executor->ShedOldest()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t CoScheduler::GetPendingCount() const {
+  size_t pending = 0;
+  for (auto &group : GetGroups()) {
+    RdLockGuard lk(group->mtx);
+    for (auto &executor : group->executors) {
+      pending += executor->GetQueueDepth();
+    }
+  }
+  return pending;
+}
+
+void CoScheduler::SetAdmissionPolicy(size_t max_pending, CoExecutor::OverflowPolicy policy) {
+  m_max_pending = max_pending;
+  m_overflow_policy = policy;
+}
+
+void CoScheduler::SetExecutorQueueLimit(size_t max_queued, CoExecutor::OverflowPolicy policy,
+                                        const std::string &name) {
+  ExecutorGroup::Ptr group = GetGroup(name);
+  if (!group) {
+    return;
+  }
+  WrLockGuard lk(group->mtx);
+  group->queue_limit = max_queued;
+  group->overflow_policy = policy;
+  for (auto &executor : group->executors) {
+    executor->SetQueueLimit(max_queued, policy);
+  }
+}
+
+void CoScheduler::SetMaxQueueTime(uint64_t us, const std::string &name) {
+  ExecutorGroup::Ptr group = GetGroup(name);
+  if (!group) {
+    return;
+  }
+  WrLockGuard lk(group->mtx);
+  group->max_queue_time_us = us;
+  for (auto &executor : group->executors) {
+    executor->SetMaxQueueTime(us);
+  }
+}
+
+CoScheduler::AdmissionStats CoScheduler::GetAdmissionStats() const {
+  AdmissionStats stats;
+  stats.admitted = m_admitted_cnt.load(std::memory_order_relaxed);
+  stats.rejected = m_rejected_cnt.load(std::memory_order_relaxed);
+  stats.shed = 0;
+  for (auto &group : GetGroups()) {
+    RdLockGuard lk(group->mtx);
+    for (auto &executor : group->executors) {
+      stats.rejected += executor->GetRejectedCount();
+      stats.shed += executor->GetShedCount();
+    }
+  }
+  return stats;
+}
+
+CoExecutor::Ptr CoScheduler::CreateNewExecutor(const ExecutorGroup::Ptr &group, bool elastic) {
+  WrLockGuard lk(group->mtx);
+  if ((int)group->executors.size() < group->max_thread_cnt) {
+    int32_t e_id = m_next_executor_id++;
+    CoExecutor::Ptr co_executor(new CoExecutor(e_id));
+    SetupExecutor(group, co_executor);
+    co_executor->m_elastic = elastic;
+    int cpu = GetExecutorCpu(group, group->executors.size());
+    // 扩容出来的执行器空闲keep-alive时间后退出，其它执行器一直运行到Stop
+    uint64_t timeout = elastic ? m_keep_alive_ms : 0;
     // 放在线程中执行executor
     Thread t(
         [=]() {
-          std::cout << "CoExecutor-" << e_id << " is now running in thread-"
+          std::cout << "CoExecutor-" << e_id << " (" << group->name << ") is now running in thread-"
                     << GetThreadId() << std::endl;
-          co_executor->Process(DEBUG_TIMEOUT_MS);
+          if (cpu >= 0) {
+            co_executor->BindCpu(cpu);
+          }
+          co_executor->Process(timeout);
+          this->OnExecutorExit(group, co_executor);
         },
         "executor-" + std::to_string(e_id));
     // 分离
     t.Detach();
-    m_executors.push_back(co_executor);
+    group->executors.push_back(co_executor);
+    if (!elastic) {
+      group->ring.Add(co_executor);
+    }
+    return co_executor;
   }
+  return nullptr;
+}
+
+void CoScheduler::OnExecutorExit(const ExecutorGroup::Ptr &group, const CoExecutor::Ptr &executor) {
+  {
+    WrLockGuard lk(group->mtx);
+    auto it = std::find(group->executors.begin(), group->executors.end(), executor);
+    if (it != group->executors.end()) {
+      group->executors.erase(it);
+    }
+    group->ring.Remove(executor);
+  }
+  {
+    // 任务的proc是裸指针，唤醒任务的线程可能在转交之前读到了这个执行器
+    std::lock_guard<std::mutex> lk(m_retired_mtx);
+    m_retired.push_back(executor);
+  }
+  if (m_stopping) {
+    return;
+  }
+  ThreadSafeDeque<TaskPtr> runnables;
+  std::vector<CoExecutor *> refused;
+  for (;;) {
+    CoExecutor::Ptr heir;
+    {
+      RdLockGuard lk(group->mtx);
+      // 挂起的任务交给组内负载最小的执行器，扩容出来的执行器会超时退出，不能接管挂起的任务
+      for (auto &candidate : group->executors) {
+        if (candidate->m_elastic || candidate->IsStopped() ||
+            std::find(refused.begin(), refused.end(), candidate.get()) != refused.end()) {
+          continue;
+        }
+        if (!heir || candidate->GetQueueDepth() + candidate->GetWaitingCount() <
+                         heir->GetQueueDepth() + heir->GetWaitingCount()) {
+          heir = candidate;
+        }
+      }
+    }
+    if (!heir && executor->GetWaitingCount() > 0) {
+      // 没有可以接管的执行器，增加一个一直运行到Stop的执行器
+      heir = CreateNewExecutor(group);
+    }
+    if (!heir) {
+      executor->HandOverTasks(runnables, nullptr);
+      if (executor->GetWaitingCount() > 0) {
+        std::cout << "CoExecutor-" << executor->Id() << " retired with " << executor->GetWaitingCount()
+                  << " held task(s) and no executor to take them over" << std::endl;
+      }
+      break;
+    }
+    if (executor->HandOverTasks(runnables, heir.get())) {
+      break;
+    }
+    // heir在选出之后停止了，换一个执行器
+    refused.push_back(heir.get());
+  }
+  for (auto &tk : runnables) {
+    AddTask(group, tk);
+  }
+  std::cout << "CoExecutor-" << executor->Id() << " retired, " << runnables.Size()
+            << " runnable task(s) rescheduled" << std::endl;
 }
 
 void CoScheduler::DispatcherThreadFunc() {
+  uint64_t last_dispatch_ms = GetCurrentMs();
+  while (!m_stopping) {
+    usleep(SCHED_TICK_MS * 1000);
+    std::vector<ExecutorGroup::Ptr> groups = GetGroups();
+    for (auto &group : groups) {
+      AdjustExecutors(group);
+    }
+    if (GetCurrentMs() - last_dispatch_ms >= DISPATCH_INTERVAL_MS) {
+      last_dispatch_ms = GetCurrentMs();
+      std::cout << "CoScheduler::DispatcherThreadFunc\n";
+      // 阻塞的执行器由监控线程处理，任务只在组内均衡
+      for (auto &group : groups) {
+        DispatchTasksEqually(group);
+      }
+    }
+  }
+}
+
+void CoScheduler::SysmonThreadFunc() {
   while (!m_stopping) {
-    usleep(100 * 10000);
-    std::cout << "CoScheduler::DispatcherThreadFunc\n";
-    // TODO 针对一些阻塞的执行器进行处理
-    DispatchTasksEqually();
+    usleep(SYSMON_INTERVAL_US);
+    for (auto &group : GetGroups()) {
+      RetakeBlockedExecutors(group);
+    }
   }
 }
 
-void CoScheduler::DispatchTasksEqually() {
+void CoScheduler::RetakeBlockedExecutors(const ExecutorGroup::Ptr &group) {
+  std::vector<CoExecutor::Ptr> blocked;
+  std::vector<CoExecutor::Ptr> healthy;
+  {
+    RdLockGuard lk(group->mtx);
+    for (auto &executor : group->executors) {
+      if (executor->IsBlockingFor(m_blocking_threshold_us)) {
+        executor->m_blocked = true;
+        // 除了正在执行的协程还有排队的任务
+        if (executor->GetQueueDepth() > 1) {
+          blocked.push_back(executor);
+        }
+      } else {
+        healthy.push_back(executor);
+      }
+    }
+  }
+  if (blocked.empty()) {
+    return;
+  }
+  // 绑定在执行器上的任务不会被取走，只剩下这类任务时什么都不做
+  std::vector<ThreadSafeDeque<TaskPtr>> retaken(blocked.size());
+  size_t n_retaken = 0;
+  for (size_t i = 0; i < blocked.size(); ++i) {
+    blocked[i]->TakeQueuedTasks(retaken[i]);
+    n_retaken += retaken[i].Size();
+  }
+  if (n_retaken == 0) {
+    return;
+  }
+  if (healthy.empty()) {
+    // 组内所有执行器都阻塞了，临时增加一个执行器，空闲后自动退出
+    CoExecutor::Ptr executor = CreateNewExecutor(group, true);
+    if (!executor) {
+      // 不能再增加执行器，任务放回原来的执行器
+      for (size_t i = 0; i < blocked.size(); ++i) {
+        blocked[i]->AddTask(retaken[i]);
+      }
+      return;
+    }
+    std::cout << "All executors are blocked, spawn executor-" << executor->Id() << std::endl;
+    healthy.push_back(executor);
+  }
+  for (auto &tasks : retaken) {
+    for (auto &tk : tasks) {
+      healthy[group->placement->Pick(healthy)]->PushTask(tk);
+    }
+  }
+  std::cout << "CoScheduler retook " << n_retaken << " task(s) from "
+            << blocked.size() << " blocked executor(s) in group " << group->name << std::endl;
+}
+
+void CoScheduler::AdjustExecutors(const ExecutorGroup::Ptr &group) {
+  size_t n_executors = 0;
+  size_t total_depth = 0;
+  uint64_t max_delay = 0;
+  {
+    RdLockGuard lk(group->mtx);
+    n_executors = group->executors.size();
+    for (auto &executor : group->executors) {
+      size_t depth = executor->GetQueueDepth();
+      total_depth += depth;
+      // 没有积压的执行器的排队时间已经过时了
+      if (depth > 0) {
+        max_delay = std::max(max_delay, executor->GetQueueDelayUs());
+      }
+    }
+  }
+  if (n_executors == 0 || (int)n_executors >= group->max_thread_cnt) {
+    group->overload_ticks = 0;
+    return;
+  }
+  bool overloaded = total_depth / n_executors >= m_scale_up_backlog || max_delay >= m_scale_up_delay_us;
+  group->overload_ticks = overloaded ? group->overload_ticks + 1 : 0;
+  if (group->overload_ticks >= SCALE_UP_SUSTAIN_TICKS) {
+    group->overload_ticks = 0;
+    std::cout << "Executor group " << group->name << " is overloaded (backlog=" << total_depth
+              << ", delay=" << max_delay << "us), spawn a new executor" << std::endl;
+    CreateNewExecutor(group, true);
+    // 新的执行器马上分担积压的任务
+    DispatchTasksEqually(group);
+  }
+}
+
+void CoScheduler::DispatchTasksEqually(const ExecutorGroup::Ptr &group) {
   // 计算负载，并且将负载高的执行器的任务分配一些给负载低的执行器
-  size_t executor_count = m_executors.size();
+  RdLockGuard lk(group->mtx);
+  const std::vector<CoExecutor::Ptr> &executors = group->executors;
+  size_t executor_count = executors.size();
+  if (executor_count == 0) {
+    return;
+  }
   size_t total_runnables = 0;
   size_t total_waitings = 0;
   std::vector<size_t> runnables_counts(executor_count, 0);
   std::vector<size_t> waitings_counts(executor_count, 0);
   for (size_t i = 0; i < executor_count; ++i) {
-    runnables_counts[i] = m_executors[i]->GetRunnableCount();
-    waitings_counts[i] = m_executors[i]->GetWaitingCount();
-    total_runnables += m_executors[i]->GetRunnableCount();
-    total_waitings += m_executors[i]->GetWaitingCount();
+    runnables_counts[i] = executors[i]->GetRunnableCount();
+    waitings_counts[i] = executors[i]->GetWaitingCount();
+    total_runnables += executors[i]->GetRunnableCount();
+    total_waitings += executors[i]->GetWaitingCount();
   }
   size_t total_loads = total_runnables + total_waitings;
   if (total_loads == 0) {
@@ -151,62 +740,85 @@ void CoScheduler::DispatchTasksEqually() {
   }
   // 计算所有执行器的平均负载
   size_t avg_load = total_loads / executor_count;
-  // 搜集高负载的执行器中取出超过平均负载的部分
-  ThreadSafeDeque<TaskPtr> stolen;
+  // 搜集高负载的执行器中取出超过平均负载的部分，按照来源执行器的L3缓存分组
+  std::map<int, ThreadSafeDeque<TaskPtr>> stolen;
   std::map<idx_t, size_t> low_load_executors;  // 低负载的执行器索引和负载大小
   idx_t min_load_idx = 0;  // 记录负载最小的executor所在索引
-  size_t min_load = m_executors[0]->GetRunnableCount();
+  size_t min_load = executors[0]->GetRunnableCount();
+  size_t stolen_count = 0;
   for (size_t idx = 0; idx < executor_count; ++idx) {
-    size_t load = m_executors[idx]->GetRunnableCount();
-    std::cout << "Executor-" << m_executors[idx]->Id() << " Load = " << load
+    size_t load = executors[idx]->GetRunnableCount();
+    std::cout << "Executor-" << executors[idx]->Id() << " Load = " << load
               << std::endl;
     if (min_load > load) {
       min_load = load;
       min_load_idx = idx;
     }
     if (load > avg_load) {
-      if (m_executors[idx]->IsBlocking()) {
-        m_executors[idx]->GiveUpTasks(stolen, 0);
+      ThreadSafeDeque<TaskPtr> &out = stolen[executors[idx]->GetL3Id()];
+      size_t before = out.Size();
+      if (executors[idx]->IsBlocking()) {
+        executors[idx]->GiveUpTasks(out, 0);
       } else {
-        m_executors[idx]->GiveUpTasks(stolen, load - avg_load);
+        executors[idx]->GiveUpTasks(out, load - avg_load);
       }
+      stolen_count += out.Size() - before;
     } else {
       low_load_executors[idx] = load;
     }
   }
-  if (stolen.Empty()) {
+  if (stolen_count == 0) {
     std::cout << "No extra tasks collected!!\n";
     return;
   }
-  std::cout << "Collected " << stolen.Size() << " tasks from " << executor_count
+  std::cout << "Collected " << stolen_count << " tasks from " << executor_count
             << " executors\n";
   // 平均分发所有任务给所有低负载的执行器，先提前满足前面的
-  auto first = stolen.begin();
-  auto last = first;
-  for (auto &item : low_load_executors) {
-    idx_t idx = item.first;
-    size_t load = item.second;
-    size_t n_supply = avg_load - load;  // 需要填补的数量
-    if (n_supply == 0) {
-      continue;
-    }
-    last = first + n_supply;
-    last = std::min(last, stolen.end());  // 防止越界
-    m_executors[idx]->AddTask(first, last);
-    std::cout << "CoExecutor-" << m_executors[idx]->Id() << " assigned "
-              << (last - first) << " tasks from sched\n";
-    first = last;
-    if (first >= stolen.end()) {
-      // 提前分配完了
-      break;
+  // 第一轮只分配来自同一个L3缓存的任务，第二轮再跨L3分配
+  for (int pass = 0; pass < 2; ++pass) {
+    for (auto &item : low_load_executors) {
+      idx_t idx = item.first;
+      size_t &load = item.second;
+      for (auto &src : stolen) {
+        if (load >= avg_load) {
+          break;
+        }
+        if (pass == 0 && src.first != executors[idx]->GetL3Id()) {
+          continue;
+        }
+        ThreadSafeDeque<TaskPtr> supply;
+        src.second.PopFrontAndAppend(avg_load - load, supply);  // 需要填补的数量
+        size_t supplied = supply.Size();
+        if (supplied == 0) {
+          continue;
+        }
+        executors[idx]->AddTask(supply);
+        std::cout << "CoExecutor-" << executors[idx]->Id() << " assigned "
+                  << supplied << " tasks from sched\n";
+        load += supplied;
+      }
     }
   }
-  if (first < stolen.end()) {  // 检查是否有剩余
-                               // 给到一开始负载最小的executor
-    m_executors[min_load_idx]->AddTask(first, stolen.end());
-    std::cout << "Executor-" << m_executors[min_load_idx]->Id()
-              << " got assigned the rest\n";
+  for (auto &src : stolen) {
+    if (!src.second.Empty()) {  // 检查是否有剩余
+                                // 给到一开始负载最小的executor
+      executors[min_load_idx]->AddTask(src.second);
+      std::cout << "Executor-" << executors[min_load_idx]->Id()
+                << " got assigned the rest\n";
+    }
   }
 }
 
+namespace this_coroutine {
+
+std::string SwitchToGroup(const std::string &group) {
+  return co_sched->SwitchCurrentToGroup(group);
+}
+
+bool Suspend(const std::function<void(const std::function<void()> &)> &fn) {
+  return co_sched->SuspendCurrent(fn);
+}
+
+} // namespace this_coroutine
+
 }  // namespace src
\ No newline at end of file
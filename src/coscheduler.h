@@ -6,9 +6,30 @@
 #include <functional>
 
 #include "coexecutor.h"
+#include "placement.h"
 #include "thread.h"
 
 #define DEBUG_TIMEOUT_MS 1000 * 2
+// 调度线程检查负载的间隔
+#define SCHED_TICK_MS 100
+// 调度线程平均分配任务的间隔
+#define DISPATCH_INTERVAL_MS 1000
+// 平均每个执行器积压的任务数量超过该值时扩容
+#define DEFAULT_SCALE_UP_BACKLOG 16
+// 执行器的平均排队时间超过该值时扩容
+#define DEFAULT_SCALE_UP_DELAY_US 20 * 1000
+// 连续多少次检查都超过阈值才扩容
+#define SCALE_UP_SUSTAIN_TICKS 3
+// 扩容出来的执行器空闲多久后退出
+#define DEFAULT_KEEP_ALIVE_MS 5000
+// 监控线程检查执行器是否阻塞的间隔
+#define SYSMON_INTERVAL_US 1000
+// 协程连续执行超过该时间视作阻塞了执行器
+#define DEFAULT_BLOCKING_THRESHOLD_US 5 * 1000
+// 唤醒的任务迁移到其它执行器需要的最小负载差
+#define MIGRATE_IMBALANCE 2
+// 默认执行器组的名字，主执行器属于该组
+#define DEFAULT_GROUP_NAME "default"
 
 namespace ahri {
 
@@ -21,6 +42,53 @@ public:
   typedef size_t idx_t;
   typedef std::shared_ptr<CoScheduler> Ptr;
 
+  /**
+   * @brief 准入控制的统计
+   *
+   */
+  struct AdmissionStats {
+    // 加入队列的任务数量
+    uint64_t admitted;
+    // 被拒绝的任务数量，包括执行器拒绝的任务
+    uint64_t rejected;
+    // 执行器因为队列已满或者排队超时丢弃的任务数量
+    uint64_t shed;
+  };
+
+  /**
+   * @brief 执行器组，每个组有自己的线程数和放置策略，
+   * 扩缩容、阻塞检测和任务均衡都只在组内进行
+   *
+   */
+  struct ExecutorGroup {
+    typedef std::shared_ptr<ExecutorGroup> Ptr;
+    // 组名
+    std::string name;
+    // 组内的执行器
+    std::vector<CoExecutor::Ptr> executors;
+    // 保护executors，添加任务时加读锁，增减执行器时加写锁
+    mutable RWMutex mtx;
+    // 新任务的放置策略
+    PlacementPolicy::Ptr placement;
+    // 常驻执行器组成的一致性哈希环，用来放置绑定key的任务；扩容出来的执行器不加入，扩缩容不会改变key的归属
+    ConsistentHashRing ring;
+    // 最小和最大线程数
+    int min_thread_cnt = 1;
+    int max_thread_cnt = 1;
+    // 组内执行器选择下一个任务的方式
+    CoExecutor::QueueMode queue_mode = CoExecutor::FIFO_QUEUE;
+    CoExecutor::LatePolicy late_policy = CoExecutor::LATE_DEPRIORITIZE;
+    // 组内每个执行器的队列上限，为0表示不限制
+    size_t queue_limit = 0;
+    CoExecutor::OverflowPolicy overflow_policy = CoExecutor::OVERFLOW_REJECT;
+    // 组内任务的最大排队时间(单位us)，为0表示不限制
+    uint64_t max_queue_time_us = 0;
+    // 组内执行器绑核时使用的第一个cpu位置
+    size_t cpu_offset = 0;
+    // 连续超过扩容阈值的检查次数
+    int overload_ticks = 0;
+  };
+
   static CoScheduler *GetSched();
 
   /**
@@ -28,6 +96,7 @@ public:
    * 
    * @param n_min_thread 最少使用多少个线程
    * @param n_max_thread 最多使用多少个线程，如果<=n_min_thread在，则使用n_min_thread
+   *                     负载持续较高时会增加执行器直到n_max_thread个，增加的执行器空闲一段时间后退出
    */
   void Start(int n_min_thread, int n_max_thread = 0);
 
@@ -39,6 +108,129 @@ public:
    */
   void Begin(int n_min_thread, int n_max_thread = 0);
 
+  /**
+   * @brief 创建一个命名的执行器组，组内的执行器都运行在单独的线程中
+   * 在Start之前创建的组随Start一起启动，之后创建的组马上启动
+   *
+   * @param name 组名，不能和已有的组重复
+   * @param n_min_thread 最少使用多少个线程，至少为1
+   * @param n_max_thread 最多使用多少个线程，<=n_min_thread时使用n_min_thread
+   * @param policy 组内新任务的放置策略，为空时使用PowerOfTwoPlacement
+   * @return true 创建成功
+   * @return false 组已经存在或者调度器正在停止
+   */
+  bool CreateGroup(const std::string &name, int n_min_thread, int n_max_thread = 0,
+                   const PlacementPolicy::Ptr &policy = nullptr);
+
+  /**
+   * @brief 执行器组是否存在
+   *
+   */
+  bool HasGroup(const std::string &name) const;
+
+  /**
+   * @brief 设置执行器是否绑核，需要在Start之前调用
+   * 各个组按照创建顺序依次占用CpuTopology::PickCpus挑选的cpu，先避开SMT兄弟
+   * 
+   * @param enable 是否绑核
+   * @param allowed_cpus 只在这些cpu上绑核，为空表示所有在线cpu；
+   *                     可以传入CpuTopology::Get().IsolatedCpus()使用isolcpus隔离出来的cpu
+   */
+  void SetCpuAffinity(bool enable, const std::vector<int> &allowed_cpus = std::vector<int>());
+
+  /**
+   * @brief 设置新任务的放置策略，默认为PowerOfTwoPlacement，需要在Start之前调用
+   * 
+   * @param policy 放置策略，为空时不修改
+   * @param group 执行器组
+   */
+  void SetPlacementPolicy(const PlacementPolicy::Ptr &policy,
+                          const std::string &group = DEFAULT_GROUP_NAME);
+
+  PlacementPolicy::Ptr GetPlacementPolicy(const std::string &group = DEFAULT_GROUP_NAME) const;
+
+  /**
+   * @brief 设置执行器组中执行器选择下一个任务的方式，需要在Start之前调用
+   * 
+   * @param mode 队列模式，EDF_QUEUE时截止时间最早的任务先执行
+   * @param late_policy EDF模式下错过截止时间的任务的处理方式
+   * @param group 执行器组
+   */
+  void SetQueueMode(CoExecutor::QueueMode mode,
+                    CoExecutor::LatePolicy late_policy = CoExecutor::LATE_DEPRIORITIZE,
+                    const std::string &group = DEFAULT_GROUP_NAME);
+
+  /**
+   * @brief 设置挂起的任务被唤醒时是否可以迁移到组内负载更低的执行器，默认开启
+   * 原执行器的负载比目标执行器高出MIGRATE_IMBALANCE以上时才迁移；
+   * 绑定key的任务和调用了this_coroutine::SetThreadAffine的任务不会迁移
+   * 
+   * @param enable 是否开启
+   */
+  void SetMigrateOnWakeup(bool enable) { m_migrate_on_wakeup = enable; }
+
+  /**
+   * @brief 设置弹性扩缩容的参数，需要在Start之前调用
+   * 
+   * @param backlog 平均每个执行器积压的任务数量持续超过该值时扩容
+   * @param queue_delay_us 执行器的平均排队时间持续超过该值时扩容，单位us
+   * @param keep_alive_ms 扩容出来的执行器空闲超过该时间后退出，挂起的任务转交给其它执行器
+   */
+  void SetElasticPolicy(size_t backlog, uint64_t queue_delay_us, uint64_t keep_alive_ms);
+
+  /**
+   * @brief 设置整个调度器的准入上限，所有执行器中等待执行和正在执行的任务总数达到上限后按照policy处理新任务
+   * 只对SchedulerTask生效，任务在执行器之间转移不受限制
+   * 
+   * @param max_pending 上限，为0表示不限制
+   * @param policy 达到上限时的处理方式，OVERFLOW_DROP_OLDEST时从负载最高的执行器中丢弃
+   */
+  void SetAdmissionPolicy(size_t max_pending, CoExecutor::OverflowPolicy policy = CoExecutor::OVERFLOW_REJECT);
+
+  /**
+   * @brief 设置执行器组中每个执行器的队列上限，需要在Start之前调用
+   * 
+   * @param max_queued 每个执行器的上限，为0表示不限制
+   * @param policy 达到上限时的处理方式
+   * @param group 执行器组
+   */
+  void SetExecutorQueueLimit(size_t max_queued, CoExecutor::OverflowPolicy policy = CoExecutor::OVERFLOW_REJECT,
+                             const std::string &group = DEFAULT_GROUP_NAME);
+
+  /**
+   * @brief 设置执行器组中任务的最大排队时间，排队超过该时间并且还没有开始执行的任务被丢弃，需要在Start之前调用
+   * 
+   * @param us 最大排队时间，单位us，为0表示不限制
+   * @param group 执行器组
+   */
+  void SetMaxQueueTime(uint64_t us, const std::string &group = DEFAULT_GROUP_NAME);
+
+  /**
+   * @brief 获取准入控制的统计
+   * 
+   */
+  AdmissionStats GetAdmissionStats() const;
+
+  /**
+   * @brief 获取所有执行器中等待执行和正在执行的任务总数
+   * 
+   */
+  size_t GetPendingCount() const;
+
+  /**
+   * @brief 设置执行器被判定为阻塞的阈值，需要在Start之前调用
+   * 监控线程发现执行器上的协程连续执行超过该时间后，会将该执行器中排队的任务转移到其它执行器
+   * 
+   * @param us 阈值，单位us
+   */
+  void SetBlockingThreshold(uint64_t us) { m_blocking_threshold_us = us; }
+
+  /**
+   * @brief 获取执行器组中当前执行器的数量，组不存在时返回0
+   * 
+   */
+  size_t GetExecutorCount(const std::string &group = DEFAULT_GROUP_NAME) const;
+
   /**
    * @brief 停止工作
    * 
@@ -46,7 +238,85 @@ public:
   void Stop();
 
 
-  void SchedulerTask(std::function<void()> &&fn);
+  /**
+   * @brief 添加任务到默认组，以下所有SchedulerTask都受准入控制的限制
+   *
+   * @param fn 任务函数
+   * @return true 任务已经加入队列
+   * @return false 任务被拒绝，或者执行器组不存在、调度器正在停止
+   */
+  bool SchedulerTask(std::function<void()> &&fn);
+
+  /**
+   * @brief 添加一个可以被取消的任务
+   *
+   * @param fn 任务函数
+   * @param token 取消令牌，令牌被取消后任务在挂起点提前返回CoExecutor::CANCELLED
+   * @param deadline 截止时间，过了截止时间后任务在挂起点提前返回CoExecutor::TIMEDOUT
+   */
+  bool SchedulerTask(std::function<void()> &&fn, const CancellationToken &token,
+                     const CoExecutor::TimePoint &deadline = CoExecutor::TimePoint::max());
+
+  /**
+   * @brief 添加一个有截止时间的任务，EDF模式下截止时间最早的任务先执行
+   *
+   * @param fn 任务函数
+   * @param deadline 截止时间，过了截止时间后任务在挂起点提前返回CoExecutor::TIMEDOUT
+   */
+  bool SchedulerTask(std::function<void()> &&fn, const CoExecutor::TimePoint &deadline);
+
+  /**
+   * @brief 添加一个指定时间片的任务
+   *
+   * @param fn 任务函数
+   * @param time_slice 任务每次换入后可以连续执行的时间，配合this_coroutine::MaybeYield使用
+   */
+  bool SchedulerTask(std::function<void()> &&fn, const std::chrono::microseconds &time_slice);
+
+  /**
+   * @brief 添加任务到指定的执行器组，组不存在时丢弃任务
+   *
+   * @param group 执行器组
+   * @param fn 任务函数
+   */
+  bool SchedulerTask(const std::string &group, std::function<void()> &&fn);
+
+  /**
+   * @brief 添加绑定key的任务，相同key的任务总是由同一个执行器执行，访问key对应的状态不需要加锁
+   * 这类任务不会被均衡任务或者监控线程转移到其它执行器
+   *
+   * @param key 任务的key，字符串可以先用std::hash转换
+   * @param fn 任务函数
+   */
+  bool SchedulerTask(uint64_t key, std::function<void()> &&fn);
+
+  /**
+   * @brief 添加绑定key的任务到指定的执行器组，组不存在时丢弃任务
+   *
+   * @param group 执行器组
+   * @param key 任务的key
+   * @param fn 任务函数
+   */
+  bool SchedulerTask(const std::string &group, uint64_t key, std::function<void()> &&fn);
+
+  /**
+   * @brief 将当前协程切换到指定的执行器组中继续执行
+   * 
+   * @param group 目标执行器组
+   * @return std::string 切换前所在的组，可以用来切换回去；
+   *                     不在协程中或者目标组不存在时不切换，返回空字符串
+   */
+  std::string SwitchCurrentToGroup(const std::string &group);
+
+  /**
+   * @brief 换出当前协程，换出之后调用fn并传入恢复函数，调用恢复函数后协程重新放回原来的组中执行
+   * 恢复函数可以在任意线程中调用，只能调用一次
+   *
+   * @param fn 换出之后在执行器线程中调用，通常把恢复函数交给其它线程
+   * @return true 协程已经被换出并且恢复
+   * @return false 不在协程中或者协程和线程相关，没有换出
+   */
+  bool SuspendCurrent(const std::function<void(const std::function<void()> &)> &fn);
 
 public:
   ~CoScheduler();
@@ -65,10 +335,66 @@ private:
 
 private:
   /**
-   * @brief 创建新的CoExecutor
+   * @brief 在执行器组中创建新的CoExecutor
+   * 
+   * @param group 执行器组
+   * @param elastic 是否为扩容出来的执行器，空闲超过keep-alive时间后退出
+   * @return CoExecutor::Ptr 新的执行器，已经达到最大数量时返回空
+   */
+  CoExecutor::Ptr CreateNewExecutor(const ExecutorGroup::Ptr &group, bool elastic = false);
+
+  /**
+   * @brief 启动执行器组中的执行器，需要持有m_groups_mtx的写锁
+   * 
+   * @param group 执行器组
+   */
+  void StartGroup(const ExecutorGroup::Ptr &group);
+
+  /**
+   * @brief 启动调度线程和监控线程，需要持有m_groups_mtx的写锁
+   * 
+   */
+  void StartBackgroundThreads();
+
+  /**
+   * @brief 查找执行器组
+   * 
+   * @return ExecutorGroup::Ptr 不存在时返回空
+   */
+  ExecutorGroup::Ptr GetGroup(const std::string &name) const;
+
+  /**
+   * @brief 获取所有执行器组的快照
    * 
    */
-  void CreateNewExecutor();
+  std::vector<ExecutorGroup::Ptr> GetGroups() const;
+
+  /**
+   * @brief 监控线程的执行函数
+   * 
+   */
+  void SysmonThreadFunc();
+
+  /**
+   * @brief 将阻塞的执行器中排队的任务转移到正常的执行器中，
+   * 没有正常的执行器时创建一个临时的执行器
+   * 
+   */
+  void RetakeBlockedExecutors(const ExecutorGroup::Ptr &group);
+
+  /**
+   * @brief 根据负载增加执行器
+   * 
+   */
+  void AdjustExecutors(const ExecutorGroup::Ptr &group);
+
+  /**
+   * @brief 执行器退出后从组中移除，并且将它的任务转交给组内其它执行器，执行器对象保留到调度器析构
+   * 
+   * @param group 执行器所在的组
+   * @param executor 退出的执行器
+   */
+  void OnExecutorExit(const ExecutorGroup::Ptr &group, const CoExecutor::Ptr &executor);
 
   /**
    * @brief 调度线程的执行函数
@@ -77,36 +403,176 @@ private:
   void DispatcherThreadFunc();
 
   /**
-   * @brief 平等分配任务
+   * @brief 在执行器组内平等分配任务
+   * 
+   */
+  void DispatchTasksEqually(const ExecutorGroup::Ptr &group);
+
+  /**
+   * @brief 将任务加入组内一个合适的CoExecutor中，绑定key的任务加入key所属的执行器；不受准入控制的限制
    * 
+   * @param group 执行器组
+   * @param tk 任务指针
    */
-  void DispatchTasksEqually();
+  void AddTask(const ExecutorGroup::Ptr &group, const TaskPtr& tk);
 
   /**
-   * @brief 将任务加入一个合适的CoExecutor中
+   * @brief 经过准入控制后将新任务加入组内一个合适的CoExecutor中
    * 
+   * @param group 执行器组
    * @param tk 任务指针
+   * @return true 任务已经加入队列
+   * @return false 任务被拒绝
+   */
+  bool AdmitTask(const ExecutorGroup::Ptr &group, const TaskPtr& tk);
+
+  /**
+   * @brief 为组内的新任务选择执行器，需要持有组的读锁
+   * 
+   * @return CoExecutor* 组内没有执行器时返回空
+   */
+  CoExecutor *PickExecutor(const ExecutorGroup::Ptr &group, const TaskPtr& tk);
+
+  /**
+   * @brief 初始化组内执行器的属性，包括队列模式、队列上限和唤醒迁移回调
+   * 
+   * @param group 执行器所在的组
+   * @param executor 新的执行器
+   */
+  void SetupExecutor(const ExecutorGroup::Ptr &group, const CoExecutor::Ptr &executor);
+
+  /**
+   * @brief 把被唤醒的任务迁移到组内负载更低的执行器
+   * 
+   * @param group 执行器组
+   * @param origin 任务原来所在的执行器
+   * @param tk 被唤醒的任务
+   * @param reason 唤醒的原因
+   * @return true 已经迁移
+   * @return false 不需要迁移，任务在原执行器中恢复
+   */
+  bool MigrateAwokenTask(const ExecutorGroup::Ptr &group, CoExecutor *origin, const TaskPtr &tk,
+                         CoExecutor::HoldResult reason);
+
+  /**
+   * @brief 从负载最高的执行器中丢弃一个还没有开始执行的任务
+   * 
+   * @return true 丢弃了一个任务
+   */
+  bool ShedOldest();
+
+  /**
+   * @brief 获取组内第idx个执行器需要绑定的cpu
+   * 
+   * @param group 执行器组
+   * @param idx 执行器在组内的索引
+   * @return int cpu编号，不需要绑核时返回-1
    */
-  void AddTask(const TaskPtr& tk);
+  int GetExecutorCpu(const ExecutorGroup::Ptr &group, idx_t idx) const;
 
 private:
   // 锁
   std::mutex m_mtx;
   // 标志启动的锁
   std::mutex m_started_mtx;
-  // 保存调度器拥有的执行器指针
-  std::vector<CoExecutor::Ptr> m_executors;
+  // 默认执行器组，包含主执行器
+  ExecutorGroup::Ptr m_default_group;
+  // 所有执行器组，按照创建顺序排列
+  std::vector<ExecutorGroup::Ptr> m_groups;
+  // 保护m_groups和组的启动状态
+  mutable RWMutex m_groups_mtx;
+  // 是否已经调用Start
+  bool m_started = false;
+  // 调度线程和监控线程是否已经启动
+  bool m_background_started = false;
+  // 下一个启动的组绑核时使用的第一个cpu位置
+  size_t m_next_cpu_offset = 0;
+  // 下一个执行器的id
+  std::atomic<int32_t> m_next_executor_id{1};
+  // 已经退出的执行器。其它线程唤醒任务时可能已经读到了任务原来的执行器，还没有看到转交后的执行器，
+  // 退出的执行器不释放，保证这些线程访问的执行器仍然有效
+  std::vector<CoExecutor::Ptr> m_retired;
+  // 保护m_retired
+  std::mutex m_retired_mtx;
   // 调度线程
   Thread m_dispatcher;
-  // 最小和最大线程数
-  int m_min_thread_cnt = 1;
-  int m_max_thread_cnt = 1;
+  // 监控阻塞执行器的线程
+  Thread m_sysmon;
   // 是否停止标记
   bool m_stopping = false;
+  // 执行器是否绑核
+  bool m_bind_cpu = false;
+  // 允许绑定的cpu
+  std::vector<int> m_allowed_cpus;
+  // 按照绑核顺序排列的cpu，执行器组依次占用
+  std::vector<int> m_executor_cpus;
+  // 扩容阈值：平均积压任务数
+  size_t m_scale_up_backlog = DEFAULT_SCALE_UP_BACKLOG;
+  // 扩容阈值：平均排队时间(单位us)
+  uint64_t m_scale_up_delay_us = DEFAULT_SCALE_UP_DELAY_US;
+  // 扩容出来的执行器的空闲退出时间
+  uint64_t m_keep_alive_ms = DEFAULT_KEEP_ALIVE_MS;
+  // 整个调度器的准入上限，为0表示不限制
+  size_t m_max_pending = 0;
+  // 达到准入上限时的处理方式
+  CoExecutor::OverflowPolicy m_overflow_policy = CoExecutor::OVERFLOW_REJECT;
+  // 加入队列的任务数量
+  std::atomic<uint64_t> m_admitted_cnt{0};
+  // 调度器拒绝的任务数量
+  std::atomic<uint64_t> m_rejected_cnt{0};
+  // 唤醒的任务是否可以迁移到其它执行器
+  bool m_migrate_on_wakeup = true;
+  // 为唤醒的任务选择目标执行器，只考虑负载
+  PowerOfTwoPlacement m_wakeup_placement;
+  // 执行器被判定为阻塞的阈值(单位us)
+  uint64_t m_blocking_threshold_us = DEFAULT_BLOCKING_THRESHOLD_US;
 };
 
 // 简便使用的宏定义
 #define g_coscheduler CoScheduler::GetSched()
 #define co_sched g_coscheduler
 
+namespace this_coroutine {
+
+/**
+ * @brief 将当前协程切换到指定的执行器组中继续执行，详见CoScheduler::SwitchCurrentToGroup
+ * 
+ * @param group 目标执行器组
+ * @return std::string 切换前所在的组
+ */
+std::string SwitchToGroup(const std::string &group);
+
+/**
+ * @brief 换出当前协程，由fn决定什么时候恢复，详见CoScheduler::SuspendCurrent
+ *
+ * @param fn 换出之后调用，参数是恢复函数
+ * @return true 协程已经被换出并且恢复
+ */
+bool Suspend(const std::function<void(const std::function<void()> &)> &fn);
+
+} // namespace this_coroutine
+
+/**
+ * @brief 在作用域内切换到指定的执行器组，离开作用域时切换回原来的组
+ * 
+ */
+class GroupSwitchGuard {
+public:
+  explicit GroupSwitchGuard(const std::string &group)
+      : m_prev(this_coroutine::SwitchToGroup(group)) {}
+
+  ~GroupSwitchGuard() {
+    if (!m_prev.empty()) {
+      this_coroutine::SwitchToGroup(m_prev);
+    }
+  }
+
+  GroupSwitchGuard(const GroupSwitchGuard &) = delete;
+
+  GroupSwitchGuard &operator=(const GroupSwitchGuard &) = delete;
+
+private:
+  std::string m_prev;
+};
+
 } // namespace src
@@ -0,0 +1,326 @@
+#ifndef __AHRI_INTRUSIVE_HPP__
+#define __AHRI_INTRUSIVE_HPP__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// 句柄表每一块的槽位数量，槽位按块分配，已经分配的槽位不会移动
+#define HANDLE_TABLE_CHUNK_SLOTS 4096
+// 句柄表最多的块数
+#define HANDLE_TABLE_MAX_CHUNKS 4096
+
+namespace ahri {
+
+/**
+ * @brief 侵入式引用计数的基类，计数和对象在同一块内存中，不需要额外的控制块
+ *
+ * @tparam T 派生类，计数归零时按照派生类型删除，不需要虚析构
+ */
+template <typename T>
+class RefCounted {
+public:
+  RefCounted() : m_refs(0) {}
+
+  RefCounted(const RefCounted &) = delete;
+
+  RefCounted &operator=(const RefCounted &) = delete;
+
+  void Retain() const { m_refs.fetch_add(1, std::memory_order_relaxed); }
+
+  /**
+   * @brief 计数不为0时才加1，用于从不持有引用的地方（比如句柄表）恢复出引用
+   *
+   * @return true
+   * @return false 对象已经在析构
+   */
+  bool TryRetain() const {
+    uint32_t refs = m_refs.load(std::memory_order_relaxed);
+    while (refs != 0) {
+      if (m_refs.compare_exchange_weak(refs, refs + 1, std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void Release() const {
+    if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      delete static_cast<const T *>(this);
+    }
+  }
+
+  uint32_t RefCount() const { return m_refs.load(std::memory_order_relaxed); }
+
+protected:
+  ~RefCounted() {}
+
+private:
+  mutable std::atomic<uint32_t> m_refs;
+};
+
+/**
+ * @brief 指向RefCounted对象的智能指针，复制时只修改对象内的一个计数
+ *
+ * @tparam T 继承自RefCounted<T>的类型
+ */
+template <typename T>
+class IntrusivePtr {
+public:
+  IntrusivePtr() : m_ptr(nullptr) {}
+
+  IntrusivePtr(std::nullptr_t) : m_ptr(nullptr) {}
+
+  /**
+   * @brief 接管一个对象，增加它的引用计数
+   *
+   */
+  explicit IntrusivePtr(T *ptr) : m_ptr(ptr) {
+    if (m_ptr) {
+      m_ptr->Retain();
+    }
+  }
+
+  IntrusivePtr(const IntrusivePtr &other) : m_ptr(other.m_ptr) {
+    if (m_ptr) {
+      m_ptr->Retain();
+    }
+  }
+
+  IntrusivePtr(IntrusivePtr &&other) noexcept : m_ptr(other.m_ptr) { other.m_ptr = nullptr; }
+
+  ~IntrusivePtr() {
+    if (m_ptr) {
+      m_ptr->Release();
+    }
+  }
+
+  IntrusivePtr &operator=(const IntrusivePtr &other) {
+    IntrusivePtr(other).swap(*this);
+    return *this;
+  }
+
+  IntrusivePtr &operator=(IntrusivePtr &&other) noexcept {
+    IntrusivePtr(std::move(other)).swap(*this);
+    return *this;
+  }
+
+  IntrusivePtr &operator=(std::nullptr_t) {
+    reset();
+    return *this;
+  }
+
+  /**
+   * @brief 接管已经加过引用计数的对象，不再增加计数
+   *
+   */
+  static IntrusivePtr Adopt(T *ptr) {
+    IntrusivePtr p;
+    p.m_ptr = ptr;
+    return p;
+  }
+
+  void reset() { IntrusivePtr().swap(*this); }
+
+  void swap(IntrusivePtr &other) noexcept { std::swap(m_ptr, other.m_ptr); }
+
+  T *get() const { return m_ptr; }
+
+  T &operator*() const { return *m_ptr; }
+
+  T *operator->() const { return m_ptr; }
+
+  explicit operator bool() const { return m_ptr != nullptr; }
+
+  uint32_t use_count() const { return m_ptr ? m_ptr->RefCount() : 0; }
+
+  friend bool operator==(const IntrusivePtr &a, const IntrusivePtr &b) { return a.m_ptr == b.m_ptr; }
+
+  friend bool operator!=(const IntrusivePtr &a, const IntrusivePtr &b) { return a.m_ptr != b.m_ptr; }
+
+  friend bool operator==(const IntrusivePtr &a, std::nullptr_t) { return a.m_ptr == nullptr; }
+
+  friend bool operator!=(const IntrusivePtr &a, std::nullptr_t) { return a.m_ptr != nullptr; }
+
+  friend bool operator==(std::nullptr_t, const IntrusivePtr &a) { return a.m_ptr == nullptr; }
+
+  friend bool operator!=(std::nullptr_t, const IntrusivePtr &a) { return a.m_ptr != nullptr; }
+
+  friend bool operator<(const IntrusivePtr &a, const IntrusivePtr &b) { return std::less<T *>()(a.m_ptr, b.m_ptr); }
+
+private:
+  T *m_ptr;
+};
+
+/**
+ * @brief 创建对象并返回指向它的IntrusivePtr，相当于std::make_shared
+ *
+ */
+template <typename T, typename... Args>
+IntrusivePtr<T> MakeIntrusive(Args &&...args) {
+  return IntrusivePtr<T>(new T(std::forward<Args>(args)...));
+}
+
+/**
+ * @brief 由槽位编号和代数组成的64位句柄到对象的映射，代替weak_ptr
+ * 句柄的低32位是槽位编号加1，高32位是注册时槽位的代数；对象注销时代数加1，
+ * 之后旧的句柄不会再匹配，即使槽位已经分配给了新的对象。判断句柄是否有效只需要读一次代数，
+ * 从句柄恢复引用时持有槽位的自旋锁，对象的析构在注销时也要获取这个锁，因此不会恢复出正在析构的对象
+ *
+ * @tparam T 继承自RefCounted<T>的类型
+ */
+template <typename T>
+class HandleTable {
+private:
+  struct Slot {
+    std::atomic<uint32_t> gen{0};
+    std::atomic<bool> busy{false};
+    T *obj = nullptr;
+
+    void Lock() {
+      while (busy.exchange(true, std::memory_order_acquire)) {
+      }
+    }
+
+    void Unlock() { busy.store(false, std::memory_order_release); }
+  };
+
+public:
+  HandleTable() {
+    for (size_t i = 0; i < HANDLE_TABLE_MAX_CHUNKS; ++i) {
+      m_chunks[i].store(nullptr, std::memory_order_relaxed);
+    }
+  }
+
+  ~HandleTable() {
+    for (size_t i = 0; i < HANDLE_TABLE_MAX_CHUNKS; ++i) {
+      delete[] m_chunks[i].load(std::memory_order_relaxed);
+    }
+  }
+
+  HandleTable(const HandleTable &) = delete;
+
+  HandleTable &operator=(const HandleTable &) = delete;
+
+  /**
+   * @brief 为对象分配一个句柄，对象析构前需要调用Unregister
+   *
+   * @return uint64_t 句柄，不会为0
+   */
+  uint64_t Register(T *obj) {
+    uint32_t index;
+    {
+      std::lock_guard<std::mutex> lk(m_mtx);
+      if (!m_free.empty()) {
+        index = m_free.back();
+        m_free.pop_back();
+      } else {
+        index = m_next++;
+        size_t chunk = index / HANDLE_TABLE_CHUNK_SLOTS;
+        if (chunk >= HANDLE_TABLE_MAX_CHUNKS) {
+          throw std::length_error("too many live handles");
+        }
+        if (index % HANDLE_TABLE_CHUNK_SLOTS == 0) {
+          m_chunks[chunk].store(new Slot[HANDLE_TABLE_CHUNK_SLOTS], std::memory_order_release);
+        }
+      }
+    }
+    Slot &slot = SlotAt(index);
+    slot.Lock();
+    slot.obj = obj;
+    uint32_t gen = slot.gen.load(std::memory_order_relaxed);
+    slot.Unlock();
+    return ((uint64_t) gen << 32) | (index + 1);
+  }
+
+  /**
+   * @brief 注销句柄，之后这个句柄和它的副本都失效
+   *
+   */
+  void Unregister(uint64_t handle) {
+    uint32_t index = (uint32_t) handle - 1;
+    Slot &slot = SlotAt(index);
+    slot.Lock();
+    slot.obj = nullptr;
+    slot.gen.fetch_add(1, std::memory_order_release);
+    slot.Unlock();
+    std::lock_guard<std::mutex> lk(m_mtx);
+    m_free.push_back(index);
+  }
+
+  /**
+   * @brief 让句柄和它的副本失效，对象仍然使用原来的槽位
+   *
+   * @return uint64_t 新的句柄
+   */
+  uint64_t Renew(uint64_t handle) {
+    uint32_t index = (uint32_t) handle - 1;
+    Slot &slot = SlotAt(index);
+    slot.Lock();
+    uint32_t gen = slot.gen.fetch_add(1, std::memory_order_release) + 1;
+    slot.Unlock();
+    return ((uint64_t) gen << 32) | (index + 1);
+  }
+
+  /**
+   * @brief 句柄对应的对象是否还没有注销，不加锁
+   *
+   */
+  bool Alive(uint64_t handle) const {
+    const Slot *slot = Find(handle);
+    return slot && slot->gen.load(std::memory_order_acquire) == (uint32_t) (handle >> 32);
+  }
+
+  /**
+   * @brief 从句柄恢复出对象的引用
+   *
+   * @return IntrusivePtr<T> 句柄已经失效或者对象正在析构时为空
+   */
+  IntrusivePtr<T> Resolve(uint64_t handle) {
+    Slot *slot = Find(handle);
+    if (!slot || slot->gen.load(std::memory_order_acquire) != (uint32_t) (handle >> 32)) {
+      return IntrusivePtr<T>();
+    }
+    IntrusivePtr<T> ptr;
+    slot->Lock();
+    if (slot->gen.load(std::memory_order_relaxed) == (uint32_t) (handle >> 32) && slot->obj &&
+        slot->obj->TryRetain()) {
+      ptr = IntrusivePtr<T>::Adopt(slot->obj);
+    }
+    slot->Unlock();
+    return ptr;
+  }
+
+private:
+  Slot &SlotAt(uint32_t index) {
+    return m_chunks[index / HANDLE_TABLE_CHUNK_SLOTS].load(std::memory_order_acquire)[index % HANDLE_TABLE_CHUNK_SLOTS];
+  }
+
+  Slot *Find(uint64_t handle) const {
+    if ((uint32_t) handle == 0) {
+      return nullptr;
+    }
+    uint32_t index = (uint32_t) handle - 1;
+    if (index / HANDLE_TABLE_CHUNK_SLOTS >= HANDLE_TABLE_MAX_CHUNKS) {
+      return nullptr;
+    }
+    Slot *chunk = m_chunks[index / HANDLE_TABLE_CHUNK_SLOTS].load(std::memory_order_acquire);
+    return chunk ? &chunk[index % HANDLE_TABLE_CHUNK_SLOTS] : nullptr;
+  }
+
+private:
+  std::atomic<Slot *> m_chunks[HANDLE_TABLE_MAX_CHUNKS];
+  // 保护空闲槽位列表和m_next
+  std::mutex m_mtx;
+  std::vector<uint32_t> m_free;
+  uint32_t m_next = 0;
+};
+
+} // namespace src
+
+#endif
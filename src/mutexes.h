@@ -70,6 +70,26 @@ public:
     pthread_rwlock_wrlock(&m_mutex);
   }
 
+  /**
+   * @brief 尝试上读锁，不等待
+   * 
+   * @return true 上锁成功
+   * @return false 有写者持有锁
+   */
+  bool TryRdLock() {
+    return pthread_rwlock_tryrdlock(&m_mutex) == 0;
+  }
+
+  /**
+   * @brief 尝试上写锁，不等待
+   * 
+   * @return true 上锁成功
+   * @return false 有其它读者或者写者持有锁
+   */
+  bool TryWrLock() {
+    return pthread_rwlock_trywrlock(&m_mutex) == 0;
+  }
+
   /**
    * @brief 解锁
    * 
@@ -0,0 +1,142 @@
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace ahri {
+
+void WaitGroup::Add(size_t n) {
+  std::lock_guard<std::mutex> lk(m_mtx);
+  m_pending += n;
+}
+
+void WaitGroup::Done() {
+  std::function<void()> resume;
+  {
+    std::lock_guard<std::mutex> lk(m_mtx);
+    AHRI_ASSERT(m_pending > 0);
+    if (--m_pending != 0) {
+      return;
+    }
+    resume.swap(m_resume);
+    m_cv.notify_all();
+  }
+  if (resume) {
+    resume();
+  }
+}
+
+void WaitGroup::SetException(std::exception_ptr ex) {
+  std::lock_guard<std::mutex> lk(m_mtx);
+  if (!m_exception) {
+    m_exception = ex;
+  }
+}
+
+void WaitGroup::Wait() {
+  bool done;
+  {
+    std::lock_guard<std::mutex> lk(m_mtx);
+    done = m_pending == 0;
+  }
+  // 在协程中换出等待，换出之后再检查一次，最后一个任务可能在换出之前就完成了
+  if (!done && !this_coroutine::Suspend([this](const std::function<void()> &resume) {
+        std::unique_lock<std::mutex> lk(m_mtx);
+        if (m_pending == 0) {
+          lk.unlock();
+          resume();
+        } else {
+          m_resume = resume;
+        }
+      })) {
+    // 不在调度器的协程中，阻塞当前线程
+    std::unique_lock<std::mutex> lk(m_mtx);
+    m_cv.wait(lk, [this]() { return m_pending == 0; });
+  }
+  std::exception_ptr ex;
+  {
+    std::lock_guard<std::mutex> lk(m_mtx);
+    ex = m_exception;
+  }
+  if (ex) {
+    std::rethrow_exception(ex);
+  }
+}
+
+typedef std::function<void(size_t, size_t)> RangeFunc;
+
+/**
+ * @brief 一次ParallelFor的共享状态，所有参与者通过next领取下一块
+ *
+ */
+struct ParallelRange {
+  ParallelRange(size_t b, size_t e, size_t g, const RangeFunc &f)
+      : begin(b), end(e), grain(g), n_chunks((e - b + g - 1) / g), fn(f), wg(n_chunks) {}
+
+  size_t begin;
+  size_t end;
+  size_t grain;
+  size_t n_chunks;
+  // 下一个还没有被领取的块
+  std::atomic<size_t> next{0};
+  RangeFunc fn;
+  // 每块完成时减1
+  WaitGroup wg;
+};
+
+static void RunChunks(ParallelRange &range) {
+  // 不断领取下一块直到全部领完，执行得快的参与者自然领到更多的块
+  for (;;) {
+    size_t idx = range.next.fetch_add(1, std::memory_order_relaxed);
+    if (idx >= range.n_chunks) {
+      return;
+    }
+    size_t b = range.begin + idx * range.grain;
+    size_t e = std::min(range.end, b + range.grain);
+    try {
+      range.fn(b, e);
+    } catch (...) {
+      range.wg.SetException(std::current_exception());
+    }
+    range.wg.Done();
+  }
+}
+
+void ParallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)> &fn,
+                 const std::string &group) {
+  if (begin >= end) {
+    return;
+  }
+  size_t n_executors = co_sched->GetExecutorCount(group);
+  if (grain == 0) {
+    size_t chunks = std::max<size_t>(n_executors, 1) * PARALLEL_CHUNKS_PER_EXECUTOR;
+    grain = std::max<size_t>((end - begin) / chunks, 1);
+  }
+  // 辅助任务可能在调用者返回之后才执行，状态由所有参与者共同持有
+  std::shared_ptr<ParallelRange> range = std::make_shared<ParallelRange>(begin, end, grain, fn);
+  // 组内每个执行器一个辅助任务，空闲的执行器马上开始领取，块已经领完时辅助任务直接返回
+  size_t n_helpers = std::min(n_executors, range->n_chunks - 1);
+  for (size_t i = 0; i < n_helpers; ++i) {
+    if (!co_sched->SchedulerTask(group, std::function<void()>([range]() { RunChunks(*range); }))) {
+      break;  // 组不存在或者被准入控制拒绝，剩下的块由调用者执行
+    }
+  }
+  // 调用者也领取块，等待时只剩下其它执行器上正在执行的块，
+  // 即使调用者不能换出、阻塞了所在的执行器，排在这个执行器上的辅助任务也不会被等待
+  RunChunks(*range);
+  range->wg.Wait();
+}
+
+void ParallelInvoke(const std::vector<std::function<void()>> &fns, const std::string &group) {
+  ParallelFor(0, fns.size(), 1, [&fns](size_t b, size_t e) {
+    for (size_t i = b; i < e; ++i) {
+      fns[i]();
+    }
+  }, group);
+}
+
+void ParallelInvoke(std::initializer_list<std::function<void()>> fns, const std::string &group) {
+  ParallelInvoke(std::vector<std::function<void()>>(fns), group);
+}
+
+} // namespace src
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "coscheduler.h"
+
+// 自动计算粒度时平均每个执行器分到的块数
+#define PARALLEL_CHUNKS_PER_EXECUTOR 4
+
+namespace ahri {
+
+/**
+ * @brief 等待一组任务完成的计数器
+ * 在协程中等待时换出协程，不占用执行器；在普通线程中等待时阻塞线程
+ *
+ */
+class WaitGroup {
+public:
+  typedef std::shared_ptr<WaitGroup> Ptr;
+
+  explicit WaitGroup(size_t count = 0) : m_pending(count) {}
+
+  WaitGroup(const WaitGroup &) = delete;
+
+  WaitGroup &operator=(const WaitGroup &) = delete;
+
+  /**
+   * @brief 增加需要等待的任务数量
+   *
+   */
+  void Add(size_t n = 1);
+
+  /**
+   * @brief 一个任务完成，最后一个任务完成时恢复等待者
+   *
+   */
+  void Done();
+
+  /**
+   * @brief 记录任务中出现的异常，只保留第一个，Wait返回前重新抛出
+   *
+   */
+  void SetException(std::exception_ptr ex);
+
+  /**
+   * @brief 等待所有任务完成
+   *
+   */
+  void Wait();
+
+private:
+  std::mutex m_mtx;
+  std::condition_variable m_cv;
+  // 还没有完成的任务数量
+  size_t m_pending;
+  // 在协程中等待时的恢复函数
+  std::function<void()> m_resume;
+  // 第一个异常
+  std::exception_ptr m_exception;
+};
+
+/**
+ * @brief 把[begin, end)按照grain分成若干块，组内每个执行器放入一个辅助任务，
+ * 辅助任务和调用者从共享的计数器中不断领取下一块执行，空闲的执行器领取得更多，直到所有块都被领走。
+ * 调用者先执行领到的块，之后在协程中时换出等待，在普通线程或者线程相关的协程中阻塞等待其它执行器上正在执行的块，
+ * 任务中的异常在返回前重新抛出
+ *
+ * @param begin 起始下标
+ * @param end 结束下标(不包括)
+ * @param grain 每块的最大长度，为0时按照执行器数量自动计算
+ * @param fn 处理[b, e)的函数，会在多个线程中同时调用
+ * @param group 执行任务的执行器组
+ */
+void ParallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)> &fn,
+                 const std::string &group = DEFAULT_GROUP_NAME);
+
+/**
+ * @brief 并行执行所有函数，全部完成后返回
+ *
+ * @param fns 需要执行的函数
+ * @param group 执行任务的执行器组
+ */
+void ParallelInvoke(const std::vector<std::function<void()>> &fns, const std::string &group = DEFAULT_GROUP_NAME);
+
+void ParallelInvoke(std::initializer_list<std::function<void()>> fns, const std::string &group = DEFAULT_GROUP_NAME);
+
+/**
+ * @brief 并行归约，按照ParallelFor拆分[begin, end)，每块的结果按照下标顺序用combine合并，
+ * 因此combine只需要满足结合律
+ *
+ * @tparam T 结果类型
+ * @param begin 起始下标
+ * @param end 结束下标(不包括)
+ * @param grain 每块的最大长度，为0时自动计算
+ * @param identity combine的单位元，区间为空时返回
+ * @param map 计算[b, e)的结果
+ * @param combine 合并两个结果
+ * @param group 执行任务的执行器组
+ * @return T 归约的结果
+ */
+template <typename T>
+T ParallelReduce(size_t begin, size_t end, size_t grain, const T &identity,
+                 const std::function<T(size_t, size_t)> &map, const std::function<T(const T &, const T &)> &combine,
+                 const std::string &group = DEFAULT_GROUP_NAME) {
+  std::mutex mtx;
+  // 以块的起始下标为key，合并时保持原来的顺序
+  std::map<size_t, T> partials;
+  ParallelFor(begin, end, grain, [&mtx, &partials, &map](size_t b, size_t e) {
+    T partial = map(b, e);
+    std::lock_guard<std::mutex> lk(mtx);
+    partials.insert(std::make_pair(b, std::move(partial)));
+  }, group);
+  T result = identity;
+  for (auto &item : partials) {
+    result = combine(result, item.second);
+  }
+  return result;
+}
+
+} // namespace src
@@ -0,0 +1,112 @@
+#include <limits>
+
+#include "placement.h"
+#include "utils.h"
+
+namespace ahri {
+
+// 被标记为阻塞的执行器短时间内不能执行新任务，视作负载最高
+static inline size_t EffectiveLoad(const CoExecutor::Ptr &executor) {
+  return executor->IsMarkedBlocked() ? std::numeric_limits<size_t>::max() : executor->GetQueueDepth();
+}
+
+size_t RandomPlacement::Pick(const std::vector<CoExecutor::Ptr> &executors) {
+  return FastRand() % executors.size();
+}
+
+size_t RoundRobinPlacement::Pick(const std::vector<CoExecutor::Ptr> &executors) {
+  return m_next.fetch_add(1, std::memory_order_relaxed) % executors.size();
+}
+
+size_t PowerOfTwoPlacement::Pick(const std::vector<CoExecutor::Ptr> &executors) {
+  size_t n = executors.size();
+  if (n == 1) {
+    return 0;
+  }
+  size_t first = FastRand() % n;
+  size_t second = FastRand() % (n - 1);
+  if (second >= first) {
+    ++second;  // 保证两个候选不相同
+  }
+  size_t global = EffectiveLoad(executors[first]) <= EffectiveLoad(executors[second]) ? first : second;
+  // 当前在执行器中并且绑了核，优先在同一个L3缓存下的执行器中选
+  CoExecutor *cur = CoExecutor::GetCurrentExecutor();
+  if (!cur || cur->GetL3Id() < 0) {
+    return global;
+  }
+  size_t nearby[2];
+  size_t found = 0;
+  size_t start = FastRand() % n;
+  for (size_t i = 0; i < n && found < 2; ++i) {
+    size_t idx = (start + i) % n;
+    if (executors[idx]->GetL3Id() == cur->GetL3Id()) {
+      nearby[found++] = idx;
+    }
+  }
+  if (found == 0) {
+    return global;
+  }
+  size_t local = nearby[0];
+  if (found == 2 && EffectiveLoad(executors[nearby[1]]) < EffectiveLoad(executors[local])) {
+    local = nearby[1];
+  }
+  // 本地的执行器被标记为阻塞或者明显比随机选出的执行器忙时，放到L3缓存以外
+  size_t local_load = EffectiveLoad(executors[local]);
+  size_t global_load = EffectiveLoad(executors[global]);
+  if (local_load != std::numeric_limits<size_t>::max() &&
+      (global_load == std::numeric_limits<size_t>::max() || local_load <= global_load + PLACEMENT_SPILL_MARGIN)) {
+    return local;
+  }
+  return global;
+}
+
+size_t CallerLocalPlacement::Pick(const std::vector<CoExecutor::Ptr> &executors) {
+  CoExecutor *cur = CoExecutor::GetCurrentExecutor();
+  if (cur && !cur->IsMarkedBlocked()) {
+    for (size_t i = 0; i < executors.size(); ++i) {
+      if (executors[i].get() == cur) {
+        return i;
+      }
+    }
+  }
+  return m_fallback.Pick(executors);
+}
+
+uint64_t MixHash(uint64_t x) {
+  x += 0x9E3779B97F4A7C15ull;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+  return x ^ (x >> 31);
+}
+
+void ConsistentHashRing::Add(const CoExecutor::Ptr &executor) {
+  // 虚拟节点先对执行器id做一次哈希，避免和数值很小的key落在同一个位置
+  uint64_t seed = MixHash((uint64_t) executor->Id());
+  for (uint64_t i = 0; i < HASH_RING_VIRTUAL_NODES; ++i) {
+    m_nodes[MixHash(seed + i)] = executor;
+  }
+}
+
+void ConsistentHashRing::Remove(const CoExecutor::Ptr &executor) {
+  for (auto it = m_nodes.begin(); it != m_nodes.end();) {
+    if (it->second == executor) {
+      it = m_nodes.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+CoExecutor::Ptr ConsistentHashRing::Lookup(uint64_t key) const {
+  if (m_nodes.empty()) {
+    return nullptr;
+  }
+  // 顺时针找到第一个虚拟节点
+  auto it = m_nodes.lower_bound(MixHash(key));
+  if (it == m_nodes.end()) {
+    it = m_nodes.begin();
+  }
+  return it->second;
+}
+
+} // namespace src
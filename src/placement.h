@@ -0,0 +1,137 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "coexecutor.h"
+
+// 一致性哈希环上每个执行器的虚拟节点数量
+#define HASH_RING_VIRTUAL_NODES 64
+// 同一个L3缓存下选出的执行器比随机选出的执行器多出这么多任务时，放到L3缓存以外的执行器
+#define PLACEMENT_SPILL_MARGIN 4
+
+namespace ahri {
+
+/**
+ * @brief 任务放置策略，决定新任务放到哪一个执行器中
+ *
+ */
+class PlacementPolicy {
+public:
+  typedef std::shared_ptr<PlacementPolicy> Ptr;
+
+  virtual ~PlacementPolicy() {}
+
+  /**
+   * @brief 选择一个执行器放置新任务，可能被多个线程同时调用
+   *
+   * @param executors 候选执行器，不为空
+   * @return size_t 选中的执行器在executors中的索引
+   */
+  virtual size_t Pick(const std::vector<CoExecutor::Ptr> &executors) = 0;
+
+  /**
+   * @brief 策略名称
+   *
+   */
+  virtual const char *Name() const = 0;
+};
+
+/**
+ * @brief 随机放置，不考虑负载
+ *
+ */
+class RandomPlacement : public PlacementPolicy {
+public:
+  size_t Pick(const std::vector<CoExecutor::Ptr> &executors) override;
+
+  const char *Name() const override { return "random"; }
+};
+
+/**
+ * @brief 轮流放置
+ *
+ */
+class RoundRobinPlacement : public PlacementPolicy {
+public:
+  size_t Pick(const std::vector<CoExecutor::Ptr> &executors) override;
+
+  const char *Name() const override { return "round-robin"; }
+
+private:
+  std::atomic<size_t> m_next{0};
+};
+
+/**
+ * @brief 随机选两个执行器，放到队列较短的一个中(power-of-two-choices)
+ * 在执行器中添加任务时，候选执行器优先从共享同一个L3缓存的执行器中选，
+ * 选出的执行器被标记为阻塞或者比全局随机选出的执行器多PLACEMENT_SPILL_MARGIN个以上任务时使用全局的选择
+ *
+ */
+class PowerOfTwoPlacement : public PlacementPolicy {
+public:
+  size_t Pick(const std::vector<CoExecutor::Ptr> &executors) override;
+
+  const char *Name() const override { return "power-of-two"; }
+};
+
+/**
+ * @brief 在执行器中添加的任务放回当前执行器，其它线程添加的任务按照power-of-two-choices放置
+ *
+ */
+class CallerLocalPlacement : public PlacementPolicy {
+public:
+  size_t Pick(const std::vector<CoExecutor::Ptr> &executors) override;
+
+  const char *Name() const override { return "caller-local"; }
+
+private:
+  PowerOfTwoPlacement m_fallback;
+};
+
+/**
+ * @brief 一致性哈希环，把key映射到执行器上
+ * 每个执行器在环上有HASH_RING_VIRTUAL_NODES个虚拟节点，虚拟节点的位置只和执行器id有关，
+ * 增减执行器时只有落在它的虚拟节点上的key会改变归属。不是线程安全的
+ *
+ */
+class ConsistentHashRing {
+public:
+  /**
+   * @brief 把执行器加入环中
+   *
+   */
+  void Add(const CoExecutor::Ptr &executor);
+
+  /**
+   * @brief 把执行器从环中移除，不在环中时什么都不做
+   *
+   */
+  void Remove(const CoExecutor::Ptr &executor);
+
+  /**
+   * @brief 查找key所属的执行器
+   *
+   * @param key
+   * @return CoExecutor::Ptr 环为空时返回空
+   */
+  CoExecutor::Ptr Lookup(uint64_t key) const;
+
+  inline bool Empty() const { return m_nodes.empty(); }
+
+  inline void Clear() { m_nodes.clear(); }
+
+private:
+  // 虚拟节点的哈希值到执行器的映射
+  std::map<uint64_t, CoExecutor::Ptr> m_nodes;
+};
+
+/**
+ * @brief 64位整数的混淆哈希(splitmix64)，让相邻的key均匀分布
+ *
+ */
+uint64_t MixHash(uint64_t x);
+
+} // namespace src
@@ -0,0 +1,143 @@
+#include <thread>
+
+#include "sharded.h"
+#include "topology.h"
+
+namespace ahri {
+
+// 当前线程所在的分片调度器和分片编号
+static thread_local ShardedScheduler *st_sharded = nullptr;
+static thread_local int st_shard_id = -1;
+
+ShardedScheduler::ShardedScheduler(size_t n_shards, bool bind_cpu) {
+  if (n_shards == 0) {
+    n_shards = std::thread::hardware_concurrency();
+  }
+  std::vector<int> cpus;
+  if (bind_cpu) {
+    cpus = CpuTopology::Get().PickCpus(n_shards);
+  }
+  for (size_t i = 0; i < n_shards; ++i) {
+    std::unique_ptr<Shard> shard(new Shard);
+    shard->executor.reset(new CoExecutor((int32_t) i));
+    shard->executor->SetPoller([this, i]() { return this->DrainMessages(i); });
+    if (!cpus.empty()) {
+      shard->cpu = cpus[i % cpus.size()];
+    }
+    m_shards.push_back(std::move(shard));
+  }
+  for (size_t i = 0; i < n_shards * n_shards; ++i) {
+    m_channels.emplace_back(new SpscQueue<Message>());
+  }
+}
+
+ShardedScheduler::~ShardedScheduler() {
+  Stop();
+}
+
+void ShardedScheduler::Start() {
+  if (m_started) {
+    return;
+  }
+  m_started = true;
+  for (size_t i = 0; i < m_shards.size(); ++i) {
+    m_shards[i]->thread = std::make_shared<Thread>([this, i]() { this->ShardLoop(i); },
+                                                   "shard-" + std::to_string(i));
+  }
+}
+
+void ShardedScheduler::Stop() {
+  if (!m_started) {
+    return;
+  }
+  m_started = false;
+  for (auto &shard : m_shards) {
+    shard->executor->RequestStop();
+    shard->executor->Poke();  // 执行器可能正在等待
+  }
+  for (auto &shard : m_shards) {
+    shard->thread->Join();
+  }
+}
+
+int ShardedScheduler::CurrentShard() const {
+  return st_sharded == this ? st_shard_id : -1;
+}
+
+void ShardedScheduler::Send(size_t shard, Message msg) {
+  AHRI_ASSERT(shard < m_shards.size());
+  int from = CurrentShard();
+  if (from >= 0) {
+    // 每对分片之间只有一个生产者和一个消费者
+    Channel((size_t) from, shard).Push(std::move(msg));
+  } else {
+    m_shards[shard]->inbox.Push(std::move(msg));
+  }
+  m_shards[shard]->executor->Poke();
+}
+
+void ShardedScheduler::ShardLoop(size_t shard) {
+  st_sharded = this;
+  st_shard_id = (int) shard;
+  CoExecutor::Ptr executor = m_shards[shard]->executor;
+  if (m_shards[shard]->cpu >= 0) {
+    executor->BindCpu(m_shards[shard]->cpu);
+  }
+  executor->Process(0);
+  st_sharded = nullptr;
+  st_shard_id = -1;
+}
+
+size_t ShardedScheduler::DrainMessages(size_t shard) {
+  Shard &s = *m_shards[shard];
+  size_t count = 0;
+  Message msg;
+  for (size_t from = 0; from < m_shards.size(); ++from) {
+    SpscQueue<Message> &channel = Channel(from, shard);
+    while (channel.Pop(msg)) {
+      s.pending.push_back(std::move(msg));
+      ++count;
+    }
+  }
+  count += s.inbox.ConsumeAll([&s](Message &m) { s.pending.push_back(std::move(m)); });
+  if (!s.pending.empty()) {
+    ScheduleWorker(shard);
+  }
+  return count;
+}
+
+void ShardedScheduler::ScheduleWorker(size_t shard) {
+  Shard &s = *m_shards[shard];
+  if (s.starting_workers > 0) {
+    return;  // 已经有worker马上会开始处理
+  }
+  ++s.starting_workers;
+  if (!s.idle_workers.empty()) {
+    CoExecutor::RecoveryEntry entry = s.idle_workers.back();
+    s.idle_workers.pop_back();
+    CoExecutor::Wakeup(entry);
+    return;
+  }
+  // 所有worker都挂起在消息中了
+  s.n_workers.fetch_add(1);
+  s.executor->AddTask(std::function<void()>([this, shard]() { this->WorkerLoop(shard); }));
+}
+
+void ShardedScheduler::WorkerLoop(size_t shard) {
+  Shard &s = *m_shards[shard];
+  while (!s.executor->IsStopped()) {
+    if (s.starting_workers > 0) {
+      --s.starting_workers;
+    }
+    // 消息在这里挂起时，后面的消息由另一个worker处理
+    while (!s.pending.empty()) {
+      Message msg = std::move(s.pending.front());
+      s.pending.pop_front();
+      msg();
+    }
+    CoExecutor::RecoveryEntry entry;
+    CoExecutor::HoldThen(entry, [&s, &entry]() { s.idle_workers.push_back(entry); });
+  }
+}
+
+} // namespace src
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "coexecutor.h"
+#include "containers.hpp"
+#include "thread.h"
+
+namespace ahri {
+
+/**
+ * @brief 每个核一个执行器、不共享任何数据的调度模式
+ * 每个分片的执行器独占自己的任务，任务不会被转移或者迁移，也没有调度线程和监控线程。
+ * 分片之间只通过每一对分片之间的单生产者单消费者队列传递消息，外部线程通过每个分片的无锁收件箱提交消息。
+ * 消息由目标分片中可以复用的worker协程依次执行，不会为每个消息创建协程；
+ * 只有正在执行的消息挂起(比如Call)时才会启用另一个worker继续处理后面的消息，因此分片内的队列只会被自己的线程访问
+ *
+ */
+class ShardedScheduler {
+public:
+  typedef std::function<void()> Message;
+
+  /**
+   * @brief 创建分片调度器
+   *
+   * @param n_shards 分片数量，为0时使用cpu数量
+   * @param bind_cpu 是否把每个分片绑定到不同的cpu上
+   */
+  explicit ShardedScheduler(size_t n_shards = 0, bool bind_cpu = false);
+
+  ~ShardedScheduler();
+
+  ShardedScheduler(const ShardedScheduler &) = delete;
+
+  ShardedScheduler &operator=(const ShardedScheduler &) = delete;
+
+  /**
+   * @brief 启动所有分片的线程
+   *
+   */
+  void Start();
+
+  /**
+   * @brief 停止所有分片并且等待线程退出
+   *
+   */
+  void Stop();
+
+  inline size_t ShardCount() const { return m_shards.size(); }
+
+  /**
+   * @brief 获取分片中已经创建的worker协程数量，等于同时挂起的消息数量的峰值加1
+   *
+   */
+  inline size_t GetWorkerCount(size_t shard) const { return m_shards[shard]->n_workers.load(); }
+
+  /**
+   * @brief 获取当前线程所在的分片
+   *
+   * @return int 分片编号，不在本调度器的分片中时返回-1
+   */
+  int CurrentShard() const;
+
+  /**
+   * @brief 发送消息到指定分片，消息在目标分片中作为任务执行
+   *
+   * @param shard 目标分片
+   * @param msg 消息
+   */
+  void Send(size_t shard, Message msg);
+
+  /**
+   * @brief 在指定分片中执行fn
+   *
+   * @param shard 目标分片
+   * @param fn 需要执行的函数
+   * @return std::future 函数的返回值，在分片中get会阻塞整个分片，分片中等待结果应该使用Call
+   */
+  template <typename F>
+  std::future<typename std::result_of<F()>::type> SubmitTo(size_t shard, F fn) {
+    typedef typename std::result_of<F()>::type R;
+    std::shared_ptr<std::packaged_task<R()>> task = std::make_shared<std::packaged_task<R()>>(std::move(fn));
+    std::future<R> fut = task->get_future();
+    Send(shard, [task]() { (*task)(); });
+    return fut;
+  }
+
+  /**
+   * @brief 在指定分片中执行fn并且等待结果
+   * 在分片的协程中调用时挂起协程，结果通过消息送回原来的分片后恢复；其它情况下阻塞当前线程。
+   * fn可能引用调用者的栈，协程被取消或者超时也会继续挂起直到结果送回，不会阻塞分片
+   *
+   * @param shard 目标分片
+   * @param fn 需要执行的函数
+   * @return fn的返回值，fn中的异常会重新抛出
+   */
+  template <typename F>
+  typename std::result_of<F()>::type Call(size_t shard, F fn) {
+    typedef typename std::result_of<F()>::type R;
+    int from = CurrentShard();
+    if (from < 0 || !CoExecutor::GetCurrentTask()) {
+      return SubmitTo(shard, std::move(fn)).get();
+    }
+    std::shared_ptr<CallState> state = std::allocate_shared<CallState>(SlabAllocator<CallState>());
+    std::shared_ptr<std::packaged_task<R()>> task = std::make_shared<std::packaged_task<R()>>(std::move(fn));
+    std::future<R> fut = task->get_future();
+    Send(shard, [this, task, state, from]() {
+      (*task)();
+      // 在原来的分片中唤醒，和等待的协程在同一个线程中，此时等待的协程一定已经换出
+      this->Send((size_t) from, [state]() {
+        state->done = true;
+        CoExecutor::Wakeup(state->entry);
+      });
+    });
+    while (!state->done) {
+      CoExecutor::HoldUninterruptibly(state->entry, []() {});
+    }
+    return fut.get();
+  }
+
+private:
+  /**
+   * @brief 分片线程运行的函数
+   *
+   */
+  void ShardLoop(size_t shard);
+
+  /**
+   * @brief 在分片线程中取出发给该分片的所有消息，交给worker协程处理
+   *
+   * @param shard 分片
+   * @return size_t 消息数量
+   */
+  size_t DrainMessages(size_t shard);
+
+  /**
+   * @brief 有待处理的消息时唤醒一个空闲的worker，没有空闲的worker时创建一个
+   *
+   */
+  void ScheduleWorker(size_t shard);
+
+  /**
+   * @brief worker协程的函数，处理完所有消息后挂起等待下一批
+   *
+   */
+  void WorkerLoop(size_t shard);
+
+  /**
+   * @brief from到to的消息队列
+   *
+   */
+  inline SpscQueue<Message> &Channel(size_t from, size_t to) { return *m_channels[from * m_shards.size() + to]; }
+
+private:
+  // Call等待结果的状态，只在调用者的分片线程中访问
+  struct CallState {
+    CoExecutor::RecoveryEntry entry;
+    bool done = false;
+  };
+
+  struct Shard {
+    CoExecutor::Ptr executor;
+    // 外部线程发给该分片的消息
+    MpscQueue<Message> inbox;
+    Thread::Ptr thread;
+    int cpu = -1;
+    // 等待worker处理的消息，以下成员只在分片线程中访问
+    std::deque<Message> pending;
+    // 挂起等待消息的worker
+    std::vector<CoExecutor::RecoveryEntry> idle_workers;
+    // 已经唤醒或者创建、还没有开始处理消息的worker数量
+    size_t starting_workers = 0;
+    std::atomic<size_t> n_workers{0};
+  };
+
+  std::vector<std::unique_ptr<Shard>> m_shards;
+  // 分片之间的消息队列，按照from * n + to排列
+  std::vector<std::unique_ptr<SpscQueue<Message>>> m_channels;
+  bool m_started = false;
+};
+
+} // namespace src
@@ -0,0 +1,346 @@
+#ifndef __AHRI_SLAB_HPP__
+#define __AHRI_SLAB_HPP__
+
+#include <stdlib.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// 每个弹匣(magazine)缓存的空闲对象数量，也是每次向系统申请一块slab时包含的对象数量
+#define SLAB_MAGAZINE_SIZE 64
+// slab中对象的对齐，对象大小向上取整到它的倍数
+#define SLAB_ALIGN 16
+// slab块的对齐，按照缓存行对齐
+#define SLAB_CHUNK_ALIGN 64
+
+namespace ahri {
+
+/**
+ * @brief 按照固定大小分配对象的slab分配器，同一大小的对象共用一个实例
+ * 每个线程有两个弹匣缓存空闲对象，分配和释放都先在本线程的弹匣中完成，不需要加锁；
+ * 弹匣用完或者装满时才和全局仓库(depot)整个交换，一次加锁转移SLAB_MAGAZINE_SIZE个对象。
+ * 在其它线程释放的对象放入释放线程自己的弹匣，装满后经过仓库回到分配的线程，不需要归还给原来的线程。
+ * 仓库中没有对象时一次申请一整块连续的slab，对象紧密排列；slab不会归还给系统
+ *
+ * @tparam Size 对象的大小，需要是SLAB_ALIGN的倍数
+ */
+template <size_t Size>
+class SlabPool {
+  static_assert(Size % SLAB_ALIGN == 0, "slab object size must be a multiple of SLAB_ALIGN");
+
+private:
+  struct Magazine {
+    size_t count = 0;
+    void *items[SLAB_MAGAZINE_SIZE];
+
+    bool Full() const { return count == SLAB_MAGAZINE_SIZE; }
+
+    bool Empty() const { return count == 0; }
+  };
+
+  /**
+   * @brief 全局仓库，保存装满的弹匣、空弹匣和线程退出后单独释放的对象
+   *
+   */
+  struct Depot {
+    std::mutex mtx;
+    std::vector<Magazine *> full;
+    std::vector<Magazine *> empty;
+    std::vector<void *> loose;
+    std::atomic<size_t> slabs{0};
+    std::atomic<uint64_t> exchanges{0};
+  };
+
+  /**
+   * @brief 线程本地的缓存，loaded用于分配和释放，previous是备用的弹匣
+   *
+   */
+  struct Cache {
+    Magazine *loaded;
+    Magazine *previous;
+
+    Cache() : loaded(new Magazine()), previous(new Magazine()) {}
+
+    ~Cache() {
+      // 线程退出时把弹匣交还仓库，之后这个线程中的释放直接放入仓库
+      LocalCacheDead() = true;
+      Depot &depot = GetDepot();
+      std::lock_guard<std::mutex> lk(depot.mtx);
+      ReturnLocked(depot, loaded);
+      ReturnLocked(depot, previous);
+    }
+  };
+
+public:
+  /**
+   * @brief 分配一个Size字节的对象
+   *
+   */
+  static void *Allocate() {
+    Cache *cache = LocalCache();
+    if (!cache) {
+      return AllocateFromDepot();
+    }
+    if (cache->loaded->Empty()) {
+      if (!cache->previous->Empty()) {
+        std::swap(cache->loaded, cache->previous);
+      } else {
+        Refill(cache);
+      }
+    }
+    return cache->loaded->items[--cache->loaded->count];
+  }
+
+  /**
+   * @brief 释放Allocate分配的对象，可以在任意线程中调用
+   *
+   */
+  static void Deallocate(void *p) {
+    Cache *cache = LocalCache();
+    if (!cache) {
+      Depot &depot = GetDepot();
+      std::lock_guard<std::mutex> lk(depot.mtx);
+      depot.loose.push_back(p);
+      return;
+    }
+    if (cache->loaded->Full()) {
+      if (!cache->previous->Full()) {
+        std::swap(cache->loaded, cache->previous);
+      } else {
+        Flush(cache);
+      }
+    }
+    cache->loaded->items[cache->loaded->count++] = p;
+  }
+
+  /**
+   * @brief 获取已经申请的slab数量，每个slab包含SLAB_MAGAZINE_SIZE个对象
+   *
+   */
+  static size_t GetSlabCount() { return GetDepot().slabs.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief 获取线程缓存和仓库交换弹匣的次数，也就是加锁的次数
+   *
+   */
+  static uint64_t GetDepotExchangeCount() { return GetDepot().exchanges.load(std::memory_order_relaxed); }
+
+private:
+  static Depot &GetDepot() {
+    // 其它静态对象析构时可能还在释放对象，仓库不析构
+    static Depot *depot = new Depot();
+    return *depot;
+  }
+
+  static bool &LocalCacheDead() {
+    static thread_local bool dead = false;
+    return dead;
+  }
+
+  /**
+   * @brief 获取当前线程的缓存
+   *
+   * @return Cache* 线程正在退出并且缓存已经析构时为空
+   */
+  static Cache *LocalCache() {
+    if (LocalCacheDead()) {
+      return nullptr;
+    }
+    static thread_local Cache cache;
+    return &cache;
+  }
+
+  /**
+   * @brief 申请一块新的slab，放满magazine
+   *
+   */
+  static void NewSlab(Magazine *magazine) {
+    void *mem = nullptr;
+    if (posix_memalign(&mem, SLAB_CHUNK_ALIGN, Size * SLAB_MAGAZINE_SIZE) != 0) {
+      throw std::bad_alloc();
+    }
+    char *base = static_cast<char *>(mem);
+    // 倒序放入，先分配地址低的对象
+    for (size_t i = 0; i < SLAB_MAGAZINE_SIZE; ++i) {
+      magazine->items[i] = base + (SLAB_MAGAZINE_SIZE - 1 - i) * Size;
+    }
+    magazine->count = SLAB_MAGAZINE_SIZE;
+    GetDepot().slabs.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief 两个弹匣都为空，用空的loaded从仓库换一个满的弹匣，仓库也没有时申请新的slab
+   *
+   */
+  static void Refill(Cache *cache) {
+    Depot &depot = GetDepot();
+    {
+      std::lock_guard<std::mutex> lk(depot.mtx);
+      depot.exchanges.fetch_add(1, std::memory_order_relaxed);
+      if (!depot.full.empty()) {
+        depot.empty.push_back(cache->loaded);
+        cache->loaded = depot.full.back();
+        depot.full.pop_back();
+        return;
+      }
+      while (!depot.loose.empty() && !cache->loaded->Full()) {
+        cache->loaded->items[cache->loaded->count++] = depot.loose.back();
+        depot.loose.pop_back();
+      }
+      if (!cache->loaded->Empty()) {
+        return;
+      }
+    }
+    NewSlab(cache->loaded);
+  }
+
+  /**
+   * @brief 两个弹匣都满了，把previous交给仓库，loaded成为previous，换一个空弹匣继续释放
+   *
+   */
+  static void Flush(Cache *cache) {
+    Depot &depot = GetDepot();
+    Magazine *empty = nullptr;
+    {
+      std::lock_guard<std::mutex> lk(depot.mtx);
+      depot.exchanges.fetch_add(1, std::memory_order_relaxed);
+      depot.full.push_back(cache->previous);
+      if (!depot.empty.empty()) {
+        empty = depot.empty.back();
+        depot.empty.pop_back();
+      }
+    }
+    cache->previous = cache->loaded;
+    cache->loaded = empty ? empty : new Magazine();
+  }
+
+  static void ReturnLocked(Depot &depot, Magazine *magazine) {
+    if (magazine->Full()) {
+      depot.full.push_back(magazine);
+      return;
+    }
+    for (size_t i = 0; i < magazine->count; ++i) {
+      depot.loose.push_back(magazine->items[i]);
+    }
+    magazine->count = 0;
+    depot.empty.push_back(magazine);
+  }
+
+  static void *AllocateFromDepot() {
+    Depot &depot = GetDepot();
+    {
+      std::lock_guard<std::mutex> lk(depot.mtx);
+      if (!depot.loose.empty()) {
+        void *p = depot.loose.back();
+        depot.loose.pop_back();
+        return p;
+      }
+      if (!depot.full.empty()) {
+        Magazine *magazine = depot.full.back();
+        void *p = magazine->items[--magazine->count];
+        if (magazine->Empty()) {
+          depot.full.pop_back();
+          depot.empty.push_back(magazine);
+        }
+        return p;
+      }
+    }
+    Magazine magazine;
+    NewSlab(&magazine);
+    void *p = magazine.items[--magazine.count];
+    std::lock_guard<std::mutex> lk(depot.mtx);
+    for (size_t i = 0; i < magazine.count; ++i) {
+      depot.loose.push_back(magazine.items[i]);
+    }
+    return p;
+  }
+};
+
+/**
+ * @brief 对象大小向上取整后的slab分配器
+ *
+ */
+template <typename T>
+struct SlabFor {
+  static_assert(alignof(T) <= SLAB_ALIGN, "slab can not satisfy the alignment of the type");
+  typedef SlabPool<(sizeof(T) + SLAB_ALIGN - 1) / SLAB_ALIGN * SLAB_ALIGN> Pool;
+};
+
+/**
+ * @brief 从slab分配单个对象的分配器，可以用于std::allocate_shared，控制块和对象在同一个slab对象中；
+ * 一次分配多个对象时使用全局的operator new
+ *
+ * @tparam T
+ */
+template <typename T>
+class SlabAllocator {
+public:
+  typedef T value_type;
+
+  template <typename U>
+  struct rebind {
+    typedef SlabAllocator<U> other;
+  };
+
+  SlabAllocator() noexcept {}
+
+  template <typename U>
+  SlabAllocator(const SlabAllocator<U> &) noexcept {}
+
+  T *allocate(size_t n) {
+    if (n == 1) {
+      return static_cast<T *>(SlabFor<T>::Pool::Allocate());
+    }
+    return static_cast<T *>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T *p, size_t n) noexcept {
+    if (n == 1) {
+      SlabFor<T>::Pool::Deallocate(p);
+    } else {
+      ::operator delete(p);
+    }
+  }
+
+  template <typename U>
+  bool operator==(const SlabAllocator<U> &) const noexcept {
+    return true;
+  }
+
+  template <typename U>
+  bool operator!=(const SlabAllocator<U> &) const noexcept {
+    return false;
+  }
+};
+
+/**
+ * @brief 继承后new/delete T时从slab分配，派生类的大小不同时使用全局的operator new
+ *
+ * @tparam T 派生类
+ */
+template <typename T>
+class SlabAllocated {
+public:
+  static void *operator new(size_t size) {
+    if (size == sizeof(T)) {
+      return SlabFor<T>::Pool::Allocate();
+    }
+    return ::operator new(size);
+  }
+
+  static void operator delete(void *p, size_t size) {
+    if (size == sizeof(T)) {
+      SlabFor<T>::Pool::Deallocate(p);
+    } else {
+      ::operator delete(p);
+    }
+  }
+};
+
+} // namespace src
+
+#endif
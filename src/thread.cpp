@@ -1,4 +1,5 @@
 #include <errno.h>
+#include <sched.h>
 #include <system_error>
 #include <cstring>
 
@@ -71,6 +72,46 @@ void Thread::Detach() {
   }
 }
 
+static bool SetThreadAffinity(pthread_t thread, const std::vector<int>& cpus) {
+  if (cpus.empty()) {
+    return false;
+  }
+  cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  for (int cpu : cpus) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &cpuset);
+    }
+  }
+  return pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuset) == 0;
+}
+
+bool Thread::SetAffinity(const std::vector<int>& cpus) {
+  if (!m_thread) {
+    return false;
+  }
+  return SetThreadAffinity(m_thread, cpus);
+}
+
+bool Thread::SetCurrentAffinity(const std::vector<int>& cpus) {
+  return SetThreadAffinity(pthread_self(), cpus);
+}
+
+std::vector<int> Thread::GetCurrentAffinity() {
+  std::vector<int> cpus;
+  cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  if (pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset) != 0) {
+    return cpus;
+  }
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &cpuset)) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
 void* Thread::Run(void* arg) {
   Thread* self = (Thread*)(arg);
   t_thread = self;
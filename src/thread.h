@@ -3,6 +3,7 @@
 #include <pthread.h>
 #include <memory>
 #include <string>
+#include <vector>
 #include <functional>
 
 #include "nocopyable.h"
@@ -80,6 +81,31 @@ public:
 
   bool Joinable() const { return m_joinable; }
 
+  /**
+   * @brief 设置线程的cpu亲和性
+   * 
+   * @param cpus 线程允许运行的cpu编号
+   * @return true 设置成功
+   * @return false 设置失败
+   */
+  bool SetAffinity(const std::vector<int>& cpus);
+
+  /**
+   * @brief 设置当前线程的cpu亲和性
+   * 
+   * @param cpus 线程允许运行的cpu编号
+   * @return true 设置成功
+   * @return false 设置失败
+   */
+  static bool SetCurrentAffinity(const std::vector<int>& cpus);
+
+  /**
+   * @brief 获取当前线程允许运行的cpu编号
+   * 
+   * @return std::vector<int> 
+   */
+  static std::vector<int> GetCurrentAffinity();
+
   void Swap(Thread& x) {
     std::swap(m_thread, x.m_thread);
     std::swap(m_name, x.m_name);
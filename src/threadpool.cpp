@@ -1,13 +1,52 @@
 #include "threadpool.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <chrono>
+
 namespace ahri {
 
+// 当前线程所属的线程池和在线程池中的编号
+static thread_local ThreadPoolExecutor *st_pool = nullptr;
+static thread_local size_t st_worker_idx = 0;
+
+void ScheduledHandle::Cancel() {
+  if (!m_state) {
+    return;
+  }
+  m_state->cancelled.store(true, std::memory_order_release);
+  std::lock_guard<std::mutex> lk(m_state->owner->mtx);
+  if (m_state->owner->pool) {
+    m_state->owner->pool->CancelTimer(static_cast<ThreadPoolExecutor::TimerEntry *>(m_state.get()));
+  }
+}
+
 ThreadPoolExecutor::ThreadPoolExecutor(size_t n_threads)
-    : m_thread_count(n_threads),
-      m_stopped(true), m_is_stopping(false), m_started(false) {
-  m_thread_count = m_thread_count == 0 ? std::thread::hardware_concurrency() : m_thread_count;
+    : ThreadPoolExecutor(n_threads, n_threads, THREADPOOL_KEEP_ALIVE_MS) {
+  m_core_threads = m_max_threads;  // n_threads为0时核心线程数量也是cpu数量
+}
+
+ThreadPoolExecutor::ThreadPoolExecutor(size_t core_threads, size_t max_threads, uint64_t keep_alive_ms)
+    : m_core_threads(core_threads), m_max_threads(max_threads), m_keep_alive_ms(keep_alive_ms),
+      m_inbound(THREADPOOL_INBOUND_CAPACITY), m_stopped(true), m_is_stopping(false), m_started(false) {
+  m_max_threads = m_max_threads == 0 ? std::thread::hardware_concurrency() : m_max_threads;
+  m_max_threads = std::max(m_max_threads, m_core_threads);
+  m_timer_owner = std::make_shared<ScheduledHandle::Owner>();
+  m_timer_owner->pool = this;
+  for (size_t i = 0; i < m_max_threads; ++i) {
+    m_workers.emplace_back(new Worker());
+  }
 }
 
 ThreadPoolExecutor::~ThreadPoolExecutor() {
+  {
+    // 线程池析构后句柄仍然可以取消任务
+    std::lock_guard<std::mutex> lk(m_timer_owner->mtx);
+    m_timer_owner->pool = nullptr;
+  }
+  if (m_started && !m_is_stopping) {
+    Stop(true);  // 线程还在运行时std::thread析构会终止进程
+  }
   if (m_is_stopping) {
     m_stopped = true;
     m_is_stopping = false;
@@ -15,84 +54,366 @@ ThreadPoolExecutor::~ThreadPoolExecutor() {
     if (!m_tasks_queue.Empty()) {
       m_tasks_queue.Clear();
     }
-    if (!m_threads.empty()) {
-      m_threads.clear();
+  }
+}
+
+bool ThreadPoolExecutor::SchedulerTask(const TaskF& task) {
+  return Enqueue(MoveOnlyTask(task));
+}
+
+bool ThreadPoolExecutor::Enqueue(MoveOnlyTask &&task) {
+  if (m_stopped || m_is_stopping) {
+    return false;
+  }
+  // 外部线程提交的任务先放入无锁的环形队列，满了再放入带锁的公共队列
+  if (st_pool == this || !m_inbound.TryPush(std::move(task))) {
+    TargetQueue().PushBack(std::move(task));
+  }
+  OnTasksAdded(1);
+  return true;
+}
+
+ThreadPoolExecutor::TaskQueue &ThreadPoolExecutor::TargetQueue() {
+  if (st_pool == this) {
+    return m_workers[st_worker_idx]->queue;
+  }
+  return m_tasks_queue;
+}
+
+void ThreadPoolExecutor::OnTasksAdded(size_t n) {
+  m_pending.fetch_add((int64_t) n);
+  NotifyCondition(n);
+  MaybeGrow(n);
+}
+
+void ThreadPoolExecutor::MaybeGrow(size_t n) {
+  // 固定大小的线程池在这里直接返回
+  size_t live = m_live.load();
+  if (live >= m_max_threads) {
+    return;
+  }
+  // 刚加入的任务还没有被取走，执行完上一个任务的线程也可能还没有减少m_active，
+  // 所以阈值为0时按照每个线程都取走一个任务之后是否还有任务在排队来判断
+  size_t threshold = m_grow_threshold != 0 ? m_grow_threshold : live;
+  if (GetPendingCount() <= threshold) {
+    return;
+  }
+  UniLock lk(m_mtx);
+  for (size_t i = 0; i < n && m_started && !m_is_stopping; ++i) {
+    if (!SpawnWorkerLocked()) {
+      break;
+    }
+  }
+}
+
+bool ThreadPoolExecutor::SpawnWorkerLocked() {
+  if (m_live.load() >= m_max_threads) {
+    return false;
+  }
+  for (size_t i = 0; i < m_workers.size(); ++i) {
+    Worker &worker = *m_workers[i];
+    if (worker.running) {
+      continue;
+    }
+    if (worker.thread.joinable()) {
+      // 之前在这个位置上的线程已经空闲退出，不会再加锁，可以直接回收
+      worker.thread.join();
+    }
+    worker.running = true;
+    worker.thread = std::thread(&ThreadPoolExecutor::Runnable, this, i);
+    size_t live = m_live.fetch_add(1) + 1;
+    if (live > m_largest.load()) {
+      m_largest = live;
+    }
+    return true;
+  }
+  return false;
+}
+
+bool ThreadPoolExecutor::TimerLater(const TimerEntryPtr &a, const TimerEntryPtr &b) {
+  if (a->when != b->when) {
+    return a->when > b->when;
+  }
+  return a->seq > b->seq;
+}
+
+ScheduledHandle ThreadPoolExecutor::ScheduleAfter(std::chrono::milliseconds delay, const TaskF &task) {
+  return ScheduleAt(Clock::now() + delay, task);
+}
+
+ScheduledHandle ThreadPoolExecutor::ScheduleAt(Clock::time_point when, const TaskF &task) {
+  TimerEntryPtr entry = std::make_shared<TimerEntry>();
+  entry->when = when;
+  entry->period = Clock::duration::zero();
+  entry->task = task;
+  entry->owner = m_timer_owner;
+  if (!AddTimer(entry)) {
+    return ScheduledHandle();
+  }
+  return ScheduledHandle(entry);
+}
+
+ScheduledHandle ThreadPoolExecutor::ScheduleAtFixedRate(std::chrono::milliseconds initial_delay,
+                                                        std::chrono::milliseconds period, const TaskF &task) {
+  AHRI_ASSERT_MSG(period.count() > 0, "period of ScheduleAtFixedRate must be positive");
+  TimerEntryPtr entry = std::make_shared<TimerEntry>();
+  entry->when = Clock::now() + initial_delay;
+  entry->period = period;
+  entry->task = task;
+  entry->owner = m_timer_owner;
+  if (!AddTimer(entry)) {
+    return ScheduledHandle();
+  }
+  return ScheduledHandle(entry);
+}
+
+size_t ThreadPoolExecutor::GetScheduledCount() {
+  LockGuard lk(m_timer_mtx);
+  return m_timers.size() - m_cancelled_timers;
+}
+
+bool ThreadPoolExecutor::AddTimer(const TimerEntryPtr &entry) {
+  if (m_stopped || m_is_stopping) {
+    return false;
+  }
+  LockGuard lk(m_timer_mtx);
+  if (m_timer_stopping) {
+    return false;
+  }
+  entry->seq = m_timer_seq++;
+  entry->in_heap = true;
+  m_timers.push_back(entry);
+  std::push_heap(m_timers.begin(), m_timers.end(), TimerLater);
+  if (!m_timer_thread.joinable()) {
+    m_timer_thread = std::thread(&ThreadPoolExecutor::TimerLoop, this);
+  } else if (m_timers.front() == entry) {
+    // 新任务比定时线程正在等待的任务更早到期
+    m_timer_cv.notify_one();
+  }
+  return true;
+}
+
+void ThreadPoolExecutor::TimerLoop() {
+  UniLock lk(m_timer_mtx);
+  while (!m_timer_stopping) {
+    if (m_timers.empty()) {
+      m_timer_cv.wait(lk);
+      continue;
+    }
+    TimerEntryPtr top = m_timers.front();
+    // 取消的任务通常不从堆中间删除，到达堆顶时再丢弃
+    bool cancelled = top->cancelled.load(std::memory_order_acquire);
+    if (!cancelled && top->when > Clock::now()) {
+      m_timer_cv.wait_until(lk, top->when);
+      continue;
+    }
+    std::pop_heap(m_timers.begin(), m_timers.end(), TimerLater);
+    m_timers.pop_back();
+    top->in_heap = false;
+    if (top->released) {
+      --m_cancelled_timers;
+    } else if (cancelled) {
+      // 取消标记已经设置，但是CancelTimer还没有拿到锁
+      top->task = nullptr;
+    }
+    if (!cancelled) {
+      lk.unlock();
+      Enqueue(MoveOnlyTask([this, top]() { this->RunTimer(top); }));
+      lk.lock();
+    }
+  }
+  for (const TimerEntryPtr &entry : m_timers) {
+    entry->in_heap = false;
+    entry->task = nullptr;
+  }
+  m_timers.clear();
+  m_cancelled_timers = 0;
+}
+
+void ThreadPoolExecutor::RunTimer(const TimerEntryPtr &entry) {
+  // 不在堆中时只有这里访问task，句柄持有的任务在执行结束后释放函数
+  if (entry->cancelled.load(std::memory_order_acquire)) {
+    entry->task = nullptr;
+    return;
+  }
+  entry->task();
+  entry->runs.fetch_add(1);
+  if (entry->period != Clock::duration::zero() && !entry->cancelled.load(std::memory_order_acquire)) {
+    // 按照计划时刻而不是结束时刻计算下一次，执行耗时不会累积
+    entry->when += entry->period;
+    if (AddTimer(entry)) {
+      return;
     }
   }
+  entry->task = nullptr;
 }
 
-void ThreadPoolExecutor::SchedulerTask(const TaskF& task) {
-  if (!m_stopped && !m_is_stopping) {
-    m_tasks_queue.PushBack(task);
-    NotifyCondition();
+void ThreadPoolExecutor::StopTimerThread() {
+  {
+    LockGuard lk(m_timer_mtx);
+    m_timer_stopping = true;
+    m_timer_cv.notify_one();
+  }
+  // 定时线程不执行任务，总是可以很快结束
+  if (m_timer_thread.joinable()) {
+    m_timer_thread.join();
   }
 }
 
+void ThreadPoolExecutor::CancelTimer(TimerEntry *entry) {
+  LockGuard lk(m_timer_mtx);
+  if (!entry->in_heap || entry->released) {
+    // 已经到期的任务在RunTimer中检查取消标记
+    return;
+  }
+  entry->released = true;
+  entry->task = nullptr;
+  ++m_cancelled_timers;
+  if (m_cancelled_timers < THREADPOOL_TIMER_COMPACT_MIN || m_cancelled_timers * 2 < m_timers.size()) {
+    return;
+  }
+  // 取消的任务占了堆的大部分，一次移除后重新建堆，堆顶只会变晚，不需要唤醒定时线程
+  auto end = std::remove_if(m_timers.begin(), m_timers.end(), [](const TimerEntryPtr &e) {
+    if (e->released) {
+      e->in_heap = false;
+      return true;
+    }
+    return false;
+  });
+  m_timers.erase(end, m_timers.end());
+  std::make_heap(m_timers.begin(), m_timers.end(), TimerLater);
+  m_cancelled_timers = 0;
+}
+
 void ThreadPoolExecutor::Start() {
   if (!m_started && m_stopped) {
-    m_threads.reserve(m_thread_count);
+    UniLock lk(m_mtx);
     m_started = true;
     m_stopped = false;
-    for (size_t i = 0; i < m_thread_count; ++i) {
-      m_threads.emplace_back(std::thread(&ThreadPoolExecutor::Runnable, this));
+    for (size_t i = 0; i < m_core_threads; ++i) {
+      SpawnWorkerLocked();
     }
   }
 }
 
 void ThreadPoolExecutor::Stop(bool join) {
   if (!m_stopped && m_started) {
-    m_is_stopping = true;
-    NotifyCondition();  // 唤醒所有的任务让他们结束
+    {
+      // 队列为空时NotifyCondition不会通知，直接唤醒所有等待的线程让他们结束
+      UniLock lk(m_mtx);
+      m_is_stopping = true;
+      m_cv.notify_all();
+    }
+    StopTimerThread();
     if (join) {
       WaitForTaskDone();  // 等待所有执行的任务结束
     } else {
       DetachAllThreads();
     }
+    m_live = 0;
   }
 }
 
-void ThreadPoolExecutor::Runnable() {
-  // 从任务队列中取出任务执行
+void ThreadPoolExecutor::Runnable(size_t idx) {
+  st_pool = this;
+  st_worker_idx = idx;
+  // 从任务队列中取出任务执行，取不到任务时等待
+  size_t idle_rounds = 0;
   while (m_started && !m_is_stopping) {
-    WaitForCondition();
-    // 出来就可以去取任务
-    if (!m_tasks_queue.Empty()) {
-      UniLock lk(m_tasks_queue.LockRef());
-      auto fn = m_tasks_queue.FrontNoLock();
-      m_tasks_queue.PopFrontUnsafe();
-      lk.unlock();
+    MoveOnlyTask fn;
+    if (PopTask(idx, fn)) {
+      idle_rounds = 0;
+      ++m_active;
       fn();
-      TaskF().swap(fn);
+      --m_active;
+    } else if (++idle_rounds < THREADPOOL_SPIN_ROUNDS) {
+      // 先让出cpu再重试几次，任务连续提交时不需要每次都经过条件变量
+      std::this_thread::yield();
+    } else {
+      idle_rounds = 0;
+      if (!WaitForCondition(idx)) {
+        break;  // 空闲超时，线程退出
+      }
     }
   }
+  st_pool = nullptr;
 }
 
-void ThreadPoolExecutor::WaitForCondition() {
-  // 等待任务队列不为空
+bool ThreadPoolExecutor::PopTask(size_t idx, MoveOnlyTask &out) {
+  bool found = m_workers[idx]->queue.TryPopBack(out) || m_inbound.TryPop(out);
+  // 所有队列都没有任务时不需要逐个加锁检查公共队列和其它线程的队列
+  if (!found && m_pending.load() > 0) {
+    found = m_tasks_queue.TryPopFront(out);
+  }
+  if (!found && m_pending.load() > 0) {
+    // 从随机的线程开始偷取，偷最早放入的任务
+    size_t n = m_workers.size();
+    size_t start = FastRand() % n;
+    for (size_t i = 0; i < n && !found; ++i) {
+      size_t victim = (start + i) % n;
+      if (victim != idx && m_workers[victim]->queue.TryPopFront(out)) {
+        m_steal_cnt.fetch_add(1, std::memory_order_relaxed);
+        found = true;
+      }
+    }
+  }
+  if (found) {
+    m_pending.fetch_sub(1);
+  }
+  return found;
+}
+
+bool ThreadPoolExecutor::WaitForCondition(size_t idx) {
+  // 等待有任务可以取，先登记为空闲线程再检查，提交任务时根据空闲线程数量决定是否通知
   UniLock lk(m_mtx);
-  m_cv.wait(lk, [this]() {
-    return !m_tasks_queue.Empty() || m_is_stopping;
-  });
+  ++m_sleeping;
+  auto ready = [this]() {
+    return m_pending.load() > 0 || m_is_stopping;
+  };
+  bool woken = true;
+  if (m_live.load() > m_core_threads) {
+    woken = m_cv.wait_for(lk, std::chrono::milliseconds(m_keep_alive_ms), ready);
+  } else {
+    m_cv.wait(lk, ready);
+  }
+  --m_sleeping;
+  // 线程数量多于核心数量时，空闲超时的线程退出，留下的位置之后可以重新创建线程
+  if (!woken && m_live.load() > m_core_threads) {
+    --m_live;
+    m_workers[idx]->running = false;
+    return false;
+  }
+  return true;
 }
 
 void ThreadPoolExecutor::DetachAllThreads() {
-  for (auto &&t : m_threads) {
-    t.detach();
+  for (auto &&worker : m_workers) {
+    if (worker->thread.joinable()) {
+      worker->thread.detach();
+    }
   }
 }
 
 void ThreadPoolExecutor::WaitForTaskDone() {
-  for (auto &&t: m_threads) {
-    if (t.joinable()) {
-      t.join();
+  for (auto &&worker : m_workers) {
+    if (worker->thread.joinable()) {
+      worker->thread.join();
     }
   }
 }
 
-void ThreadPoolExecutor::NotifyCondition() {
-  if (!m_tasks_queue.Empty()) {
-    UniLock lk(m_mtx);
+void ThreadPoolExecutor::NotifyCondition(size_t n) {
+  // 没有空闲线程时不需要通知，忙碌的线程执行完当前任务后会继续取任务
+  if (m_sleeping.load() == 0) {
+    return;
+  }
+  UniLock lk(m_mtx);
+  if (n >= m_sleeping.load()) {
     m_cv.notify_all();
+  } else {
+    for (size_t i = 0; i < n; ++i) {
+      m_cv.notify_one();
+    }
   }
 }
 
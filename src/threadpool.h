@@ -6,24 +6,280 @@
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
+#include <chrono>
 #include <functional>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 
 #include "singleton.hpp"
 #include "containers.hpp"
 
+// 线程取不到任务时，进入等待之前让出cpu重试的次数
+#define THREADPOOL_SPIN_ROUNDS 16
+// 外部线程提交任务的无锁队列的容量
+#define THREADPOOL_INBOUND_CAPACITY 4096
+// 核心线程以外的线程默认的空闲存活时间
+#define THREADPOOL_KEEP_ALIVE_MS 60000
+// 已经取消的定时任务超过这个数量并且超过堆中任务的一半时，从堆中移除所有取消的任务
+#define THREADPOOL_TIMER_COMPACT_MIN 64
+
 namespace ahri {
 
+/**
+ * @brief 只能移动的任务，可以保存不能复制的可调用对象，放入和取出队列时都不会复制
+ *
+ */
+class MoveOnlyTask {
+public:
+  MoveOnlyTask() {}
+
+  template <typename F,
+            typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, MoveOnlyTask>::value>::type>
+  MoveOnlyTask(F &&fn) : m_impl(new Impl<typename std::decay<F>::type>(std::forward<F>(fn))) {}
+
+  MoveOnlyTask(MoveOnlyTask &&) = default;
+
+  MoveOnlyTask &operator=(MoveOnlyTask &&) = default;
+
+  MoveOnlyTask(const MoveOnlyTask &) = delete;
+
+  MoveOnlyTask &operator=(const MoveOnlyTask &) = delete;
+
+  void operator()() { m_impl->Call(); }
+
+  explicit operator bool() const { return m_impl != nullptr; }
+
+private:
+  struct ImplBase {
+    virtual ~ImplBase() {}
+
+    virtual void Call() = 0;
+  };
+
+  template <typename F>
+  struct Impl : ImplBase {
+    template <typename U>
+    explicit Impl(U &&f) : fn(std::forward<U>(f)) {}
+
+    void Call() override { fn(); }
+
+    F fn;
+  };
+
+  std::unique_ptr<ImplBase> m_impl;
+};
+
+template <size_t... I>
+struct IndexSequence {};
+
+template <size_t N, size_t... I>
+struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, I...> {};
+
+template <size_t... I>
+struct MakeIndexSequence<0, I...> {
+  typedef IndexSequence<I...> type;
+};
+
+/**
+ * @brief 保存函数和参数，调用时把参数移动给函数，参数可以是只能移动的类型
+ *
+ * @tparam F 函数类型
+ * @tparam Args 参数类型
+ */
+template <typename F, typename... Args>
+class BoundCall {
+public:
+  typedef typename std::result_of<F(Args...)>::type result_type;
+
+  template <typename UF, typename... UArgs>
+  explicit BoundCall(UF &&fn, UArgs &&...args) : m_fn(std::forward<UF>(fn)), m_args(std::forward<UArgs>(args)...) {}
+
+  result_type operator()() { return Invoke(typename MakeIndexSequence<sizeof...(Args)>::type()); }
+
+private:
+  template <size_t... I>
+  result_type Invoke(IndexSequence<I...>) {
+    return m_fn(std::move(std::get<I>(m_args))...);
+  }
+
+  F m_fn;
+  std::tuple<Args...> m_args;
+};
+
+class ThreadPoolExecutor;
+
+/**
+ * @brief 定时任务的句柄，可以用来取消还没有执行的定时任务或者停止周期任务
+ * 默认构造的句柄为空句柄，表示任务没有被接受
+ *
+ */
+class ScheduledHandle {
+public:
+  ScheduledHandle() {}
+
+  bool Valid() const { return m_state != nullptr; }
+
+  /**
+   * @brief 取消任务，还没有到期的任务不会再执行，周期任务在正在进行的这次执行之后停止，重复调用无效
+   * 还在等待到期的任务立即释放函数，不再计入GetScheduledCount
+   *
+   */
+  void Cancel();
+
+  bool IsCancelled() const { return m_state && m_state->cancelled.load(std::memory_order_acquire); }
+
+  /**
+   * @brief 获取任务已经执行完成的次数
+   *
+   */
+  uint64_t GetRunCount() const { return m_state ? m_state->runs.load() : 0; }
+
+private:
+  friend class ThreadPoolExecutor;
+
+  /**
+   * @brief 创建任务的线程池，线程池析构时置空，之后取消任务只设置标记
+   *
+   */
+  struct Owner {
+    std::mutex mtx;
+    ThreadPoolExecutor *pool;
+  };
+
+  struct State {
+    std::atomic_bool cancelled{false};
+    std::atomic<uint64_t> runs{0};
+    std::shared_ptr<Owner> owner;
+  };
+
+  explicit ScheduledHandle(const std::shared_ptr<State> &state) : m_state(state) {}
+
+  std::shared_ptr<State> m_state;
+};
+
 class ThreadPoolExecutor {
   using TaskF = std::function<void()>;
-  using TaskQueue = ThreadSafeDeque<TaskF>;
+  using TaskQueue = ThreadSafeDeque<MoveOnlyTask>;
   using UniLock = std::unique_lock<std::mutex>;
   using LockGuard = std::lock_guard<std::mutex>;
 public:
+  typedef std::chrono::steady_clock Clock;
+
+  /**
+   * @brief 创建固定线程数量的线程池
+   *
+   * @param n_threads 线程数量，为0时使用cpu数量
+   */
   explicit ThreadPoolExecutor(size_t n_threads = 0);
 
+  /**
+   * @brief 创建线程数量可以伸缩的线程池
+   * Start时创建core_threads个线程；所有线程都在忙或者待执行的任务超过阈值时增加线程，最多max_threads个；
+   * 线程数量超过core_threads时，空闲超过keep_alive_ms的线程退出
+   *
+   * @param core_threads 核心线程数量，可以为0
+   * @param max_threads 最大线程数量，为0时使用cpu数量，小于core_threads时等于core_threads
+   * @param keep_alive_ms 多出的线程空闲多久后退出
+   */
+  ThreadPoolExecutor(size_t core_threads, size_t max_threads, uint64_t keep_alive_ms = THREADPOOL_KEEP_ALIVE_MS);
+
   ~ThreadPoolExecutor();
 
-  void SchedulerTask(const TaskF& task);
+  /**
+   * @brief 提交任务
+   *
+   * @return true
+   * @return false 线程池没有启动或者已经停止，任务被丢弃
+   */
+  bool SchedulerTask(const TaskF& task);
+
+  /**
+   * @brief 提交任务，函数和参数都会被移动到线程池中，可以是只能移动的类型
+   *
+   * @param fn 函数
+   * @param args 参数
+   * @return std::future 函数的返回值，线程池已经停止时future中是broken_promise异常
+   */
+  template <typename F, typename... Args>
+  std::future<typename BoundCall<typename std::decay<F>::type, typename std::decay<Args>::type...>::result_type>
+  Submit(F &&fn, Args &&...args) {
+    typedef BoundCall<typename std::decay<F>::type, typename std::decay<Args>::type...> Call;
+    typedef typename Call::result_type R;
+    std::packaged_task<R()> task(Call(std::forward<F>(fn), std::forward<Args>(args)...));
+    std::future<R> fut = task.get_future();
+    Enqueue(MoveOnlyTask(std::move(task)));
+    return fut;
+  }
+
+  /**
+   * @brief 批量提交[begin, end)中的无参函数，只加一次队列锁。传入std::move_iterator时函数会被移走
+   *
+   * @param begin 起始迭代器
+   * @param end 结束迭代器
+   * @return std::vector<std::future> 每个函数的返回值，顺序和输入相同
+   */
+  template <typename Iterator>
+  std::vector<std::future<typename std::result_of<typename std::iterator_traits<Iterator>::value_type()>::type>>
+  SubmitAll(Iterator begin, Iterator end) {
+    typedef typename std::result_of<typename std::iterator_traits<Iterator>::value_type()>::type R;
+    std::vector<std::future<R>> futures;
+    if (m_stopped || m_is_stopping) {
+      return futures;
+    }
+    TaskQueue &queue = TargetQueue();
+    {
+      std::lock_guard<std::mutex> lk(queue.LockRef());
+      for (; begin != end; ++begin) {
+        std::packaged_task<R()> task(*begin);
+        futures.push_back(task.get_future());
+        queue.PushBackUnsafe(MoveOnlyTask(std::move(task)));
+      }
+    }
+    OnTasksAdded(futures.size());
+    return futures;
+  }
+
+  /**
+   * @brief 延迟delay之后在线程池中执行任务
+   * 所有定时任务由一个定时线程按照到期时间排序，到期后放入任务队列，定时线程在第一次提交定时任务时创建
+   *
+   * @param delay 延迟时间
+   * @param task 任务
+   * @return ScheduledHandle 任务的句柄，线程池没有启动或者已经停止时为空句柄
+   */
+  ScheduledHandle ScheduleAfter(std::chrono::milliseconds delay, const TaskF &task);
+
+  /**
+   * @brief 在when时刻之后在线程池中执行任务，when已经过去时尽快执行
+   *
+   * @param when 执行时刻
+   * @param task 任务
+   * @return ScheduledHandle 任务的句柄
+   */
+  ScheduledHandle ScheduleAt(Clock::time_point when, const TaskF &task);
+
+  /**
+   * @brief 延迟initial_delay之后以固定的频率重复执行任务，直到被取消或者线程池停止
+   * 第n次执行的计划时刻是首次时刻加上n个周期，不会因为执行耗时累积偏差；
+   * 同一个任务不会同时执行，上一次执行超过一个周期时下一次在上一次结束后立即执行
+   *
+   * @param initial_delay 首次执行的延迟
+   * @param period 执行周期，必须大于0
+   * @param task 任务
+   * @return ScheduledHandle 任务的句柄
+   */
+  ScheduledHandle ScheduleAtFixedRate(std::chrono::milliseconds initial_delay, std::chrono::milliseconds period,
+                                      const TaskF &task);
+
+  /**
+   * @brief 获取还没有到期的定时任务数量，不包括已经取消的任务
+   *
+   */
+  size_t GetScheduledCount();
 
   void Start();
 
@@ -33,38 +289,202 @@ public:
 
   bool IsStopped() const { return m_stopped; }
 
+  /**
+   * @brief 获取空闲线程从其它线程的队列中偷取任务的次数
+   *
+   */
+  uint64_t GetStealCount() const { return m_steal_cnt.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief 设置增加线程的阈值，待执行的任务数量超过阈值时即使有空闲线程也增加线程，默认为0表示待执行的任务多于线程数量时增加，也就是每个线程都取走一个任务之后仍然有任务在排队
+   *
+   */
+  void SetGrowThreshold(size_t threshold) { m_grow_threshold = threshold; }
+
+  size_t GetCoreThreads() const { return m_core_threads; }
+
+  size_t GetMaxThreads() const { return m_max_threads; }
+
+  /**
+   * @brief 获取当前的线程数量
+   *
+   */
+  size_t GetPoolSize() const { return m_live.load(); }
+
+  /**
+   * @brief 获取线程数量曾经达到的最大值
+   *
+   */
+  size_t GetLargestPoolSize() const { return m_largest.load(); }
+
+  /**
+   * @brief 获取正在执行任务的线程数量
+   *
+   */
+  size_t GetActiveCount() const { return m_active.load(); }
+
+  /**
+   * @brief 获取所有队列中待执行的任务数量
+   *
+   */
+  size_t GetPendingCount() const {
+    int64_t pending = m_pending.load();
+    return pending > 0 ? (size_t) pending : 0;
+  }
+
 private:
+  friend class ScheduledHandle;
+
+  /**
+   * @brief 每个线程自己的任务队列，队尾由自己后进先出地取，队头被其它线程先进先出地偷。
+   * 按照最大线程数量预先创建，线程退出后位置留给之后新建的线程，退出时自己的队列一定为空
+   *
+   */
+  struct Worker {
+    TaskQueue queue;
+    std::thread thread;
+    // 位置上是否有正在运行的线程，由m_mtx保护
+    bool running = false;
+  };
+
+  /**
+   * @brief 定时任务，按照到期时间排序，相同时间的按照提交顺序
+   *
+   */
+  struct TimerEntry : public ScheduledHandle::State {
+    Clock::time_point when;
+    uint64_t seq;
+    // 为0表示只执行一次
+    Clock::duration period;
+    TaskF task;
+    // 以下两个字段由m_timer_mtx保护。是否在堆中；在堆中被取消，函数已经释放
+    bool in_heap = false;
+    bool released = false;
+  };
+
+  typedef std::shared_ptr<TimerEntry> TimerEntryPtr;
+
+  /**
+   * 定时任务堆的比较函数，最早到期的在堆顶，相同时间的先提交的在前
+   */
+  static bool TimerLater(const TimerEntryPtr &a, const TimerEntryPtr &b);
 
   /**
    * 内部线程运行的函数
    */
-  void Runnable();
+  void Runnable(size_t idx);
+
+  /**
+   * 定时线程运行的函数，等待最早的定时任务到期后放入任务队列
+   */
+  void TimerLoop();
+
+  /**
+   * 把定时任务加入堆中，需要时创建定时线程或者唤醒定时线程
+   */
+  bool AddTimer(const TimerEntryPtr &entry);
+
+  /**
+   * 在线程池的线程中执行到期的定时任务，周期任务执行完后重新加入堆中
+   */
+  void RunTimer(const TimerEntryPtr &entry);
+
+  /**
+   * 停止并等待定时线程，丢弃所有没有到期的定时任务
+   */
+  void StopTimerThread();
+
+  /**
+   * 取消还在堆中的定时任务，释放函数，取消的任务过多时整理堆
+   */
+  void CancelTimer(TimerEntry *entry);
+
+  /**
+   * 在空闲的位置上创建一个线程，需要持有m_mtx
+   */
+  bool SpawnWorkerLocked();
+
+  /**
+   * 所有线程都在忙或者任务堆积时，为新加入的n个任务增加最多n个线程
+   */
+  void MaybeGrow(size_t n);
+
+  /**
+   * 依次从自己的队列、无锁队列、公共队列和随机的其它线程的队列中取任务
+   */
+  bool PopTask(size_t idx, MoveOnlyTask &out);
+
+  /**
+   * 新任务放入的队列，在线程池的线程中提交时放入自己的队列，否则放入公共队列
+   */
+  TaskQueue &TargetQueue();
+
+  /**
+   * 增加待执行的任务数量，并且唤醒最多n个空闲线程
+   */
+  void OnTasksAdded(size_t n);
+
+  /**
+   * 放入任务队列，线程池已经停止时丢弃任务并返回false
+   */
+  bool Enqueue(MoveOnlyTask &&task);
 
   /**
    * Wait for the task queue not empty
+   * 多出核心数量的线程空闲超时后返回false，线程退出
    */
-  void WaitForCondition();
+  bool WaitForCondition(size_t idx);
 
   void WaitForTaskDone();
 
   void DetachAllThreads();
 
   /**
-   * notify that task queue is not empty
+   * 唤醒最多n个空闲线程
    */
-  void NotifyCondition();
+  void NotifyCondition(size_t n);
 
 private:
-  // 线程数量
-  size_t m_thread_count;
-  // 线程池中的所有线程
-  std::vector<std::thread> m_threads;
+  // 核心线程数量
+  size_t m_core_threads;
+  // 最大线程数量
+  size_t m_max_threads;
+  // 多出的线程空闲多久后退出
+  uint64_t m_keep_alive_ms;
+  // 待执行的任务超过这个数量时增加线程
+  size_t m_grow_threshold = 0;
   // 锁
   std::mutex m_mtx;
   // 条件变脸，检查任务队列是否为空
   std::condition_variable m_cv;
-  // 任务队列
+  // 不在线程池的线程中提交的任务先放入这个无锁队列
+  MpmcQueue<MoveOnlyTask> m_inbound;
+  // 公共任务队列，无锁队列满了以后和批量提交的任务放在这里
   TaskQueue m_tasks_queue;
+  // 每个线程的任务队列
+  std::vector<std::unique_ptr<Worker>> m_workers;
+  // 所有队列中待执行的任务数量
+  std::atomic<int64_t> m_pending{0};
+  // 在条件变量上等待的线程数量
+  std::atomic<size_t> m_sleeping{0};
+  // 当前的线程数量，修改时持有m_mtx
+  std::atomic<size_t> m_live{0};
+  // 线程数量曾经达到的最大值
+  std::atomic<size_t> m_largest{0};
+  // 正在执行任务的线程数量
+  std::atomic<size_t> m_active{0};
+  // 偷取任务的次数
+  std::atomic<uint64_t> m_steal_cnt{0};
+  // 定时任务的小顶堆和保护它的锁
+  std::mutex m_timer_mtx;
+  std::condition_variable m_timer_cv;
+  std::vector<TimerEntryPtr> m_timers;
+  // 堆中已经取消但还没有移除的任务数量
+  size_t m_cancelled_timers = 0;
+  std::shared_ptr<ScheduledHandle::Owner> m_timer_owner;
+  uint64_t m_timer_seq = 0;
+  std::thread m_timer_thread;
+  bool m_timer_stopping = false;
   std::atomic_bool m_stopped;
   std::atomic_bool m_is_stopping;
   // 开始标记
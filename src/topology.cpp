@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+#include "topology.h"
+#include "utils.h"
+
+namespace ahri {
+
+static bool ReadSysfsLine(const std::string &filename, std::string &out) {
+  std::ifstream ifs;
+  if (!FileUtils::OpenForRead(ifs, filename, std::ios_base::in)) {
+    return false;
+  }
+  std::getline(ifs, out);
+  out = StringUtils::Trim(out);
+  return true;
+}
+
+static int ReadSysfsInt(const std::string &filename, int def = -1) {
+  std::string line;
+  if (!ReadSysfsLine(filename, line) || line.empty()) {
+    return def;
+  }
+  return atoi(line.c_str());
+}
+
+const CpuTopology &CpuTopology::Get() {
+  static CpuTopology topology;
+  static bool loaded = (topology.Load(), true);
+  (void) loaded;
+  return topology;
+}
+
+void CpuTopology::Load(const std::string &sysfs_root) {
+  m_cpus.clear();
+  m_isolated.clear();
+  std::string online;
+  if (!ReadSysfsLine(sysfs_root + "/online", online)) {
+    return;
+  }
+  for (int cpu : ParseCpuList(online)) {
+    std::string dir = sysfs_root + "/cpu" + std::to_string(cpu);
+    CpuInfo info;
+    info.cpu = cpu;
+    info.core_id = ReadSysfsInt(dir + "/topology/core_id");
+    info.package_id = ReadSysfsInt(dir + "/topology/physical_package_id");
+    std::string siblings;
+    if (ReadSysfsLine(dir + "/topology/thread_siblings_list", siblings)) {
+      info.siblings = ParseCpuList(siblings);
+    }
+    if (info.siblings.empty()) {
+      info.siblings.push_back(cpu);
+    }
+    // 在各级缓存中找到L3
+    for (int idx = 0;; ++idx) {
+      std::string cache_dir = dir + "/cache/index" + std::to_string(idx);
+      int level = ReadSysfsInt(cache_dir + "/level");
+      if (level < 0) {
+        break;
+      }
+      std::string shared;
+      if (level == 3 && ReadSysfsLine(cache_dir + "/shared_cpu_list", shared)) {
+        std::vector<int> shared_cpus = ParseCpuList(shared);
+        if (!shared_cpus.empty()) {
+          info.l3_id = *std::min_element(shared_cpus.begin(), shared_cpus.end());
+        }
+        break;
+      }
+    }
+    m_cpus.push_back(info);
+  }
+  std::string isolated;
+  if (ReadSysfsLine(sysfs_root + "/isolated", isolated)) {
+    m_isolated = ParseCpuList(isolated);
+  }
+}
+
+int CpuTopology::GetL3Id(int cpu) const {
+  for (auto &info : m_cpus) {
+    if (info.cpu == cpu) {
+      return info.l3_id;
+    }
+  }
+  return -1;
+}
+
+std::vector<int> CpuTopology::PickCpus(size_t n, const std::vector<int> &allowed) const {
+  std::vector<const CpuInfo *> candidates;
+  for (auto &info : m_cpus) {
+    if (allowed.empty() || std::find(allowed.begin(), allowed.end(), info.cpu) != allowed.end()) {
+      candidates.push_back(&info);
+    }
+  }
+  // 按照L3、物理核排序，保证相邻的执行器尽量共享L3
+  std::stable_sort(candidates.begin(), candidates.end(),
+                   [](const CpuInfo *a, const CpuInfo *b) {
+                     if (a->l3_id != b->l3_id) {
+                       return a->l3_id < b->l3_id;
+                     }
+                     if (a->package_id != b->package_id) {
+                       return a->package_id < b->package_id;
+                     }
+                     return a->core_id < b->core_id;
+                   });
+  // 第一轮每个物理核只取一个cpu，剩下的SMT兄弟放到第二轮
+  std::vector<int> primary;
+  std::vector<int> secondary;
+  std::set<std::pair<int, int>> used_cores;
+  for (auto info : candidates) {
+    if (used_cores.insert(std::make_pair(info->package_id, info->siblings.front())).second) {
+      primary.push_back(info->cpu);
+    } else {
+      secondary.push_back(info->cpu);
+    }
+  }
+  primary.insert(primary.end(), secondary.begin(), secondary.end());
+  std::vector<int> ans;
+  if (primary.empty()) {
+    return ans;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    ans.push_back(primary[i % primary.size()]);
+  }
+  return ans;
+}
+
+std::vector<int> CpuTopology::ParseCpuList(const std::string &str) {
+  std::vector<int> ans;
+  std::stringstream ss(str);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    item = StringUtils::Trim(item);
+    if (item.empty()) {
+      continue;
+    }
+    auto dash = item.find('-');
+    if (dash == std::string::npos) {
+      ans.push_back(atoi(item.c_str()));
+    } else {
+      int first = atoi(item.substr(0, dash).c_str());
+      int last = atoi(item.substr(dash + 1).c_str());
+      for (int cpu = first; cpu <= last; ++cpu) {
+        ans.push_back(cpu);
+      }
+    }
+  }
+  return ans;
+}
+
+} // namespace src
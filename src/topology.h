@@ -0,0 +1,89 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace ahri {
+
+/**
+ * @brief 单个逻辑cpu的拓扑信息
+ *
+ */
+struct CpuInfo {
+  // 逻辑cpu编号
+  int cpu = -1;
+  // 物理核编号(同一个package内唯一)
+  int core_id = -1;
+  // 物理cpu编号
+  int package_id = -1;
+  // 共享L3缓存的id，取共享该L3缓存的最小cpu编号；没有L3缓存时为-1
+  int l3_id = -1;
+  // 同一个物理核上的SMT兄弟(包括自己)
+  std::vector<int> siblings;
+};
+
+/**
+ * @brief 从sysfs中读取的cpu拓扑
+ *
+ */
+class CpuTopology {
+public:
+  /**
+   * @brief 获取当前机器的cpu拓扑，第一次调用时从sysfs中加载
+   *
+   * @return const CpuTopology&
+   */
+  static const CpuTopology &Get();
+
+  /**
+   * @brief 从指定的sysfs路径加载拓扑，读取失败的cpu会被忽略
+   *
+   * @param sysfs_root 默认为/sys/devices/system/cpu
+   */
+  void Load(const std::string &sysfs_root = "/sys/devices/system/cpu");
+
+  const std::vector<CpuInfo> &Cpus() const { return m_cpus; }
+
+  size_t CpuCount() const { return m_cpus.size(); }
+
+  /**
+   * @brief 获取cpu所在的L3缓存id
+   *
+   * @param cpu 逻辑cpu编号
+   * @return int L3缓存id，未知时返回-1
+   */
+  int GetL3Id(int cpu) const;
+
+  /**
+   * @brief 获取内核启动参数isolcpus隔离出来的cpu
+   *
+   * @return const std::vector<int>&
+   */
+  const std::vector<int> &IsolatedCpus() const { return m_isolated; }
+
+  /**
+   * @brief 为n个执行器挑选cpu
+   * 先在每个物理核上选一个cpu，物理核用完之后再使用SMT兄弟；
+   * 同一个L3缓存下的cpu排在一起，方便相邻的执行器共享L3缓存。
+   * n大于可选cpu数量时循环使用
+   *
+   * @param n 需要的cpu数量
+   * @param allowed 只从这些cpu中挑选，为空表示可以使用所有cpu
+   * @return std::vector<int> 挑选的cpu编号，没有可用cpu时为空
+   */
+  std::vector<int> PickCpus(size_t n, const std::vector<int> &allowed = std::vector<int>()) const;
+
+  /**
+   * @brief 解析sysfs中的cpu列表格式，如"0-3,8,10-11"
+   *
+   * @param str
+   * @return std::vector<int>
+   */
+  static std::vector<int> ParseCpuList(const std::string &str);
+
+private:
+  std::vector<CpuInfo> m_cpus;
+  std::vector<int> m_isolated;
+};
+
+} // namespace src
@@ -73,6 +73,15 @@ uint64_t GetCurrentUs() {
   return tv.tv_sec * 1000 * 1000ul + tv.tv_usec;
 }
 
+uint64_t FastRand() {
+  // xorshift64*，每个线程使用不同的种子
+  static thread_local uint64_t state = GetCurrentUs() ^ ((uint64_t) GetThreadId() << 32) ^ 0x9E3779B97F4A7C15ull;
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return state * 0x2545F4914F6CDD1Dull;
+}
+
 std::string StringUtils::RightTrim(const std::string &str, const std::string &delim) {
   auto end = str.find_last_not_of(delim);
   if (end == std::string::npos) {
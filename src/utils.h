@@ -118,6 +118,13 @@ uint64_t GetCurrentMs();
  */
 uint64_t GetCurrentUs();
 
+/**
+ * @brief 线程局部的快速随机数，不会像rand()一样争抢全局锁
+ *
+ * @return uint64_t
+ */
+uint64_t FastRand();
+
 /**
  * @brief 字符串帮助类
  * 
@@ -0,0 +1,96 @@
+#include <atomic>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+#include "blocking.hpp"
+
+using namespace ahri;
+
+// 阻塞调用在线程池中执行，执行器继续执行其它协程
+void test_run_blocking() {
+  CoExecutor exec(1);
+  std::atomic<bool> done{false};
+  exec.AddTask(std::function<void()>([&done]() {
+    uint64_t begin = GetCurrentUs();
+    int value = this_coroutine::RunBlocking([]() {
+      usleep(100 * 1000);
+      return 42;
+    });
+    std::cout << "BLOCKING result = " << value << " after " << (GetCurrentUs() - begin) / 1000
+              << "ms in thread-" << GetThreadId() << std::endl;
+    try {
+      this_coroutine::RunBlocking([]() { throw std::runtime_error("legacy client failed"); });
+    } catch (const std::exception &ex) {
+      std::cout << "BLOCKING caught: " << ex.what() << std::endl;
+    }
+    done = true;
+  }));
+  exec.AddTask(std::function<void()>([&done]() {
+    int ticks = 0;
+    while (!done) {
+      ++ticks;
+      CoExecutor::HoldFor(std::chrono::microseconds(10 * 1000));
+    }
+    std::cout << "TICKER ran " << ticks << " times while the blocking call was running" << std::endl;
+  }));
+  exec.Process(200);
+}
+
+// 等待中的协程被取消后继续挂起，执行器不被阻塞，函数完成后仍然返回结果
+void test_cancelled() {
+  CoExecutor exec(1);
+  std::atomic<bool> done{false};
+  CancellationToken token = CancellationToken::Create();
+  exec.AddTask(std::function<void()>([&done, token]() {
+    TaskPtr tk = CoExecutor::GetCurrentTask();
+    tk->token = token;
+    int value = this_coroutine::RunBlocking([]() {
+      usleep(100 * 1000);
+      return 42;
+    });
+    tk->token = CancellationToken();
+    std::cout << "CANCELLED result = " << value << " (expected 42)" << std::endl;
+    done = true;
+  }));
+  exec.AddTask(std::function<void()>([&done]() {
+    int ticks = 0;
+    while (!done) {
+      ++ticks;
+      CoExecutor::HoldFor(std::chrono::microseconds(10 * 1000));
+    }
+    std::cout << "TICKER ran " << ticks << " times after the waiting task was cancelled" << std::endl;
+  }));
+  std::thread canceller([token]() mutable {
+    usleep(20 * 1000);
+    token.Cancel();
+  });
+  exec.Process(200);
+  canceller.join();
+}
+
+// 线程池已经停止时立刻失败
+void test_stopped_pool() {
+  ThreadPoolExecutor pool(1);
+  pool.Start();
+  pool.Stop();
+  CoExecutor exec(1);
+  exec.AddTask(std::function<void()>([&pool]() {
+    uint64_t begin = GetCurrentUs();
+    try {
+      this_coroutine::RunBlocking(pool, []() { return 0; });
+      std::cout << "STOPPED POOL: no error" << std::endl;
+    } catch (const std::exception &ex) {
+      std::cout << "STOPPED POOL caught: " << ex.what() << " after " << (GetCurrentUs() - begin) / 1000 << "ms"
+                << std::endl;
+    }
+  }));
+  exec.Process(50);
+}
+
+int main() {
+  test_run_blocking();
+  test_cancelled();
+  test_stopped_pool();
+  return 0;
+}
@@ -0,0 +1,62 @@
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "channel.hpp"
+
+using namespace ahri;
+
+#define N_MESSAGES 1000000
+#define BATCH_SIZE 256
+
+// 外部线程批量发送，消费者协程在通道为空时挂起，同一个执行器中的其它协程继续执行
+void test_spsc_channel() {
+  CoExecutor exec(1);
+  SpscChannel<uint64_t> channel(1024);
+  std::atomic<bool> done{false};
+  std::thread producer([&channel]() {
+    usleep(50 * 1000);
+    std::vector<uint64_t> batch;
+    for (uint64_t i = 1; i <= N_MESSAGES; ++i) {
+      batch.push_back(i);
+      if (batch.size() == BATCH_SIZE || i == N_MESSAGES) {
+        channel.PushBatch(batch.begin(), batch.end());
+        batch.clear();
+      }
+    }
+    channel.Close();
+  });
+  exec.AddTask(std::function<void()>([&channel, &done]() {
+    uint64_t begin = GetCurrentUs();
+    uint64_t sum = 0;
+    uint64_t count = 0;
+    std::vector<uint64_t> buf(BATCH_SIZE);
+    size_t n;
+    while ((n = channel.PopBatch(buf.begin(), buf.size())) > 0) {
+      for (size_t i = 0; i < n; ++i) {
+        sum += buf[i];
+      }
+      count += n;
+    }
+    std::cout << "CHANNEL received = " << count << ", sum = " << sum << " (expected "
+              << (uint64_t) N_MESSAGES * (N_MESSAGES + 1) / 2 << ") in " << (GetCurrentUs() - begin) / 1000
+              << "ms, wakeups = " << channel.GetWakeupCount() << std::endl;
+    done = true;
+  }));
+  exec.AddTask(std::function<void()>([&done]() {
+    int ticks = 0;
+    while (!done) {
+      ++ticks;
+      CoExecutor::HoldFor(std::chrono::microseconds(10 * 1000));
+    }
+    std::cout << "TICKER ran " << (ticks > 0 ? "while" : "NOT while") << " the consumer was parked" << std::endl;
+  }));
+  exec.Process(200);
+  producer.join();
+}
+
+int main() {
+  test_spsc_channel();
+  return 0;
+}
@@ -34,11 +34,11 @@ void co_func3() {
 void coexec_test() {
   std::cout << "Coexec test\n";
   auto co1 =
-      std::make_shared<CoExecutor::CoTask>(std::function<void()>(co_func1));
+      MakeIntrusive<CoExecutor::CoTask>(std::function<void()>(co_func1));
   auto co2 =
-      std::make_shared<CoExecutor::CoTask>(std::function<void()>(co_func2));
+      MakeIntrusive<CoExecutor::CoTask>(std::function<void()>(co_func2));
   auto co3 =
-      std::make_shared<CoExecutor::CoTask>(std::function<void()>(co_func3));
+      MakeIntrusive<CoExecutor::CoTask>(std::function<void()>(co_func3));
   executor->AddTask(co1);
   executor->AddTask(co2);
   executor->AddTask(co3);
@@ -46,11 +46,11 @@ void coexec_test() {
 
 void test_batch_add_task() {
   auto co1 =
-      std::make_shared<CoExecutor::CoTask>(std::function<void()>(co_func1));
+      MakeIntrusive<CoExecutor::CoTask>(std::function<void()>(co_func1));
   auto co2 =
-      std::make_shared<CoExecutor::CoTask>(std::function<void()>(co_func2));
+      MakeIntrusive<CoExecutor::CoTask>(std::function<void()>(co_func2));
   auto co3 =
-      std::make_shared<CoExecutor::CoTask>(std::function<void()>(co_func3));
+      MakeIntrusive<CoExecutor::CoTask>(std::function<void()>(co_func3));
   std::vector<CoExecutor::CoTaskPtr> tasks{co1, co2, co3};
   executor->AddTask(tasks.begin(), tasks.end());
 }
@@ -62,6 +62,59 @@ void task1() {
   // }
 }
 
+// 测试取消令牌和截止时间
+void test_hold_cancel_and_deadline() {
+  CoExecutor exec(1);
+  CancellationToken token = CancellationToken::Create();
+  auto co1 = MakeIntrusive<CoExecutor::CoTask>(std::function<void()>([]() {
+    CoExecutor::RecoveryEntry e;
+    auto ret = CoExecutor::Hold(e);
+    std::cout << "co1 hold returned " << ret << " (expect CANCELLED=" << CoExecutor::CANCELLED << ")\n";
+  }));
+  co1->token = token;
+  auto co2 = MakeIntrusive<CoExecutor::CoTask>(std::function<void()>([]() {
+    CoExecutor::RecoveryEntry e;
+    auto ret = CoExecutor::Hold(e);
+    std::cout << "co2 hold returned " << ret << " (expect TIMEDOUT=" << CoExecutor::TIMEDOUT << ")\n";
+  }));
+  co2->deadline_us = GetCurrentUs() + 50 * 1000;
+  auto co3 = MakeIntrusive<CoExecutor::CoTask>(std::function<void()>([token]() mutable {
+    auto begin = GetCurrentMs();
+    auto ret = CoExecutor::HoldFor(std::chrono::milliseconds(20));
+    std::cout << "co3 hold for " << GetCurrentMs() - begin << "ms returned " << ret << "\n";
+    token.Cancel();
+  }));
+  exec.AddTask(co1);
+  exec.AddTask(co2);
+  exec.AddTask(co3);
+  exec.Process(200);
+}
+
+// 测试时间片让出
+void test_maybe_yield() {
+  CoExecutor exec(2);
+  exec.SetTimeSlice(1000);
+  auto busy = [](const char *name) {
+    return std::function<void()>([name]() {
+      uint64_t yields = 0;
+      uint64_t begin = GetCurrentUs();
+      while (GetCurrentUs() - begin < 20 * 1000) {
+        if (this_coroutine::MaybeYield()) {
+          ++yields;
+        }
+      }
+      std::cout << name << " yielded " << yields << " time(s) in 20ms\n";
+    });
+  };
+  auto co1 = MakeIntrusive<CoExecutor::CoTask>(busy("busy-1ms"));
+  auto co2 = MakeIntrusive<CoExecutor::CoTask>(busy("busy-5ms"));
+  co2->time_slice_us = 5000;
+  exec.AddTask(co1);
+  exec.AddTask(co2);
+  exec.Process(100);
+  std::cout << "Executor preempted " << exec.GetPreemptCount() << " time(s)\n";
+}
+
 void coexec_test_with_thread_add_task() {
   Thread t1([&]() { executor->Process(); }, "ProcessThread");
 
@@ -82,11 +135,214 @@ void coexec_test_with_thread_add_task() {
   t2.Join();
 }
 
+// 测试EDF模式下按照截止时间执行
+void test_edf_queue() {
+  CoExecutor exec(3);
+  exec.SetQueueMode(CoExecutor::EDF_QUEUE, CoExecutor::LATE_DROP);
+  uint64_t now = GetCurrentUs();
+  auto make_task = [](const std::string &name, uint64_t deadline_us) {
+    auto tk = MakeIntrusive<CoExecutor::CoTask>(std::function<void()>([name]() {
+      std::cout << "EDF run " << name << std::endl;
+      uint64_t begin = GetCurrentUs();
+      while (GetCurrentUs() - begin < 4000) {
+      }
+    }));
+    tk->deadline_us = deadline_us;
+    return tk;
+  };
+  // 按照截止时间倒序加入
+  exec.AddTask(make_task("best-effort", 0));
+  exec.AddTask(make_task("deadline+30ms", now + 30 * 1000));
+  exec.AddTask(make_task("deadline+20ms", now + 20 * 1000));
+  exec.AddTask(make_task("deadline+5ms", now + 5 * 1000));
+  exec.AddTask(make_task("already-late", now - 1000));
+  // 排在deadline+5ms之后执行，完成时已经超过了截止时间
+  exec.AddTask(make_task("deadline+7ms", now + 7 * 1000));
+  exec.Process(100);
+  std::cout << "Deadlines met = " << exec.GetDeadlineMetCount()
+            << ", missed = " << exec.GetDeadlineMissedCount()
+            << ", dropped = " << exec.GetDeadlineDroppedCount() << std::endl;
+}
+
+// 测试队列上限和排队超时丢弃
+void test_admission_control() {
+  auto noop = []() { return std::function<void()>([]() {}); };
+  {
+    CoExecutor exec(4);
+    exec.SetQueueLimit(4, CoExecutor::OVERFLOW_REJECT);
+    int admitted = 0;
+    for (int i = 0; i < 10; ++i) {
+      admitted += exec.AddTask(noop()) ? 1 : 0;
+    }
+    std::cout << "REJECT: admitted = " << admitted << ", rejected = " << exec.GetRejectedCount() << std::endl;
+    exec.Process(50);
+  }
+  {
+    CoExecutor exec(5);
+    exec.SetQueueLimit(4, CoExecutor::OVERFLOW_DROP_OLDEST);
+    for (int i = 0; i < 10; ++i) {
+      exec.AddTask(std::function<void()>([i]() { std::cout << "DROP_OLDEST: task-" << i << " ran\n"; }));
+    }
+    std::cout << "DROP_OLDEST: shed = " << exec.GetShedCount() << std::endl;
+    exec.Process(50);
+  }
+  {
+    CoExecutor exec(6);
+    exec.SetMaxQueueTime(5 * 1000);
+    for (int i = 0; i < 10; ++i) {
+      exec.AddTask(noop());
+    }
+    usleep(10 * 1000);
+    exec.AddTask(std::function<void()>([]() { std::cout << "QUEUE_TIME: fresh task ran\n"; }));
+    exec.Process(50);
+    std::cout << "QUEUE_TIME: shed = " << exec.GetShedCount() << std::endl;
+  }
+  {
+    // 生产者线程被阻塞，执行器取走任务后继续添加
+    CoExecutor exec(7);
+    exec.SetQueueLimit(2, CoExecutor::OVERFLOW_BLOCK);
+    Thread producer([&exec]() {
+      uint64_t begin = GetCurrentUs();
+      for (int i = 0; i < 10; ++i) {
+        exec.AddTask(std::function<void()>([]() { usleep(1000); }));
+      }
+      std::cout << "BLOCK: producer blocked for " << (GetCurrentUs() - begin) / 1000 << "ms" << std::endl;
+    });
+    exec.Process(100);
+    producer.Join();
+    std::cout << "BLOCK: switched = " << exec.GetSwitchCount() << ", rejected = "
+              << exec.GetRejectedCount() << std::endl;
+  }
+  {
+    // 已经被取消的生产者协程向自己所在的执行器添加任务，队列满时直接拒绝而不是一直重试
+    CoExecutor exec(7);
+    exec.SetQueueLimit(2, CoExecutor::OVERFLOW_BLOCK);
+    CancellationToken token = CancellationToken::Create();
+    token.Cancel();
+    TaskPtr producer = MakeIntrusive<CoExecutor::CoTask>(std::function<void()>([&exec]() {
+      int admitted = 0;
+      for (int i = 0; i < 10; ++i) {
+        admitted += exec.AddTask(std::function<void()>([]() {})) ? 1 : 0;
+      }
+      std::cout << "BLOCK CANCELLED: admitted = " << admitted << ", rejected = " << exec.GetRejectedCount()
+                << std::endl;
+    }));
+    producer->token = token;
+    exec.AddTask(producer);
+    uint64_t begin = GetCurrentUs();
+    exec.Process(50);
+    std::cout << "BLOCK CANCELLED: Process returned after " << (GetCurrentUs() - begin) / 1000 << "ms" << std::endl;
+  }
+}
+
+// 测试在其它线程中批量唤醒挂起的任务
+void test_remote_wakeup() {
+  CoExecutor exec(8);
+  const int n = 100;
+  std::vector<CoExecutor::RecoveryEntry> entries(n);
+  std::atomic<int> held{0};
+  std::atomic<int> resumed{0};
+  for (int i = 0; i < n; ++i) {
+    exec.AddTask(std::function<void()>([i, &entries, &held, &resumed]() {
+      held.fetch_add(1);
+      CoExecutor::Hold(entries[i]);
+      resumed.fetch_add(1);
+    }));
+  }
+  Thread waker([&entries, &held]() {
+    while (held.load() < n) {
+      usleep(1000);
+    }
+    // 等待执行器进入等待状态后再一起唤醒
+    usleep(10 * 1000);
+    for (auto &entry : entries) {
+      CoExecutor::Wakeup(entry);
+    }
+  });
+  exec.Process(100);
+  waker.Join();
+  std::cout << "REMOTE WAKEUP: resumed = " << resumed.load() << ", doorbells = "
+            << exec.GetDoorbellCount() << std::endl;
+}
+
+// 挂起一个任务，在其它线程中检查入口后唤醒，返回时任务已经结束
+static void hold_and_wakeup(int32_t id, CoExecutor::RecoveryEntry &entry, const CoExecutor::RecoveryEntry &stale) {
+  CoExecutor exec(id);
+  std::atomic<bool> held{false};
+  exec.AddTask(std::function<void()>([&entry, &held]() {
+    held.store(true);
+    CoExecutor::Hold(entry);
+  }));
+  Thread waker([&entry, &held, &stale]() {
+    while (!held.load()) {
+      usleep(1000);
+    }
+    usleep(10 * 1000);
+    std::cout << "STALE: entry valid while held = " << (bool) entry << ", old entry valid = " << (bool) stale
+              << ", old entry wakes = " << CoExecutor::Wakeup(stale) << std::endl;
+    CoExecutor::Wakeup(entry);
+  });
+  exec.Process(50);
+  waker.Join();
+}
+
+// 测试任务结束后恢复入口失效，槽位复用后旧的入口也不会唤醒新的任务
+void test_stale_entry() {
+  CoExecutor::RecoveryEntry first;
+  CoExecutor::RecoveryEntry second;
+  hold_and_wakeup(9, first, CoExecutor::RecoveryEntry());
+  std::cout << "STALE: entry valid after task freed = " << (bool) first << ", wakeup = " << CoExecutor::Wakeup(first)
+            << std::endl;
+  hold_and_wakeup(10, second, first);
+  std::cout << "STALE: same slot = " << ((uint32_t) first.handle == (uint32_t) second.handle)
+            << ", same handle = " << (first == second) << std::endl;
+  // 同一个任务已经被唤醒的入口不会唤醒它之后的挂起
+  CoExecutor exec(11);
+  CoExecutor::RecoveryEntry earlier;
+  std::atomic<bool> holding_again{false};
+  exec.AddTask(std::function<void()>([&earlier, &holding_again]() {
+    CoExecutor::HoldThen(earlier, [&earlier]() { CoExecutor::Wakeup(earlier); });
+    uint64_t begin = GetCurrentUs();
+    holding_again = true;
+    CoExecutor::HoldResult ret = CoExecutor::HoldFor(std::chrono::microseconds(200 * 1000));
+    std::cout << "STALE: second hold result = " << ret << " (0 = AWOKEN) after " << (GetCurrentUs() - begin) / 1000
+              << "ms (expected 200ms)" << std::endl;
+  }));
+  Thread waker([&earlier, &holding_again]() {
+    while (!holding_again.load()) {
+      usleep(1000);
+    }
+    usleep(50 * 1000);
+    std::cout << "STALE: entry of an earlier hold valid = " << (bool) earlier
+              << ", wakes the live task = " << CoExecutor::Wakeup(earlier) << std::endl;
+  });
+  exec.Process(300);
+  waker.Join();
+}
+
 int main() {
   coexec_test();
   std::cout
       << "---------------------------------------------------------------\n";
   test_batch_add_task();
+  std::cout
+      << "---------------------------------------------------------------\n";
+  test_hold_cancel_and_deadline();
+  std::cout
+      << "---------------------------------------------------------------\n";
+  test_maybe_yield();
+  std::cout
+      << "---------------------------------------------------------------\n";
+  test_edf_queue();
+  std::cout
+      << "---------------------------------------------------------------\n";
+  test_admission_control();
+  std::cout
+      << "---------------------------------------------------------------\n";
+  test_remote_wakeup();
+  std::cout
+      << "---------------------------------------------------------------\n";
+  test_stale_entry();
   std::cout
       << "---------------------------------------------------------------\n";
   coexec_test_with_thread_add_task();
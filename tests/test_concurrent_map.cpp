@@ -0,0 +1,147 @@
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "concurrent_map.hpp"
+
+using namespace ahri;
+
+#define BENCH_KEYS 65536
+#define BENCH_OPS 1000000
+#define BENCH_MAX_THREADS 8
+// 每多少次操作中有一次写
+#define BENCH_WRITE_EVERY 10
+
+// 测试基本操作
+void test_basic() {
+  ConcurrentHashMap<std::string, int> map;
+  map.Insert("a", 1);
+  map.Insert("b", 2);
+  bool dup = map.Insert("a", 100);
+  map.InsertOrAssign("b", 20);
+  map.Update("a", [](int &v) { v += 10; });
+  int c = map.Upsert("c", 0, [](int &v) { v += 3; });
+  int a = 0;
+  int b = 0;
+  map.Find("a", a);
+  map.Find("b", b);
+  map.Erase("c");
+  int sum = 0;
+  map.ForEach([&sum](const std::string &, const int &v) { sum += v; });
+  std::cout << "MAP a = " << a << ", b = " << b << ", c = " << c << ", duplicate inserted = " << dup
+            << ", size = " << map.Size() << ", sum = " << sum << ", shards = " << map.ShardCount() << std::endl;
+}
+
+// 线程长时间持有分片的写锁，协程写同一个key时挂起，执行器继续执行其它协程
+void test_coroutine_hold() {
+  ConcurrentHashMap<int, int> map;
+  map.Insert(1, 0);
+  std::atomic<bool> locked{false};
+  std::atomic<bool> done{false};
+  std::thread owner([&map, &locked]() {
+    map.Update(1, [&locked](int &v) {
+      locked = true;
+      usleep(100 * 1000);
+      v += 1;
+    });
+  });
+  while (!locked) {
+    usleep(1000);
+  }
+  CoExecutor exec(1);
+  exec.AddTask(std::function<void()>([&map, &done]() {
+    uint64_t begin = GetCurrentUs();
+    int v = map.Upsert(1, 0, [](int &x) { x += 10; });
+    std::cout << "MAP coroutine writer got " << v << " after " << (GetCurrentUs() - begin) / 1000 << "ms"
+              << std::endl;
+    done = true;
+  }));
+  exec.AddTask(std::function<void()>([&done]() {
+    int ticks = 0;
+    while (!done) {
+      ++ticks;
+      CoExecutor::HoldFor(std::chrono::microseconds(10 * 1000));
+    }
+    std::cout << "TICKER ran " << (ticks > 0 ? "while" : "NOT while") << " the writer was held" << std::endl;
+  }));
+  exec.Process(200);
+  owner.join();
+}
+
+// 读写锁保护的std::unordered_map
+struct LockedMap {
+  RWMutex mtx;
+  std::unordered_map<uint64_t, uint64_t> map;
+
+  bool Find(uint64_t key, uint64_t &out) {
+    RdLockGuard lk(mtx);
+    auto it = map.find(key);
+    if (it == map.end()) {
+      return false;
+    }
+    out = it->second;
+    return true;
+  }
+
+  void InsertOrAssign(uint64_t key, uint64_t value) {
+    WrLockGuard lk(mtx);
+    map[key] = value;
+  }
+};
+
+struct ShardedMap {
+  ConcurrentHashMap<uint64_t, uint64_t> map;
+
+  bool Find(uint64_t key, uint64_t &out) { return map.Find(key, out); }
+
+  void InsertOrAssign(uint64_t key, uint64_t value) { map.InsertOrAssign(key, value); }
+};
+
+template <typename Map>
+void bench_map(const std::string &name, size_t n_threads) {
+  Map map;
+  for (uint64_t k = 0; k < BENCH_KEYS; ++k) {
+    map.InsertOrAssign(k, k);
+  }
+  std::vector<std::thread> threads;
+  uint64_t begin = GetCurrentUs();
+  for (size_t t = 0; t < n_threads; ++t) {
+    threads.emplace_back([&map, t, n_threads]() {
+      uint64_t key = t * 7919;
+      uint64_t v = 0;
+      for (size_t i = 0; i < BENCH_OPS / n_threads; ++i) {
+        key = (key * 6364136223846793005ull + 1442695040888963407ull) % BENCH_KEYS;
+        if (i % BENCH_WRITE_EVERY == 0) {
+          map.InsertOrAssign(key, i);
+        } else {
+          map.Find(key, v);
+        }
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  double rate = BENCH_OPS * 1e6 / (GetCurrentUs() - begin);
+  printf("%-16s threads = %zu, %10.0f ops/s\n", name.c_str(), n_threads, rate);
+}
+
+void bench_maps() {
+  for (size_t n = 1; n <= BENCH_MAX_THREADS; n *= 2) {
+    bench_map<LockedMap>("rwmutex+map", n);
+    bench_map<ShardedMap>("concurrent-map", n);
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && std::string(argv[1]) == "bench") {
+    bench_maps();
+    return 0;
+  }
+  test_basic();
+  test_coroutine_hold();
+  return 0;
+}
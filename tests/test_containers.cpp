@@ -1,8 +1,227 @@
 #include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 #include "containers.hpp"
+#include "thread.h"
+#include "utils.h"
 using namespace ahri;
 
-int main() {
+#define BENCH_ITEMS 1000000
+#define BENCH_MAX_THREADS 8
+#define BENCH_SPSC_ITEMS 100000000ull
+#define BENCH_SPSC_BATCH 64
+
+// 测试有界无锁队列的基本操作和多线程下每个元素只被取出一次
+void test_mpmc() {
+  MpmcQueue<std::unique_ptr<int>> q(5);
+  std::cout << "MPMC capacity = " << q.Capacity() << std::endl;
+  int pushed = 0;
+  while (q.TryPush(std::unique_ptr<int>(new int(pushed)))) {
+    ++pushed;
+  }
+  std::unique_ptr<int> out;
+  q.TryPop(out);
+  std::cout << "MPMC pushed = " << pushed << ", first = " << *out << ", size = " << q.Size() << std::endl;
+
+  std::vector<int> batch{100, 101, 102, 103};
+  MpmcQueue<int> ints(4);
+  ints.TryPush(1);
+  size_t n_pushed = ints.TryPushBatch(batch.begin(), batch.end());
+  std::vector<int> popped;
+  size_t n_popped = ints.TryPopBatch(std::back_inserter(popped), 10);
+  std::cout << "MPMC batch pushed = " << n_pushed << ", popped = " << n_popped << ":";
+  for (int v : popped) {
+    std::cout << " " << v;
+  }
+  std::cout << std::endl;
+
+  // 4个生产者4个消费者，所有取出的元素之和应该等于放入的
+  MpmcQueue<uint64_t> shared(64);
+  std::atomic<uint64_t> sum{0};
+  std::atomic<uint64_t> consumed{0};
+  std::vector<std::thread> threads;
+  for (int p = 0; p < 4; ++p) {
+    threads.emplace_back([&shared]() {
+      for (uint64_t i = 1; i <= 100000; ++i) {
+        while (!shared.TryPush(i)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (int c = 0; c < 4; ++c) {
+    threads.emplace_back([&shared, &sum, &consumed]() {
+      uint64_t v;
+      while (consumed.load() < 400000) {
+        if (shared.TryPop(v)) {
+          sum.fetch_add(v);
+          consumed.fetch_add(1);
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  std::cout << "MPMC sum = " << sum.load() << ", expected = " << 4ull * 100000 * 100001 / 2 << std::endl;
+}
+
+// 测试批量操作移动元素，shared_ptr的引用计数不变
+void test_bulk_moves() {
+  std::shared_ptr<int> item = std::make_shared<int>(7);
+  ThreadSafeDeque<std::shared_ptr<int>> src;
+  for (int i = 0; i < 4; ++i) {
+    src.EmplaceBack(item);
+  }
+  ThreadSafeDeque<std::shared_ptr<int>> dst;
+  src.PopFrontAndAppend(1, dst);
+  dst.Splice(src);
+  std::vector<std::shared_ptr<int>> batch;
+  size_t popped = dst.PopBatch(2, std::back_inserter(batch));
+  ThreadSafeDeque<std::shared_ptr<int>> rest;
+  size_t drained = dst.DrainTo(rest);
+  std::cout << "BULK use_count = " << item.use_count() << " (expected 5), popped = " << popped
+            << ", drained = " << drained << ", src = " << src.Size() << ", dst = " << dst.Size()
+            << ", rest = " << rest.Size() << std::endl;
+}
+
+// ThreadSafeDeque和MpmcQueue的统一接口
+struct DequeAdapter {
+  ThreadSafeDeque<uint64_t> q;
+
+  bool TryPush(uint64_t v) {
+    q.PushBack(v);
+    return true;
+  }
+
+  bool TryPop(uint64_t &v) { return q.TryPopFront(v); }
+};
+
+struct MpmcAdapter {
+  MpmcAdapter() : q(1024) {}
+
+  MpmcQueue<uint64_t> q;
+
+  bool TryPush(uint64_t v) { return q.TryPush(v); }
+
+  bool TryPop(uint64_t &v) { return q.TryPop(v); }
+};
+
+// n个生产者和n个消费者同时操作一个队列
+template <typename Queue>
+void bench_queue(const std::string &name, size_t n) {
+  Queue queue;
+  std::atomic<size_t> consumed{0};
+  size_t per_producer = BENCH_ITEMS / n;
+  size_t total = per_producer * n;
+  std::vector<std::thread> threads;
+  uint64_t begin = GetCurrentUs();
+  for (size_t i = 0; i < n; ++i) {
+    threads.emplace_back([&queue, per_producer]() {
+      for (size_t k = 0; k < per_producer; ++k) {
+        while (!queue.TryPush(k)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+    threads.emplace_back([&queue, &consumed, total]() {
+      uint64_t v;
+      while (consumed.load(std::memory_order_relaxed) < total) {
+        if (queue.TryPop(v)) {
+          consumed.fetch_add(1, std::memory_order_relaxed);
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  double rate = total * 1e6 / (GetCurrentUs() - begin);
+  printf("%-8s producers = consumers = %zu, %10.0f ops/s\n", name.c_str(), n, rate);
+}
+
+// 生产者和消费者分别绑定到不同的cpu上，测试单生产者单消费者队列的吞吐量
+template <bool Batched>
+void bench_spsc(const std::string &name) {
+  SpscRing<uint64_t> ring(4096);
+  bool pin = std::thread::hardware_concurrency() > 1;
+  uint64_t begin = GetCurrentUs();
+  std::thread producer([&ring, pin]() {
+    if (pin) {
+      Thread::SetCurrentAffinity(std::vector<int>{0});
+    }
+    uint64_t buf[BENCH_SPSC_BATCH];
+    for (uint64_t i = 0; i < BENCH_SPSC_ITEMS;) {
+      if (Batched) {
+        size_t n = 0;
+        for (; n < BENCH_SPSC_BATCH; ++n) {
+          buf[n] = i + n;
+        }
+        size_t pushed = ring.TryPushBatch(buf, buf + n);
+        i += pushed;
+        if (pushed == 0) {
+          std::this_thread::yield();
+        }
+      } else if (ring.TryPush(i)) {
+        ++i;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  });
+  std::thread consumer([&ring, pin]() {
+    if (pin) {
+      Thread::SetCurrentAffinity(std::vector<int>{1});
+    }
+    uint64_t sum = 0;
+    for (uint64_t received = 0; received < BENCH_SPSC_ITEMS;) {
+      size_t n = 0;
+      if (Batched) {
+        n = ring.ConsumeBatch([&sum](uint64_t &v) { sum += v; }, BENCH_SPSC_BATCH);
+      } else {
+        uint64_t v;
+        if (ring.TryPop(v)) {
+          sum += v;
+          n = 1;
+        }
+      }
+      received += n;
+      if (n == 0) {
+        std::this_thread::yield();
+      }
+    }
+    if (sum != BENCH_SPSC_ITEMS * (BENCH_SPSC_ITEMS - 1) / 2) {
+      printf("SPSC sum mismatch\n");
+    }
+  });
+  producer.join();
+  consumer.join();
+  double rate = BENCH_SPSC_ITEMS * 1e6 / (GetCurrentUs() - begin);
+  printf("%-12s %s, %12.0f msgs/s\n", name.c_str(), pin ? "pinned to cpu 0/1" : "single cpu", rate);
+}
+
+void bench_containers() {
+  bench_spsc<false>("spsc");
+  bench_spsc<true>("spsc-batch");
+  for (size_t n = 1; n <= BENCH_MAX_THREADS; n *= 2) {
+    bench_queue<DequeAdapter>("deque", n);
+    bench_queue<MpmcAdapter>("mpmc", n);
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && std::string(argv[1]) == "bench") {
+    bench_containers();
+    return 0;
+  }
+  test_mpmc();
+
   ThreadSafeDeque<int> d;
   d.PushBack(1);
   d.PushBack(2);
@@ -87,5 +306,6 @@ int main() {
   }
   std::cout << std::endl;
 
+  test_bulk_moves();
   return 0;
 }
\ No newline at end of file
@@ -1,5 +1,8 @@
 #include "coscheduler.h"
 
+#include <atomic>
+#include <map>
+#include <set>
 #include <thread>
 #include <chrono>
 using std::chrono::milliseconds;
@@ -75,8 +78,223 @@ void test_coshed_dispatcher() {
   t.Join();
 }
 
-int main() {
+// 测试弹性扩缩容
+CoExecutor::RecoveryEntry g_entries[4];
+std::atomic<int> g_held_resumed{0};
+
+void test_elastic_scaling() {
+  co_sched->SetElasticPolicy(4, 5 * 1000, 500);
+  Thread t([]() {
+    for (int i = 0; i < 200; ++i) {
+      co_sched->SchedulerTask(std::function<void()>([]() {
+        uint64_t begin = GetCurrentUs();
+        while (GetCurrentUs() - begin < 2000) {
+        }
+      }));
+    }
+    usleep(600 * 1000);
+    // 挂起一些任务，扩容出来的执行器退出时会转交给其它执行器
+    for (int i = 0; i < 4; ++i) {
+      co_sched->SchedulerTask(std::function<void()>([i]() {
+        std::cout << "HELD task-" << i << " holding on executor-" << CoExecutor::GetCurrentExecutor()->Id()
+                  << std::endl;
+        CoExecutor::Hold(g_entries[i]);
+        std::cout << "HELD task-" << i << " resumed on executor-" << CoExecutor::GetCurrentExecutor()->Id()
+                  << std::endl;
+        g_held_resumed.fetch_add(1);
+      }));
+    }
+    // 等到扩容的执行器都退出，并且超过主执行器的空闲超时时间
+    for (int i = 0; i < 50; ++i) {
+      usleep(100 * 1000);
+      std::cout << "EXECUTOR COUNT = " << co_sched->GetExecutorCount() << std::endl;
+    }
+    for (auto &entry : g_entries) {
+      CoExecutor::Wakeup(entry);
+    }
+  });
+  co_sched->Start(1, 4);
+  t.Join();
+  std::cout << "HELD resumed = " << g_held_resumed.load() << " (expected 4)" << std::endl;
+}
+
+// 测试阻塞执行器中的任务被转移
+void test_blocked_executor_handoff() {
+  co_sched->SetPlacementPolicy(std::make_shared<CallerLocalPlacement>());
+  Thread t([]() {
+    usleep(100 * 1000);
+    co_sched->SchedulerTask(std::function<void()>([]() {
+      // 在当前执行器中添加任务，然后阻塞当前执行器
+      for (int i = 0; i < 10; ++i) {
+        uint64_t submit_us = GetCurrentUs();
+        co_sched->SchedulerTask(std::function<void()>([i, submit_us]() {
+          std::cout << "SHORT task-" << i << " waited " << (GetCurrentUs() - submit_us) / 1000
+                    << "ms" << std::endl;
+        }));
+      }
+      std::cout << "BLOCKER sleeping 300ms in thread-" << GetThreadId() << std::endl;
+      co_sleep(300);
+      std::cout << "BLOCKER done" << std::endl;
+    }));
+  });
+  co_sched->Start(2, 3);
+  t.Join();
+}
+
+// 测试执行器组
+void test_executor_groups() {
+  co_sched->CreateGroup("io", 1);
+  co_sched->CreateGroup("compute", 2);
+  Thread t([]() {
+    usleep(100 * 1000);
+    // 计算任务放到compute组，不会影响io组中任务的延迟
+    for (int i = 0; i < 6; ++i) {
+      co_sched->SchedulerTask("compute", std::function<void()>([i]() {
+        uint64_t begin = GetCurrentUs();
+        while (GetCurrentUs() - begin < 50 * 1000) {
+        }
+        std::cout << "COMPUTE task-" << i << " done in thread-" << GetThreadId() << std::endl;
+      }));
+    }
+    for (int i = 0; i < 5; ++i) {
+      uint64_t submit_us = GetCurrentUs();
+      co_sched->SchedulerTask("io", std::function<void()>([i, submit_us]() {
+        std::cout << "IO task-" << i << " waited " << (GetCurrentUs() - submit_us)
+                  << "us in thread-" << GetThreadId() << std::endl;
+        // 切换到compute组做一段计算，然后回到io组
+        {
+          GroupSwitchGuard guard("compute");
+          std::cout << "IO task-" << i << " hopped to thread-" << GetThreadId() << " ("
+                    << CoExecutor::GetCurrentExecutor()->GetGroupName() << ")" << std::endl;
+        }
+        std::cout << "IO task-" << i << " back in thread-" << GetThreadId() << " ("
+                  << CoExecutor::GetCurrentExecutor()->GetGroupName() << ")" << std::endl;
+      }));
+      usleep(20 * 1000);
+    }
+  });
+  co_sched->Start(1);
+  t.Join();
+}
+
+// 测试相同key的任务在同一个执行器中执行
+void test_key_affinity() {
+  Thread t([]() {
+    usleep(100 * 1000);
+    std::mutex mtx;
+    std::map<uint64_t, std::set<int32_t>> key_executors;
+    for (int i = 0; i < 60; ++i) {
+      uint64_t key = i % 6;
+      co_sched->SchedulerTask(key, std::function<void()>([key, &mtx, &key_executors]() {
+        // 绑定的任务也会被阻塞检测和均衡任务跳过
+        uint64_t begin = GetCurrentUs();
+        while (GetCurrentUs() - begin < 8 * 1000) {
+        }
+        std::lock_guard<std::mutex> lk(mtx);
+        key_executors[key].insert(CoExecutor::GetCurrentExecutor()->Id());
+      }));
+    }
+    usleep(1500 * 1000);
+    std::lock_guard<std::mutex> lk(mtx);
+    for (auto &item : key_executors) {
+      std::cout << "KEY-" << item.first << " ran on " << item.second.size() << " executor(s):";
+      for (auto id : item.second) {
+        std::cout << " " << id;
+      }
+      std::cout << std::endl;
+    }
+  });
+  co_sched->Start(3);
+  t.Join();
+}
+
+// 测试调度器的准入控制
+void test_admission_control() {
+  co_sched->SetAdmissionPolicy(16, CoExecutor::OVERFLOW_BLOCK);
+  co_sched->SetExecutorQueueLimit(8, CoExecutor::OVERFLOW_REJECT);
+  Thread t([]() {
+    usleep(100 * 1000);
+    // 在协程中生产任务，达到调度器上限时挂起生产者协程
+    co_sched->SchedulerTask(std::function<void()>([]() {
+      int failed = 0;
+      for (int i = 0; i < 100; ++i) {
+        if (!co_sched->SchedulerTask(std::function<void()>([]() { usleep(500); }))) {
+          ++failed;
+        }
+        if (co_sched->GetPendingCount() > 17) {
+          std::cout << "PENDING exceeds the limit: " << co_sched->GetPendingCount() << std::endl;
+        }
+      }
+      std::cout << "PRODUCER done, failed = " << failed << std::endl;
+    }));
+    usleep(1000 * 1000);
+    CoScheduler::AdmissionStats stats = co_sched->GetAdmissionStats();
+    std::cout << "ADMISSION admitted = " << stats.admitted << ", rejected = " << stats.rejected
+              << ", shed = " << stats.shed << std::endl;
+  });
+  co_sched->Start(2);
+  t.Join();
+}
+
+// 测试被唤醒的任务迁移到空闲的执行器
+std::atomic<int> g_held_cnt{0};
+
+void test_wakeup_migration() {
+  co_sched->SetPlacementPolicy(std::make_shared<CallerLocalPlacement>());
+  Thread t([]() {
+    usleep(100 * 1000);
+    co_sched->SchedulerTask(std::function<void()>([]() {
+      // 挂起的任务和积压的任务都放在当前执行器中
+      for (int i = 0; i < 4; ++i) {
+        co_sched->SchedulerTask(std::function<void()>([i]() {
+          if (i == 0) {
+            // 线程相关的任务只在原来的线程中恢复
+            this_coroutine::SetThreadAffine();
+          }
+          int32_t held_tid = GetThreadId();
+          g_held_cnt.fetch_add(1);
+          CoExecutor::Hold(g_entries[i]);
+          std::cout << "HELD task-" << i << " held in thread-" << held_tid << ", resumed in thread-"
+                    << GetThreadId() << std::endl;
+        }));
+      }
+      for (int i = 0; i < 50; ++i) {
+        co_sched->SchedulerTask(std::function<void()>([]() {
+          uint64_t begin = GetCurrentUs();
+          while (GetCurrentUs() - begin < 2000) {
+          }
+        }));
+      }
+    }));
+    while (g_held_cnt.load() < 4) {
+      usleep(1000);
+    }
+    usleep(5 * 1000);
+    for (auto &entry : g_entries) {
+      CoExecutor::Wakeup(entry);
+    }
+    usleep(500 * 1000);
+  });
+  co_sched->Start(3);
+  t.Join();
+}
+
+int main(int argc, char **argv) {
   // primary_cosched_test();
-  test_coshed_dispatcher();
+  if (argc > 1 && std::string(argv[1]) == "elastic") {
+    test_elastic_scaling();
+  } else if (argc > 1 && std::string(argv[1]) == "sysmon") {
+    test_blocked_executor_handoff();
+  } else if (argc > 1 && std::string(argv[1]) == "groups") {
+    test_executor_groups();
+  } else if (argc > 1 && std::string(argv[1]) == "affinity") {
+    test_key_affinity();
+  } else if (argc > 1 && std::string(argv[1]) == "admission") {
+    test_admission_control();
+  } else if (argc > 1 && std::string(argv[1]) == "migrate") {
+    test_wakeup_migration();
+  } else {
+    test_coshed_dispatcher();
+  }
   return 0;
 }
\ No newline at end of file
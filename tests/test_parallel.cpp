@@ -0,0 +1,127 @@
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "parallel.h"
+
+using namespace ahri;
+
+#define BENCH_ELEMENTS (1 << 24)
+#define BENCH_MAX_EXECUTORS 8
+
+// 测试并行循环、归约和异常传递
+void test_parallel_basic() {
+  Thread t([]() {
+    usleep(100 * 1000);
+    // 在协程中调用，等待时换出协程
+    co_sched->SchedulerTask(std::function<void()>([]() {
+      std::vector<int> data(10000);
+      ParallelFor(0, data.size(), 100, [&data](size_t b, size_t e) {
+        for (size_t i = b; i < e; ++i) {
+          data[i] = (int) i;
+        }
+      });
+      long long sum = ParallelReduce<long long>(0, data.size(), 0, 0LL,
+          [&data](size_t b, size_t e) {
+            long long s = 0;
+            for (size_t i = b; i < e; ++i) {
+              s += data[i];
+            }
+            return s;
+          },
+          [](const long long &a, const long long &b) { return a + b; });
+      std::cout << "PARALLEL sum = " << sum << ", expected = " << 9999LL * 10000 / 2 << std::endl;
+      // 归约保持块的顺序，只要求结合律
+      std::string joined = ParallelReduce<std::string>(0, 26, 1, std::string(),
+          [](size_t b, size_t e) {
+            std::string s;
+            for (size_t i = b; i < e; ++i) {
+              s.push_back((char) ('a' + i));
+            }
+            return s;
+          },
+          [](const std::string &a, const std::string &b) { return a + b; });
+      std::cout << "PARALLEL joined = " << joined << std::endl;
+    }));
+    usleep(300 * 1000);
+    // 在普通线程中调用，阻塞等待
+    std::atomic<int> invoked{0};
+    ParallelInvoke({[&invoked]() { invoked.fetch_add(1); },
+                    [&invoked]() { invoked.fetch_add(10); },
+                    [&invoked]() { invoked.fetch_add(100); }});
+    std::cout << "PARALLEL invoked = " << invoked.load() << std::endl;
+    try {
+      ParallelFor(0, 8, 1, [](size_t b, size_t) {
+        if (b == 5) {
+          throw std::runtime_error("chunk 5 failed");
+        }
+      });
+    } catch (const std::exception &ex) {
+      std::cout << "PARALLEL caught: " << ex.what() << std::endl;
+    }
+    // 线程相关的协程不能换出，在只有一个执行器的组中等待时阻塞了唯一的执行器，块由调用者自己执行
+    std::atomic<bool> affine_done{false};
+    co_sched->SchedulerTask("single", std::function<void()>([&affine_done]() {
+      this_coroutine::SetThreadAffine();
+      std::atomic<size_t> covered{0};
+      ParallelFor(0, 1000, 10, [&covered](size_t b, size_t e) { covered.fetch_add(e - b); }, "single");
+      std::cout << "PARALLEL thread affine covered = " << covered.load() << " (expected 1000)" << std::endl;
+      affine_done = true;
+    }));
+    while (!affine_done) {
+      usleep(10 * 1000);
+    }
+  });
+  co_sched->CreateGroup("single", 1);
+  co_sched->Start(3);
+  t.Join();
+}
+
+// 用不同大小的执行器组比较ParallelReduce的扩展性
+void bench_parallel_scaling() {
+  std::vector<size_t> sizes;
+  for (size_t n = 1; n <= BENCH_MAX_EXECUTORS; n *= 2) {
+    sizes.push_back(n);
+    co_sched->CreateGroup("p" + std::to_string(n), n);
+  }
+  Thread t([&sizes]() {
+    usleep(100 * 1000);
+    std::vector<std::string> report;
+    double base_ms = 0;
+    for (size_t n : sizes) {
+      std::string group = "p" + std::to_string(n);
+      uint64_t begin = GetCurrentUs();
+      double sum = ParallelReduce<double>(0, BENCH_ELEMENTS, BENCH_ELEMENTS / (n * PARALLEL_CHUNKS_PER_EXECUTOR), 0.0,
+          [](size_t b, size_t e) {
+            double s = 0;
+            for (size_t i = b; i < e; ++i) {
+              s += std::sqrt((double) i);
+            }
+            return s;
+          },
+          [](const double &a, const double &b) { return a + b; }, group);
+      double ms = (GetCurrentUs() - begin) / 1000.0;
+      if (n == 1) {
+        base_ms = ms;
+      }
+      report.push_back("SCALING executors = " + std::to_string(n) + ", time = " + std::to_string(ms) +
+                       "ms, speedup = " + std::to_string(base_ms / ms) + ", sum = " + std::to_string(sum));
+    }
+    for (auto &line : report) {
+      std::cout << line << std::endl;
+    }
+  });
+  co_sched->Start(1);
+  t.Join();
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && std::string(argv[1]) == "bench") {
+    bench_parallel_scaling();
+  } else {
+    test_parallel_basic();
+  }
+  return 0;
+}
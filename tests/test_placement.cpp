@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "coexecutor.h"
+#include "placement.h"
+#include "thread.h"
+
+using namespace ahri;
+
+// 比较不同放置策略在任务耗时不均匀时的排队延迟
+// 90%的任务执行50us，10%的任务执行2ms
+
+#define N_EXECUTORS 4
+#define N_TASKS 2000
+#define SUBMIT_INTERVAL_US 400
+
+void busy_for(uint64_t us) {
+  uint64_t begin = GetCurrentUs();
+  while (GetCurrentUs() - begin < us) {
+  }
+}
+
+void bench_policy(PlacementPolicy &policy) {
+  std::vector<CoExecutor::Ptr> executors;
+  std::vector<Thread::Ptr> threads;
+  for (int i = 0; i < N_EXECUTORS; ++i) {
+    CoExecutor::Ptr executor(new CoExecutor(i + 1));
+    executors.push_back(executor);
+    threads.push_back(std::make_shared<Thread>([executor]() { executor->Process(300); },
+                                               "bench-" + std::to_string(i)));
+  }
+  std::vector<uint64_t> delays(N_TASKS, 0);
+  for (int i = 0; i < N_TASKS; ++i) {
+    uint64_t submit_us = GetCurrentUs();
+    uint64_t cost_us = (i % 10 == 0) ? 2000 : 50;
+    uint64_t *delay = &delays[i];
+    size_t idx = policy.Pick(executors);
+    executors[idx]->AddTask(std::function<void()>([submit_us, cost_us, delay]() {
+      *delay = GetCurrentUs() - submit_us;
+      busy_for(cost_us);
+    }));
+    busy_for(SUBMIT_INTERVAL_US);
+  }
+  for (auto &t : threads) {
+    t->Join();
+  }
+  std::sort(delays.begin(), delays.end());
+  std::cerr << policy.Name() << ": p50=" << delays[N_TASKS / 2] << "us p99="
+            << delays[N_TASKS * 99 / 100] << "us max=" << delays.back() << "us" << std::endl;
+}
+
+// 一致性哈希环在增减执行器时只有少量key改变归属
+void test_hash_ring_remap() {
+  const uint64_t n_keys = 100000;
+  ConsistentHashRing ring;
+  std::vector<CoExecutor::Ptr> executors;
+  for (int i = 0; i < 4; ++i) {
+    executors.push_back(std::make_shared<CoExecutor>(i));
+    ring.Add(executors.back());
+  }
+  std::vector<int32_t> before(n_keys);
+  std::vector<size_t> counts(executors.size(), 0);
+  for (uint64_t key = 0; key < n_keys; ++key) {
+    before[key] = ring.Lookup(key)->Id();
+    ++counts[before[key]];
+  }
+  for (size_t i = 0; i < counts.size(); ++i) {
+    std::cout << "executor-" << i << " owns " << counts[i] << " keys" << std::endl;
+  }
+  // 加入第5个执行器，理想情况下1/5的key改变归属
+  CoExecutor::Ptr added = std::make_shared<CoExecutor>(4);
+  ring.Add(added);
+  size_t moved = 0;
+  for (uint64_t key = 0; key < n_keys; ++key) {
+    int32_t id = ring.Lookup(key)->Id();
+    if (id != before[key]) {
+      ++moved;
+      AHRI_ASSERT(id == added->Id());  // 只能移到新的执行器上
+    }
+  }
+  std::cout << "add executor: " << moved * 100.0 / n_keys << "% keys moved" << std::endl;
+  // 移除新加的执行器，所有key回到原来的执行器
+  ring.Remove(added);
+  for (uint64_t key = 0; key < n_keys; ++key) {
+    AHRI_ASSERT(ring.Lookup(key)->Id() == before[key]);
+  }
+  std::cout << "remove executor: all keys restored" << std::endl;
+}
+
+// 绑核的执行器是所在L3缓存下唯一的执行器，积压的任务较多时新任务放到其它执行器
+void test_local_spill() {
+  std::vector<CoExecutor::Ptr> executors;
+  for (int i = 0; i < 4; ++i) {
+    executors.push_back(std::make_shared<CoExecutor>(i));
+  }
+  CoExecutor::Ptr local = executors[0];
+  PowerOfTwoPlacement policy;
+  local->AddTask(std::function<void()>([&executors, &policy, local]() {
+    size_t spilled = 0;
+    for (int i = 0; i < 100; ++i) {
+      spilled += executors[policy.Pick(executors)] != local ? 1 : 0;
+    }
+    std::cout << "local spill: l3 = " << local->GetL3Id() << ", queue depth = " << local->GetQueueDepth()
+              << ", spilled " << spilled << "/100 picks" << std::endl;
+  }));
+  for (int i = 0; i < 20; ++i) {
+    local->AddTask(std::function<void()>([]() {}));
+  }
+  Thread t([local]() {
+    local->BindCpu(0);
+    local->Process(50);
+  }, "spill");
+  t.Join();
+}
+
+int main() {
+  test_hash_ring_remap();
+  test_local_spill();
+  RandomPlacement random;
+  RoundRobinPlacement round_robin;
+  PowerOfTwoPlacement power_of_two;
+  CallerLocalPlacement caller_local;
+  bench_policy(random);
+  bench_policy(round_robin);
+  bench_policy(power_of_two);
+  bench_policy(caller_local);
+  return 0;
+}
@@ -0,0 +1,135 @@
+#include <atomic>
+#include <iostream>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "coexecutor.h"
+#include "containers.hpp"
+#include "slab.hpp"
+
+using namespace ahri;
+
+#define N_OBJECTS 100000
+#define N_ROUNDS 20
+
+struct Item : public SlabAllocated<Item> {
+  uint64_t id;
+  char payload[104];
+
+  explicit Item(uint64_t i) : id(i) {}
+};
+
+struct PlainItem {
+  uint64_t id;
+  char payload[104];
+
+  explicit PlainItem(uint64_t i) : id(i) {}
+};
+
+// 测试同一线程中分配的地址不重复，释放后的地址被重复使用
+void test_reuse() {
+  typedef SlabFor<Item>::Pool Pool;
+  std::vector<Item *> items;
+  std::set<Item *> addrs;
+  for (uint64_t i = 0; i < 1000; ++i) {
+    items.push_back(new Item(i));
+    addrs.insert(items.back());
+  }
+  size_t slabs = Pool::GetSlabCount();
+  for (Item *item : items) {
+    delete item;
+  }
+  items.clear();
+  size_t reused = 0;
+  for (uint64_t i = 0; i < 1000; ++i) {
+    items.push_back(new Item(i));
+    reused += addrs.count(items.back());
+  }
+  for (Item *item : items) {
+    delete item;
+  }
+  std::cout << "REUSE: unique = " << addrs.size() << ", reused = " << reused << ", slabs = " << slabs
+            << " -> " << Pool::GetSlabCount() << std::endl;
+}
+
+// 测试在一个线程分配、在另一个线程释放，释放的对象经过仓库回到分配的线程
+void test_cross_thread_free() {
+  typedef SlabFor<Item>::Pool Pool;
+  MpscQueue<Item *> queue;
+  std::atomic<bool> done{false};
+  std::atomic<uint64_t> freed{0};
+  std::thread consumer([&queue, &done, &freed]() {
+    while (!done.load() || !queue.Empty()) {
+      freed += queue.ConsumeAll([](Item *item) { delete item; });
+    }
+  });
+  size_t slabs = Pool::GetSlabCount();
+  for (int r = 0; r < N_ROUNDS; ++r) {
+    for (uint64_t i = 0; i < N_OBJECTS / N_ROUNDS; ++i) {
+      queue.Push(new Item(i));
+    }
+  }
+  done = true;
+  consumer.join();
+  std::cout << "CROSS THREAD: freed = " << freed.load() << ", new slabs = " << Pool::GetSlabCount() - slabs
+            << ", depot exchanges = " << Pool::GetDepotExchangeCount() << std::endl;
+}
+
+// 测试任务对象从slab分配
+void test_task_objects() {
+  typedef SlabFor<CoExecutor::CoTask>::Pool Pool;
+  CoExecutor exec(1);
+  std::atomic<int> ran{0};
+  for (int i = 0; i < 1000; ++i) {
+    exec.AddTask(std::function<void()>([&ran]() { ran.fetch_add(1); }));
+  }
+  exec.Process(50);
+  std::cout << "TASKS: ran = " << ran.load() << ", task slabs = " << Pool::GetSlabCount() << std::endl;
+}
+
+template <typename T>
+uint64_t bench_alloc(size_t n_threads) {
+  MpscQueue<T *> queue;
+  std::atomic<bool> done{false};
+  uint64_t begin = GetCurrentUs();
+  std::thread consumer([&queue, &done]() {
+    while (!done.load() || !queue.Empty()) {
+      queue.ConsumeAll([](T *item) { delete item; });
+    }
+  });
+  std::vector<std::thread> producers;
+  for (size_t t = 0; t < n_threads; ++t) {
+    producers.emplace_back([&queue, n_threads]() {
+      for (uint64_t i = 0; i < N_OBJECTS * 10 / n_threads; ++i) {
+        queue.Push(new T(i));
+      }
+    });
+  }
+  for (auto &t : producers) {
+    t.join();
+  }
+  done = true;
+  consumer.join();
+  return (GetCurrentUs() - begin) / 1000;
+}
+
+// 生产者线程分配，消费者线程释放
+void bench() {
+  for (size_t n : {1, 2, 4}) {
+    std::cout << "BENCH producers = " << n << ": malloc = " << bench_alloc<PlainItem>(n)
+              << "ms, slab = " << bench_alloc<Item>(n) << "ms" << std::endl;
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && std::string(argv[1]) == "bench") {
+    bench();
+    return 0;
+  }
+  test_reuse();
+  test_cross_thread_free();
+  test_task_objects();
+  return 0;
+}
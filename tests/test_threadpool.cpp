@@ -1,9 +1,17 @@
+#include <atomic>
 #include <chrono>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
 #include "threadpool.h"
 #include "utils.h"
 using namespace std::chrono;
 
+#define BENCH_TASKS 100000
+#define BENCH_FORK_PARENTS 100
+#define BENCH_MAX_WORKERS 64
+
 void f1() {
   int i = 0;
   long j = 0;
@@ -37,7 +45,236 @@ void f3() {
   printf("Running f3 in thread-%d\n", ahri::GetThreadId());
 }
 
-int main() {
+// 测试提交只能移动的任务和获取返回值
+void test_submit() {
+  ahri::ThreadPoolExecutor pool(2);
+  pool.Start();
+  std::unique_ptr<int> owned(new int(40));
+  std::future<int> f = pool.Submit([](std::unique_ptr<int> p, int delta) { return *p + delta; }, std::move(owned), 2);
+  std::cout << "Submit result = " << f.get() << std::endl;
+
+  std::future<void> failed = pool.Submit([]() { throw std::runtime_error("task failed"); });
+  try {
+    failed.get();
+  } catch (const std::exception &ex) {
+    std::cout << "Submit caught: " << ex.what() << std::endl;
+  }
+
+  std::vector<std::function<int()>> batch;
+  for (int i = 0; i < 8; ++i) {
+    batch.push_back([i]() { return i * i; });
+  }
+  auto futures = pool.SubmitAll(batch.begin(), batch.end());
+  int sum = 0;
+  for (auto &fut : futures) {
+    sum += fut.get();
+  }
+  std::cout << "SubmitAll sum = " << sum << std::endl;
+  pool.Stop(true);
+}
+
+// 测试线程数量随任务增加，空闲后回到核心数量
+void test_elastic() {
+  ahri::ThreadPoolExecutor pool(1, 4, 200);
+  pool.Start();
+  std::vector<std::future<void>> futures;
+  for (int i = 0; i < 8; ++i) {
+    futures.push_back(pool.Submit([]() { std::this_thread::sleep_for(milliseconds(100)); }));
+  }
+  std::this_thread::sleep_for(milliseconds(50));
+  size_t busy_size = pool.GetPoolSize();
+  size_t active = pool.GetActiveCount();
+  for (auto &fut : futures) {
+    fut.get();
+  }
+  std::this_thread::sleep_for(milliseconds(500));
+  std::cout << "ELASTIC busy size = " << busy_size << ", active = " << active
+            << ", largest = " << pool.GetLargestPoolSize() << ", idle size = " << pool.GetPoolSize() << std::endl;
+  // 退出的线程留下的位置可以重新创建线程
+  futures.clear();
+  for (int i = 0; i < 4; ++i) {
+    futures.push_back(pool.Submit([]() { std::this_thread::sleep_for(milliseconds(50)); }));
+  }
+  for (auto &fut : futures) {
+    fut.get();
+  }
+  std::cout << "ELASTIC regrown size = " << pool.GetPoolSize() << std::endl;
+  pool.Stop(true);
+}
+
+// 测试依次提交、每次等待完成的任务不会增加线程，空闲的线程池保持核心数量
+void test_elastic_idle() {
+  ahri::ThreadPoolExecutor pool(1, 8, 200);
+  pool.Start();
+  for (int i = 0; i < 8; ++i) {
+    pool.Submit([]() {}).get();
+  }
+  std::cout << "ELASTIC sequential size = " << pool.GetPoolSize() << " (expected " << pool.GetCoreThreads() << ")"
+            << std::endl;
+  pool.Stop(true);
+}
+
+// 测试延迟任务、周期任务和取消
+void test_schedule() {
+  ahri::ThreadPoolExecutor pool(2);
+  pool.Start();
+  uint64_t begin = ahri::GetCurrentMs();
+  std::atomic<uint64_t> delayed_ms{0};
+  pool.ScheduleAfter(milliseconds(100), [&delayed_ms, begin]() { delayed_ms = ahri::GetCurrentMs() - begin; });
+  ahri::ScheduledHandle cancelled = pool.ScheduleAfter(milliseconds(50), []() { printf("cancelled task ran\n"); });
+  cancelled.Cancel();
+  // 先提交的任务更晚到期，定时线程需要被唤醒
+  std::atomic<int> order{0};
+  std::atomic<int> late_order{0};
+  pool.ScheduleAt(ahri::ThreadPoolExecutor::Clock::now() + milliseconds(60), [&order, &late_order]() { late_order = ++order; });
+  pool.ScheduleAfter(milliseconds(30), [&order]() { ++order; });
+  ahri::ScheduledHandle periodic = pool.ScheduleAtFixedRate(milliseconds(20), milliseconds(20), []() {});
+  std::this_thread::sleep_for(milliseconds(210));
+  periodic.Cancel();
+  uint64_t runs = periodic.GetRunCount();
+  std::this_thread::sleep_for(milliseconds(60));
+  std::cout << "SCHEDULE delayed = " << delayed_ms.load() << "ms, cancelled runs = " << cancelled.GetRunCount()
+            << ", later timer order = " << late_order.load() << ", periodic runs = " << runs
+            << ", after cancel = " << periodic.GetRunCount() << ", still scheduled = " << pool.GetScheduledCount()
+            << std::endl;
+  pool.Stop(true);
+}
+
+// 测试取消的定时任务立即释放函数，不再计入定时任务数量
+void test_schedule_cancel() {
+  ahri::ThreadPoolExecutor pool(2);
+  pool.Start();
+  std::shared_ptr<int> captured = std::make_shared<int>(0);
+  std::vector<ahri::ScheduledHandle> handles;
+  for (int i = 0; i < 1000; ++i) {
+    handles.push_back(pool.ScheduleAfter(milliseconds(10000), [captured]() { ++*captured; }));
+  }
+  size_t scheduled = pool.GetScheduledCount();
+  long refs = captured.use_count();
+  for (int i = 0; i < 600; ++i) {
+    handles[i].Cancel();
+  }
+  std::cout << "SCHEDULE CANCEL scheduled = " << scheduled << " -> " << pool.GetScheduledCount()
+            << ", closure refs = " << refs << " -> " << captured.use_count() << std::endl;
+  pool.Stop(true);
+}
+
+// 原来的线程池实现：所有线程共享一个队列，每次提交唤醒所有线程，取任务时复制一次
+class SharedQueuePool {
+public:
+  explicit SharedQueuePool(size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      m_threads.emplace_back([this]() { Runnable(); });
+    }
+  }
+
+  ~SharedQueuePool() {
+    {
+      std::lock_guard<std::mutex> lk(m_mtx);
+      m_stopping = true;
+      m_cv.notify_all();
+    }
+    for (auto &t : m_threads) {
+      t.join();
+    }
+  }
+
+  void SchedulerTask(const std::function<void()> &task) {
+    m_tasks.PushBack(task);
+    std::lock_guard<std::mutex> lk(m_mtx);
+    m_cv.notify_all();
+  }
+
+private:
+  void Runnable() {
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lk(m_mtx);
+        m_cv.wait(lk, [this]() { return !m_tasks.Empty() || m_stopping; });
+        if (m_stopping) {
+          return;
+        }
+      }
+      std::unique_lock<std::mutex> lk(m_tasks.LockRef());
+      if (m_tasks.SizeNoLock() == 0) {
+        continue;
+      }
+      auto fn = m_tasks.FrontNoLock();
+      m_tasks.PopFrontUnsafe();
+      lk.unlock();
+      fn();
+    }
+  }
+
+  ahri::ThreadSafeDeque<std::function<void()>> m_tasks;
+  std::vector<std::thread> m_threads;
+  std::mutex m_mtx;
+  std::condition_variable m_cv;
+  bool m_stopping = false;
+};
+
+void wait_for_count(std::atomic<int> &done, int expected) {
+  while (done.load() < expected) {
+    std::this_thread::yield();
+  }
+}
+
+// 外部线程提交大量小任务，以及任务中再提交子任务两种场景下的吞吐量(任务数/秒)
+template <typename Pool>
+void bench_pool(const std::string &name, size_t n_workers) {
+  std::atomic<int> done{0};
+  double flat_rate, fork_rate;
+  {
+    Pool pool(n_workers);
+    uint64_t begin = ahri::GetCurrentUs();
+    for (int i = 0; i < BENCH_TASKS; ++i) {
+      pool.SchedulerTask([&done]() { done.fetch_add(1); });
+    }
+    wait_for_count(done, BENCH_TASKS);
+    flat_rate = BENCH_TASKS * 1e6 / (ahri::GetCurrentUs() - begin);
+
+    done = 0;
+    const int children = BENCH_TASKS / BENCH_FORK_PARENTS;
+    begin = ahri::GetCurrentUs();
+    for (int i = 0; i < BENCH_FORK_PARENTS; ++i) {
+      pool.SchedulerTask([&pool, &done, children]() {
+        for (int j = 0; j < children; ++j) {
+          pool.SchedulerTask([&done]() { done.fetch_add(1); });
+        }
+      });
+    }
+    wait_for_count(done, BENCH_TASKS);
+    fork_rate = BENCH_TASKS * 1e6 / (ahri::GetCurrentUs() - begin);
+  }
+  printf("%-12s workers = %2zu, flat = %10.0f tasks/s, fork = %10.0f tasks/s\n",
+         name.c_str(), n_workers, flat_rate, fork_rate);
+}
+
+// 让ThreadPoolExecutor和SharedQueuePool有同样的构造和析构方式
+class StealingPool : public ahri::ThreadPoolExecutor {
+public:
+  explicit StealingPool(size_t n) : ahri::ThreadPoolExecutor(n) { Start(); }
+
+  ~StealingPool() { Stop(true); }
+};
+
+void bench_threadpool() {
+  for (size_t n = 1; n <= BENCH_MAX_WORKERS; n *= 2) {
+    bench_pool<SharedQueuePool>("shared-queue", n);
+    bench_pool<StealingPool>("stealing", n);
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && std::string(argv[1]) == "bench") {
+    bench_threadpool();
+    return 0;
+  }
+  test_submit();
+  test_elastic();
+  test_elastic_idle();
+  test_schedule();
+  test_schedule_cancel();
   //  g_threadpool.Start();
   ahri::ThreadPoolExecutor threadpool(4);
   threadpool.Start();
@@ -0,0 +1,82 @@
+#include <fstream>
+#include <iostream>
+#include "utils.h"
+#include "thread.h"
+#include "topology.h"
+#include "coexecutor.h"
+
+using namespace ahri;
+
+void print_cpus(const std::string &name, const std::vector<int> &cpus) {
+  std::cout << name << ": ";
+  for (int cpu : cpus) {
+    std::cout << cpu << " ";
+  }
+  std::cout << std::endl;
+}
+
+void test_parse_cpu_list() {
+  print_cpus("0-3,8,10-11", CpuTopology::ParseCpuList("0-3,8,10-11"));
+  print_cpus("empty", CpuTopology::ParseCpuList(""));
+}
+
+void test_topology() {
+  const CpuTopology &topology = CpuTopology::Get();
+  std::cout << "Online cpus: " << topology.CpuCount() << std::endl;
+  for (auto &info : topology.Cpus()) {
+    std::cout << "cpu-" << info.cpu << " core=" << info.core_id
+              << " package=" << info.package_id << " l3=" << info.l3_id;
+    print_cpus(" siblings", info.siblings);
+  }
+  print_cpus("Isolated", topology.IsolatedCpus());
+  print_cpus("Pick 4", topology.PickCpus(4));
+}
+
+void write_file(const std::string &filename, const std::string &content) {
+  std::ofstream ofs;
+  FileUtils::OpenForWrite(ofs, filename, std::ios_base::out);
+  ofs << content << "\n";
+}
+
+// 两个L3，每个L3下2个物理核，每个物理核2个SMT
+void test_fake_sysfs() {
+  std::string root = "/tmp/ahri_fake_sysfs_" + std::to_string(GetThreadId());
+  write_file(root + "/online", "0-7");
+  write_file(root + "/isolated", "6-7");
+  for (int cpu = 0; cpu < 8; ++cpu) {
+    int core = cpu % 4;  // cpu i和i+4是SMT兄弟
+    std::string dir = root + "/cpu" + std::to_string(cpu);
+    write_file(dir + "/topology/core_id", std::to_string(core));
+    write_file(dir + "/topology/physical_package_id", "0");
+    write_file(dir + "/topology/thread_siblings_list",
+               std::to_string(core) + "," + std::to_string(core + 4));
+    write_file(dir + "/cache/index0/level", "1");
+    write_file(dir + "/cache/index1/level", "3");
+    write_file(dir + "/cache/index1/shared_cpu_list", core < 2 ? "0-1,4-5" : "2-3,6-7");
+  }
+  CpuTopology topology;
+  topology.Load(root);
+  // 期望: 0 1 2 3 4 5 6 7，先物理核再SMT兄弟
+  print_cpus("Fake pick 8", topology.PickCpus(8));
+  print_cpus("Fake isolated", topology.IsolatedCpus());
+  print_cpus("Fake pick isolated", topology.PickCpus(2, topology.IsolatedCpus()));
+  std::cout << "Fake l3 of cpu-6 = " << topology.GetL3Id(6) << std::endl;
+}
+
+void test_affinity() {
+  print_cpus("Affinity before", Thread::GetCurrentAffinity());
+  Thread t([]() {
+    CoExecutor executor(1);
+    executor.BindCpu(CpuTopology::Get().PickCpus(1).front());
+    print_cpus("Affinity in executor thread", Thread::GetCurrentAffinity());
+  }, "affinity");
+  t.Join();
+}
+
+int main() {
+  test_parse_cpu_list();
+  test_topology();
+  test_fake_sysfs();
+  test_affinity();
+  return 0;
+}